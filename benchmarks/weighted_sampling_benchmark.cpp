@@ -0,0 +1,124 @@
+// compares the alias table sampler used for generative layers against the
+// linear scan + std::mt19937 sampler it replaced, and times generating long
+// arrangements from first and second order markov layers
+//
+// build with -DJAMS_BUILD_BENCHMARKS=ON and run
+// ./weighted_sampling_benchmark [num_draws]
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <string>
+
+#include "generative.hpp"
+
+// the sampler generate_sequences used before layers were compiled, kept here
+// verbatim as the baseline
+std::string legacy_sample_string(const LayerChoices &choices,
+                                 std::mt19937 &rng) {
+  unsigned total_weight = 0;
+  for (const auto &[_, weight] : choices) {
+    total_weight += weight;
+  }
+
+  std::uniform_int_distribution<> dist(1, total_weight);
+  unsigned r = dist(rng);
+
+  unsigned cumulative = 0;
+  for (const auto &[str, weight] : choices) {
+    cumulative += weight;
+    if (r <= cumulative) {
+      return str;
+    }
+  }
+
+  return choices.back().first;
+}
+
+LayerChoices make_layer(unsigned int num_choices) {
+  LayerChoices choices;
+  for (unsigned int i = 0; i < num_choices; ++i) {
+    choices.emplace_back(std::string(1, static_cast<char>('A' + i % 26)),
+                         1 + (i * 7) % 13);
+  }
+  return choices;
+}
+
+// every pattern can move to itself or the next two, and pairs that repeat
+// are told to move on
+GenerativeLayer make_markov_layer(unsigned int num_choices, bool second_order) {
+  GenerativeLayer layer;
+  layer.choices = make_layer(num_choices);
+  for (unsigned int i = 0; i < num_choices; ++i) {
+    std::string from(1, static_cast<char>('A' + i % 26));
+    for (unsigned int step = 0; step < 3; ++step) {
+      std::string to(1, static_cast<char>('A' + (i + step) % num_choices % 26));
+      layer.transitions.push_back({{from}, to, 1 + step});
+    }
+    if (second_order) {
+      std::string next(1, static_cast<char>('A' + (i + 1) % num_choices % 26));
+      layer.transitions.push_back({{from, from}, next, 1});
+    }
+  }
+  return layer;
+}
+
+template <typename F> double time_seconds(F &&f) {
+  auto start = std::chrono::steady_clock::now();
+  f();
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                       start)
+      .count();
+}
+
+int main(int argc, char *argv[]) {
+  std::uint64_t num_draws = 10'000'000;
+  if (argc > 1)
+    num_draws = std::stoull(argv[1]);
+
+  for (unsigned int num_choices : {2u, 4u, 8u, 26u}) {
+    LayerChoices choices = make_layer(num_choices);
+    CompiledLayer layer = compile_layer({choices, {}});
+
+    // checksums stop the compiler from dropping the loops
+    std::uint64_t legacy_checksum = 0, alias_checksum = 0;
+
+    double legacy_sec = time_seconds([&]() {
+      std::mt19937 rng(1234);
+      for (std::uint64_t i = 0; i < num_draws; ++i)
+        legacy_checksum += legacy_sample_string(choices, rng)[0];
+    });
+
+    double alias_sec = time_seconds([&]() {
+      Xoshiro256 rng(1234);
+      for (std::uint64_t i = 0; i < num_draws; ++i)
+        alias_checksum += layer.sample(rng)[0];
+    });
+
+    std::cout << num_choices << " choices, " << num_draws << " draws: "
+              << "legacy " << legacy_sec * 1e9 / num_draws << " ns/draw, "
+              << "alias " << alias_sec * 1e9 / num_draws << " ns/draw, "
+              << "speedup " << legacy_sec / alias_sec << "x"
+              << " (checksums " << legacy_checksum << " " << alias_checksum
+              << ")\n";
+  }
+
+  const std::size_t num_blocks = 1'000'000;
+  for (bool second_order : {false, true}) {
+    CompiledLayer layer = compile_layer(make_markov_layer(16, second_order));
+    Xoshiro256 rng(1234);
+    std::uint64_t checksum = 0;
+
+    double sec = time_seconds([&]() {
+      for (std::uint32_t id : generate_pattern_ids(layer, num_blocks, rng))
+        checksum += id;
+    });
+
+    std::cout << "order " << layer.order() << " markov layer, " << num_blocks
+              << " blocks: " << sec * 1e3 << " ms (checksum " << checksum
+              << ")\n";
+  }
+
+  return 0;
+}
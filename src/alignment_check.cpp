@@ -0,0 +1,143 @@
+#include "alignment_check.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+#include "audio_engine.hpp"
+#include "synth.hpp"
+
+namespace {
+
+using clock = std::chrono::steady_clock;
+
+// about what a device asks for at a time
+constexpr std::uint64_t block_frames = 256;
+// a hit starts on its first sample this loud after this long of silence,
+// every note is over well before the next beat
+constexpr float onset_threshold = 1e-6f;
+constexpr std::uint64_t silence_frames = 480;
+
+constexpr std::uint8_t synth_channel = 0;
+constexpr std::uint8_t midi_channel = 1;
+
+// a short note on both channels on every beat
+CompiledSong hits_on_every_beat(const AlignmentCheckSettings &settings) {
+  CompiledSong song;
+  song.bpm = static_cast<unsigned int>(settings.bpm);
+  song.num_bars = static_cast<unsigned int>(settings.num_bars);
+  const double beat_sec = 60.0 / settings.bpm;
+  const int num_beats = settings.num_bars * 4;
+  song.duration_sec = num_beats * beat_sec;
+  for (int beat = 0; beat < num_beats; ++beat) {
+    const double time_sec = beat * beat_sec;
+    for (std::uint8_t channel : {synth_channel, midi_channel}) {
+      song.events.push_back(
+          {time_sec, static_cast<std::uint8_t>(0x90 | channel), 60, 100});
+      song.events.push_back({time_sec + beat_sec / 4,
+                             static_cast<std::uint8_t>(0x80 | channel), 60,
+                             0});
+    }
+  }
+  std::stable_sort(song.events.begin(), song.events.end(),
+                   [](const TimedMidiEvent &a, const TimedMidiEvent &b) {
+                     return a.time_sec < b.time_sec;
+                   });
+  return song;
+}
+
+bool is_loud(const float *frame) {
+  return std::abs(frame[0]) >= onset_threshold ||
+         std::abs(frame[1]) >= onset_threshold;
+}
+
+} // namespace
+
+AlignmentCheckResult check_alignment(const AlignmentCheckSettings &settings) {
+  AlignmentCheckResult result;
+  const CompiledSong song = hits_on_every_beat(settings);
+  result.num_hits = static_cast<std::uint64_t>(settings.num_bars) * 4;
+
+  AudioEngine audio(AudioBackend::offline);
+  ma_engine &engine = audio.get();
+  result.sample_rate = ma_engine_get_sample_rate(&engine);
+
+  // the capture sink, only the sending thread touches it until it's stopped
+  std::vector<clock::time_point> sent;
+  sent.reserve(4 * result.num_hits);
+  Synth synth(result.sample_rate);
+  FramedMidiSender sender(
+      [&sent](std::vector<unsigned char> &message) {
+        if ((message[0] & 0xF0) == 0x90 && message[2] > 0)
+          sent.push_back(clock::now());
+      },
+      synth.get_frame_clock(), result.sample_rate);
+
+  FrameSchedulerOutputs outputs;
+  outputs.midi_channels = 1 << midi_channel;
+  outputs.midi_events = &sender.get_events();
+  outputs.latency = settings.latency;
+  FrameScheduler scheduler(song, result.sample_rate, outputs);
+  // the perc program dies away well within a beat
+  synth.set_program(synth_channel + 1, 6);
+  synth.set_event_source(&scheduler);
+  synth.attach(engine);
+  sender.start();
+
+  // one pass, and the delay the latest output's events come after their
+  // place in it, short of the next pass's first hit
+  const std::uint64_t end_frame =
+      static_cast<std::uint64_t>(
+          std::llround(song.duration_sec * result.sample_rate)) +
+      std::max(scheduler.get_synth_delay_frames(),
+               scheduler.get_midi_delay_frames());
+  std::vector<float> mixed(2 * end_frame);
+  std::vector<clock::time_point> block_times;
+  const clock::time_point start = clock::now();
+  for (std::uint64_t frame = 0; frame < end_frame; frame += block_frames) {
+    const auto due = start + std::chrono::duration_cast<clock::duration>(
+                                 std::chrono::duration<double>(
+                                     frame / result.sample_rate));
+    std::this_thread::sleep_until(due);
+    block_times.push_back(clock::now());
+    audio.read(mixed.data() + 2 * frame,
+               std::min(block_frames, end_frame - frame));
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  sender.stop();
+  synth.detach();
+
+  // when each onset was rendered, which is when the sender takes its frame
+  // to be rendered too
+  std::vector<clock::time_point> onsets;
+  std::uint64_t quiet = silence_frames;
+  for (std::uint64_t frame = 0; frame < end_frame; ++frame) {
+    if (!is_loud(mixed.data() + 2 * frame)) {
+      ++quiet;
+      continue;
+    }
+    if (quiet >= silence_frames) {
+      const double offset_sec =
+          (frame % block_frames) / result.sample_rate;
+      onsets.push_back(block_times[frame / block_frames] +
+                       std::chrono::duration_cast<clock::duration>(
+                           std::chrono::duration<double>(offset_sec)));
+    }
+    quiet = 0;
+  }
+
+  result.num_onsets_found = std::min<std::uint64_t>(onsets.size(),
+                                                    result.num_hits);
+  result.num_midi_sent = std::min<std::uint64_t>(sent.size(), result.num_hits);
+  const double latency_sec =
+      settings.latency.midi_sec - settings.latency.audio_sec;
+  for (std::uint64_t hit = 0;
+       hit < std::min(result.num_onsets_found, result.num_midi_sent); ++hit) {
+    result.errors.add(
+        std::chrono::duration<double>(sent[hit] - onsets[hit]).count() +
+        latency_sec);
+  }
+  return result;
+}
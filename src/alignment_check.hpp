@@ -0,0 +1,41 @@
+#ifndef ALIGNMENT_CHECK_HPP
+#define ALIGNMENT_CHECK_HPP
+
+#include <cstdint>
+
+#include "frame_scheduler.hpp"
+#include "stats.hpp"
+
+struct AlignmentCheckSettings {
+  double bpm = 120;
+  int num_bars = 2;
+  // what the outputs are taken to add, the midi output being the slower one
+  // by default so it's the synth that has to wait
+  OutputLatency latency = {0.010, 0.025};
+};
+
+struct AlignmentCheckResult {
+  double sample_rate = 0;
+  // hits played on both outputs at once
+  std::uint64_t num_hits = 0;
+  // hits whose start was found in the synth's audio
+  std::uint64_t num_onsets_found = 0;
+  // hits that came out of the midi sender
+  std::uint64_t num_midi_sent = 0;
+  // when each hit was heard over midi less when it was heard from the synth,
+  // in seconds, taking each output's latency to be what the settings say
+  RunningStats errors;
+};
+
+// plays a song with a hit on every beat on both a synth channel and a midi
+// channel through a FrameScheduler and a FramedMidiSender, with no sound card
+// or midi port: an offline engine is read a block at a time at the pace a
+// device would read it, the synth's audio is kept to find where each hit
+// starts and the sender hands its messages to a capture sink that notes when
+// each one went out
+//
+// throws when the engine can't be started
+AlignmentCheckResult
+check_alignment(const AlignmentCheckSettings &settings = {});
+
+#endif // ALIGNMENT_CHECK_HPP
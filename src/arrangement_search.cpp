@@ -0,0 +1,200 @@
+#include "arrangement_search.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace {
+
+// one slot of the search is one layer in one block
+struct SearchFrame {
+  std::uint32_t chosen = 0;
+  // 0: nothing tried yet, 1: the weighted draw was tried, 2: trying the rest
+  // of the patterns from remaining
+  std::uint8_t stage = 0;
+  std::uint32_t next_remaining = 0;
+  std::vector<std::uint32_t> remaining;
+
+  // state after this slot, so the next slot can check incrementally
+  std::uint32_t num_playing = 0;      // layers playing in this block so far
+  std::uint32_t covered_channels = 0; // bit c - 1 set when channel c plays
+  std::uint32_t run_length = 0;       // blocks in a row this layer kept it
+};
+
+// every pattern with a positive weight in a random order where heavier
+// patterns tend to come first (efraimidis-spirakis keys)
+void weighted_order(const double *weights, std::size_t n, std::uint32_t skip,
+                    Xoshiro256 &rng, std::vector<std::uint32_t> &out) {
+  std::vector<std::pair<double, std::uint32_t>> keyed;
+  keyed.reserve(n);
+  for (std::uint32_t id = 0; id < n; ++id) {
+    if (id == skip || weights[id] <= 0)
+      continue;
+    double u = 1.0 - rng.next_double(); // (0, 1]
+    keyed.emplace_back(std::log(u) / weights[id], id);
+  }
+  std::sort(keyed.begin(), keyed.end(),
+            [](const auto &a, const auto &b) { return a.first > b.first; });
+  out.clear();
+  for (const auto &[_, id] : keyed)
+    out.push_back(id);
+}
+
+std::uint32_t channel_bit(unsigned int channel) {
+  return channel == 0 ? 0 : 1u << ((channel - 1) & 31);
+}
+
+} // namespace
+
+AllSequences
+search_sequences(const std::vector<CompiledLayer> &layers,
+                 const ArrangementConstraints &constraints,
+                 const std::vector<std::vector<unsigned int>> &pattern_channels,
+                 int target_length, std::uint64_t seed) {
+  const std::size_t num_layers = layers.size();
+  const std::size_t num_blocks = target_length > 0 ? target_length : 0;
+  const std::size_t num_slots = num_layers * num_blocks;
+  if (num_slots == 0)
+    return AllSequences(num_layers);
+
+  std::uint32_t required_channels = 0;
+  for (unsigned int channel : constraints.required_channels)
+    required_channels |= channel_bit(channel);
+
+  // what the layers after a slot could still add to its block, used to prune
+  // partial blocks that can't meet the minimum or the required channels
+  std::vector<std::uint32_t> playable_layers_after(num_layers + 1, 0);
+  std::vector<std::uint32_t> channels_after(num_layers + 1, 0);
+  for (std::size_t l = num_layers; l-- > 0;) {
+    bool can_play = false;
+    std::uint32_t channels = 0;
+    for (unsigned int channel : pattern_channels[l]) {
+      can_play = can_play || channel != 0;
+      channels |= channel_bit(channel);
+    }
+    playable_layers_after[l] = playable_layers_after[l + 1] + can_play;
+    channels_after[l] = channels_after[l + 1] | channels;
+  }
+
+  if ((required_channels & ~channels_after[0]) != 0 ||
+      playable_layers_after[0] < constraints.min_simultaneous_layers) {
+    throw std::runtime_error(
+        "GENERATIVE constraints can't be met by any combination of the "
+        "layers' patterns");
+  }
+
+  // the pattern ids chosen so far, layer-major so a layer's history is
+  // contiguous for the markov lookups
+  std::vector<std::vector<std::uint32_t>> ids(
+      num_layers, std::vector<std::uint32_t>(num_blocks, 0));
+  std::vector<SearchFrame> frames(num_slots);
+  Xoshiro256 rng(seed);
+
+  auto accept = [&](std::size_t slot, std::uint32_t id) {
+    const std::size_t block = slot / num_layers;
+    const std::size_t l = slot % num_layers;
+    SearchFrame &frame = frames[slot];
+
+    const unsigned int channel = pattern_channels[l][id];
+    const bool playing = channel != 0;
+
+    frame.run_length = 1;
+    if (block > 0 && ids[l][block - 1] == id)
+      frame.run_length = frames[slot - num_layers].run_length + 1;
+    if (constraints.max_repeats != 0 && playing &&
+        frame.run_length > constraints.max_repeats)
+      return false;
+
+    const SearchFrame *previous = l == 0 ? nullptr : &frames[slot - 1];
+    frame.num_playing = (previous ? previous->num_playing : 0) + playing;
+    frame.covered_channels = (previous ? previous->covered_channels : 0) |
+                             channel_bit(channel);
+
+    if (constraints.max_simultaneous_layers != 0 &&
+        frame.num_playing > constraints.max_simultaneous_layers)
+      return false;
+    if (frame.num_playing + playable_layers_after[l + 1] <
+        constraints.min_simultaneous_layers)
+      return false;
+    if ((required_channels &
+         ~(frame.covered_channels | channels_after[l + 1])) != 0)
+      return false;
+
+    return true;
+  };
+
+  // the next pattern to try for a slot, false once every one has been tried
+  auto next_candidate = [&](std::size_t slot, std::uint32_t &id) {
+    const std::size_t block = slot / num_layers;
+    const std::size_t l = slot % num_layers;
+    SearchFrame &frame = frames[slot];
+    const CompiledLayer &layer = layers[l];
+
+    if (frame.stage == 0) {
+      // the common case, one alias draw which nearly always fits
+      frame.stage = 1;
+      id = layer.sample_after(ids[l].data(), block, rng);
+      frame.chosen = id;
+      return true;
+    }
+    if (frame.stage == 1) {
+      frame.stage = 2;
+      weighted_order(layer.weights_after(ids[l].data(), block),
+                     layer.pattern_names.size(), frame.chosen, rng,
+                     frame.remaining);
+      frame.next_remaining = 0;
+    }
+    if (frame.next_remaining >= frame.remaining.size())
+      return false;
+    id = frame.remaining[frame.next_remaining++];
+    return true;
+  };
+
+  // backtracking can blow up on constraints that are barely satisfiable, give
+  // up well before that would look like a hang
+  const std::size_t max_search_steps = 256 * num_slots + 1'000'000;
+  std::size_t search_steps = 0;
+
+  std::size_t slot = 0;
+  while (slot < num_slots) {
+    bool placed = false;
+    std::uint32_t id;
+    while (next_candidate(slot, id)) {
+      if (++search_steps > max_search_steps) {
+        throw std::runtime_error(
+            "Gave up searching for an arrangement that meets the GENERATIVE "
+            "constraints, try loosening them");
+      }
+      if (accept(slot, id)) {
+        ids[slot % num_layers][slot / num_layers] = id;
+        placed = true;
+        break;
+      }
+    }
+
+    if (placed) {
+      ++slot;
+      if (slot < num_slots)
+        frames[slot].stage = 0;
+      continue;
+    }
+
+    // nothing fits here, release what this slot allocated and revisit the
+    // previous one
+    frames[slot].remaining.clear();
+    frames[slot].remaining.shrink_to_fit();
+    if (slot == 0) {
+      throw std::runtime_error(
+          "No arrangement meets the GENERATIVE constraints");
+    }
+    --slot;
+  }
+
+  AllSequences sequences(num_layers);
+  for (std::size_t l = 0; l < num_layers; ++l) {
+    sequences[l].reserve(num_blocks);
+    for (std::uint32_t id : ids[l])
+      sequences[l].push_back(layers[l].pattern_names[id]);
+  }
+  return sequences;
+}
@@ -0,0 +1,48 @@
+#ifndef ARRANGEMENT_SEARCH_HPP
+#define ARRANGEMENT_SEARCH_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include "generative.hpp"
+
+// written in the GENERATIVE section under a "- constraints:" header, e.g.
+//
+// - constraints:
+//   - max_simultaneous_layers: 2
+//   - min_simultaneous_layers: 1
+//   - max_repeats: 3
+//   - require_channel: 10
+//
+// a layer counts as playing in a block when it drew a real pattern there (not
+// the blank one), max_repeats limits how many blocks in a row a layer may play
+// the same pattern and every required channel must have a pattern playing on
+// it in every block, 0 means no limit
+struct ArrangementConstraints {
+  unsigned int max_simultaneous_layers = 0;
+  unsigned int min_simultaneous_layers = 0;
+  unsigned int max_repeats = 0;
+  std::vector<unsigned int> required_channels;
+
+  bool empty() const {
+    return max_simultaneous_layers == 0 && min_simultaneous_layers == 0 &&
+           max_repeats == 0 && required_channels.empty();
+  }
+};
+
+// like generate_sequences but every block is checked against the constraints
+// as it is built, a block is filled one layer at a time trying patterns in a
+// weighted random order (so the unconstrained distribution is kept as much as
+// possible), partial blocks that can no longer be completed are pruned and
+// when nothing fits the search backtracks, into earlier blocks if needed,
+// throws when no arrangement is found within the search budget
+//
+// pattern_channels[layer][pattern id] is the channel the pattern plays on, or
+// 0 for the blank pattern
+AllSequences
+search_sequences(const std::vector<CompiledLayer> &layers,
+                 const ArrangementConstraints &constraints,
+                 const std::vector<std::vector<unsigned int>> &pattern_channels,
+                 int target_length, std::uint64_t seed);
+
+#endif // ARRANGEMENT_SEARCH_HPP
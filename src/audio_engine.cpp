@@ -0,0 +1,99 @@
+#include "audio_engine.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+// what the data callback gets as the device's user data, the engine has to
+// come first
+struct AudioEngine::MeteredEngine {
+  ma_engine engine;
+  AudioLoadMeter *meter;
+};
+
+AudioBackend parse_audio_backend(const std::string &name) {
+  if (name == "system")
+    return AudioBackend::system;
+  if (name == "null")
+    return AudioBackend::null;
+  if (name == "offline")
+    return AudioBackend::offline;
+  throw std::runtime_error("Unknown audio backend: " + name +
+                           " (system, null or offline)");
+}
+
+AudioEngine::AudioEngine(AudioBackend backend,
+                         std::uint32_t offline_sample_rate,
+                         std::uint32_t period_frames)
+    : backend(backend), offline_sample_rate(offline_sample_rate),
+      period_frames(period_frames) {}
+
+void AudioEngine::read_metered_engine(ma_device *device, void *frames_out,
+                                      const void *frames_in,
+                                      ma_uint32 frame_count) {
+  (void)frames_in;
+  auto *metered = static_cast<MeteredEngine *>(device->pUserData);
+  const AudioLoadMeter::clock::time_point start = metered->meter->begin();
+  ma_engine_read_pcm_frames(&metered->engine, frames_out, frame_count, NULL);
+  metered->meter->end(start, frame_count, device->sampleRate);
+}
+
+AudioEngine::~AudioEngine() {
+  if (engine)
+    ma_engine_uninit(&engine->engine);
+  if (context)
+    ma_context_uninit(context.get());
+}
+
+ma_engine &AudioEngine::get() {
+  if (engine)
+    return engine->engine;
+
+  ma_engine_config config = ma_engine_config_init();
+  config.dataCallback = read_metered_engine;
+  config.periodSizeInFrames = period_frames;
+  // started once the meter knows the device's buffer
+  config.noAutoStart = MA_TRUE;
+  if (backend == AudioBackend::null) {
+    auto null_context = std::make_unique<ma_context>();
+    const ma_backend backends[] = {ma_backend_null};
+    if (ma_context_init(backends, 1, NULL, null_context.get()) != MA_SUCCESS)
+      throw std::runtime_error("Could not start the null audio backend");
+    context = std::move(null_context);
+    config.pContext = context.get();
+  } else if (backend == AudioBackend::offline) {
+    config.noDevice = MA_TRUE;
+    config.channels = 2;
+    config.sampleRate = offline_sample_rate;
+  }
+
+  auto new_engine = std::make_unique<MeteredEngine>();
+  new_engine->meter = &load_meter;
+  if (ma_engine_init(&config, &new_engine->engine) != MA_SUCCESS)
+    throw std::runtime_error("Could not start audio output");
+
+  ma_device *device = ma_engine_get_device(&new_engine->engine);
+  if (device) {
+    const double period_sec =
+        static_cast<double>(device->playback.internalPeriodSizeInFrames) /
+        device->playback.internalSampleRate;
+    const ma_uint32 num_periods =
+        std::max<ma_uint32>(device->playback.internalPeriods, 2);
+    double late_threshold_sec = period_sec * (num_periods - 1);
+    // the null device only looks at the time every 10 ms
+    if (backend == AudioBackend::null)
+      late_threshold_sec += 0.010;
+    load_meter.set_late_threshold(late_threshold_sec);
+    if (ma_engine_start(&new_engine->engine) != MA_SUCCESS) {
+      ma_engine_uninit(&new_engine->engine);
+      throw std::runtime_error("Could not start audio output");
+    }
+  }
+  engine = std::move(new_engine);
+  return engine->engine;
+}
+
+void AudioEngine::read(float *frames, std::uint64_t num_frames) {
+  if (backend != AudioBackend::offline)
+    throw std::runtime_error("Only an offline engine can be read from");
+  ma_engine_read_pcm_frames(&get(), frames, num_frames, NULL);
+}
@@ -0,0 +1,73 @@
+#ifndef AUDIO_ENGINE_HPP
+#define AUDIO_ENGINE_HPP
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "audio_load_meter.hpp"
+#include "miniaudio/miniaudio.h"
+
+// what the engine plays through
+enum class AudioBackend {
+  // the system's default output
+  system,
+  // miniaudio's null backend, a device that runs in real time on its own
+  // thread and throws the audio away, for machines without a sound card
+  null,
+  // no device at all, nothing plays until read() is called, so everything the
+  // engine mixes can be looked at frame by frame as fast as it can be made
+  offline,
+};
+
+// "system", "null" or "offline", throws on anything else
+AudioBackend parse_audio_backend(const std::string &name);
+
+// the miniaudio engine, only opened the first time something asks for it so
+// that modes that never make a sound (sending midi, rendering to a file) run
+// on machines without any audio
+//
+// with a device the engine is read from a data callback of ours that times
+// every callback into the load meter
+class AudioEngine {
+public:
+  // period_frames is how many frames the device asks for at a time, 0 leaves
+  // it to the backend
+  explicit AudioEngine(AudioBackend backend = AudioBackend::system,
+                       std::uint32_t offline_sample_rate = 48000,
+                       std::uint32_t period_frames = 0);
+  ~AudioEngine();
+
+  AudioEngine(const AudioEngine &) = delete;
+  AudioEngine &operator=(const AudioEngine &) = delete;
+
+  // opens the engine on first use, throws when it can't be
+  ma_engine &get();
+  bool is_open() const { return static_cast<bool>(engine); }
+  AudioBackend get_backend() const { return backend; }
+
+  // is there before the engine opens, so a reader can start collecting from
+  // it on another thread straight away
+  AudioLoadMeter &get_load_meter() { return load_meter; }
+
+  // offline only, mixes the next frames of everything playing into
+  // interleaved stereo and moves the engine's clock on by num_frames
+  void read(float *frames, std::uint64_t num_frames);
+
+private:
+  struct MeteredEngine;
+
+  // the device's data callback, mixes the engine and times it
+  static void read_metered_engine(ma_device *device, void *frames_out,
+                                  const void *frames_in,
+                                  ma_uint32 frame_count);
+
+  AudioBackend backend;
+  std::uint32_t offline_sample_rate;
+  std::uint32_t period_frames;
+  AudioLoadMeter load_meter;
+  std::unique_ptr<ma_context> context;
+  std::unique_ptr<MeteredEngine> engine;
+};
+
+#endif // AUDIO_ENGINE_HPP
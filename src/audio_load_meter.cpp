@@ -0,0 +1,143 @@
+#include "audio_load_meter.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+void AudioLoadStats::print(std::ostream &os) const {
+  if (num_callbacks == 0) {
+    os << "no callbacks";
+    return;
+  }
+  os << frames_per_callback << " frames a callback, load p99 "
+     << recent_p99_load * 100 << "% max " << recent_max_load * 100
+     << "% (recent), mean " << load.mean * 100 << "% max " << load.max * 100
+     << "% over " << num_callbacks << " callbacks, " << num_overloads
+     << " overloads, " << num_late_callbacks << " late callbacks";
+  if (num_dropped > 0)
+    os << ", " << num_dropped << " not measured";
+}
+
+AudioLoadMeter::AudioLoadMeter() {
+  window.reserve(window_size);
+  sorted.reserve(window_size);
+}
+
+void AudioLoadMeter::end(clock::time_point start, std::uint32_t num_frames,
+                         double sample_rate) {
+  const clock::time_point now = clock::now();
+  const double period_sec = num_frames / sample_rate;
+
+  // the device asks for more once it has room, so this callback was due a
+  // period after the last one or at the last one's start, whichever came
+  // later. starting later than that by more than the device has buffered has
+  // left it with nothing to play for a while.
+  //
+  // callbacks that come early in bursts (the backend filling several periods
+  // at once) never look late, and early ones pull the due time back a little
+  // so a device running fast against steady_clock doesn't leave it further
+  // and further ahead
+  bool is_late = false;
+  if (has_due) {
+    const double lateness_sec =
+        std::chrono::duration<double>(start - due).count();
+    // devices take a few callbacks to settle into their pace when they start
+    is_late = lateness_sec > std::max(period_sec, late_threshold_sec) &&
+              num_started > settle_callbacks;
+    if (lateness_sec > 0)
+      due = start;
+    else
+      due += std::chrono::duration_cast<clock::duration>(
+          std::chrono::duration<double>(lateness_sec * early_pull));
+  } else {
+    due = start;
+    has_due = true;
+  }
+  ++num_started;
+  due += std::chrono::duration_cast<clock::duration>(
+      std::chrono::duration<double>(period_sec));
+
+  const Callback callback = {
+      static_cast<float>(std::chrono::duration<double>(now - start).count()),
+      static_cast<float>(period_sec), num_frames, is_late};
+  if (!callbacks.try_push(callback)) {
+    num_dropped.store(num_dropped.load(std::memory_order_relaxed) + 1,
+                      std::memory_order_relaxed);
+  }
+}
+
+AudioLoadStats AudioLoadMeter::collect() {
+  Callback callback;
+  bool has_new = false;
+  while (callbacks.try_pop(callback)) {
+    has_new = true;
+    const double load = callback.duration_sec / callback.period_sec;
+    ++stats.num_callbacks;
+    stats.frames_per_callback = callback.num_frames;
+    stats.callback_time.add(callback.duration_sec);
+    stats.load.add(load);
+    if (load > 1)
+      ++stats.num_overloads;
+    if (callback.is_late)
+      ++stats.num_late_callbacks;
+
+    if (window.size() < window_size) {
+      window.push_back(static_cast<float>(load));
+    } else {
+      window[window_next] = static_cast<float>(load);
+      window_next = (window_next + 1) % window_size;
+    }
+  }
+  stats.num_dropped = num_dropped.load(std::memory_order_relaxed);
+
+  if (has_new) {
+    sorted.assign(window.begin(), window.end());
+    const std::size_t p99 = sorted.size() * 99 / 100;
+    std::nth_element(sorted.begin(), sorted.begin() + p99, sorted.end());
+    stats.recent_p99_load = sorted[p99];
+    stats.recent_max_load = *std::max_element(window.begin(), window.end());
+  }
+  return stats;
+}
+
+AudioLoadReporter::AudioLoadReporter(AudioLoadMeter &meter,
+                                     std::chrono::seconds report_interval)
+    : meter(meter), report_interval(report_interval) {
+  thread = std::thread([this]() { run(); });
+}
+
+AudioLoadReporter::~AudioLoadReporter() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    should_stop = true;
+  }
+  wake.notify_one();
+  thread.join();
+}
+
+void AudioLoadReporter::run() {
+  std::uint64_t num_overloads = 0;
+  std::uint64_t num_late_callbacks = 0;
+  auto next_report = std::chrono::steady_clock::now() + report_interval;
+  std::unique_lock<std::mutex> lock(mutex);
+  while (!wake.wait_for(lock, std::chrono::seconds(1),
+                        [this]() { return should_stop; })) {
+    const AudioLoadStats stats = meter.collect();
+    if (stats.num_overloads != num_overloads ||
+        stats.num_late_callbacks != num_late_callbacks) {
+      std::cerr << "Audio callbacks: "
+                << stats.num_overloads - num_overloads << " overloads, "
+                << stats.num_late_callbacks - num_late_callbacks
+                << " late in the last second (" << stats.frames_per_callback
+                << " frames a callback, --buffer picks more)\n";
+      num_overloads = stats.num_overloads;
+      num_late_callbacks = stats.num_late_callbacks;
+    }
+    if (report_interval.count() > 0 && stats.num_callbacks > 0 &&
+        std::chrono::steady_clock::now() >= next_report) {
+      std::cout << "Audio load: ";
+      stats.print(std::cout);
+      std::cout << std::endl;
+      next_report += report_interval;
+    }
+  }
+}
@@ -0,0 +1,127 @@
+#ifndef AUDIO_LOAD_METER_HPP
+#define AUDIO_LOAD_METER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+#include "spsc_ring_buffer.hpp"
+#include "stats.hpp"
+
+struct AudioLoadStats {
+  std::uint64_t num_callbacks = 0;
+  // frames the device asked for in the last callback
+  std::uint32_t frames_per_callback = 0;
+  // seconds spent in each callback
+  RunningStats callback_time;
+  // time spent in each callback over how long the audio it made lasts, at 1
+  // the callback only just kept up
+  RunningStats load;
+  // over the last AudioLoadMeter::window_size callbacks
+  double recent_max_load = 0;
+  double recent_p99_load = 0;
+  // callbacks that took longer than the audio they made lasts, the device
+  // runs dry if that keeps up
+  std::uint64_t num_overloads = 0;
+  // callbacks that started more than a period after they were due, the
+  // device most likely ran dry in between (an xrun)
+  std::uint64_t num_late_callbacks = 0;
+  // measurements lost because the reader fell behind
+  std::uint64_t num_dropped = 0;
+
+  // "256 frames a callback, load p99 12% max 20% (recent), ..."
+  void print(std::ostream &os) const;
+};
+
+// how long the audio callback takes against the length of the audio it
+// makes, measured on the audio thread around everything the callback does:
+// begin() and end() only read the clock and push into a lock free ring, the
+// stats are worked out on the thread that calls collect()
+//
+// the percentile and max are over a rolling window of recent callbacks so a
+// load spike shows up even after hours of quiet playback, that's what a
+// buffer size should be picked on, a size is too small when the p99 gets
+// near 1 or callbacks run late
+class AudioLoadMeter {
+public:
+  using clock = std::chrono::steady_clock;
+  // about 10 seconds of 256 frame callbacks at 48 kHz
+  static constexpr std::size_t window_size = 2048;
+
+  AudioLoadMeter();
+
+  AudioLoadMeter(const AudioLoadMeter &) = delete;
+  AudioLoadMeter &operator=(const AudioLoadMeter &) = delete;
+
+  // how late a callback may start before the device is taken to have run dry,
+  // the device's buffer less the period the callback refills, at least a
+  // period, has to be set before the device starts
+  void set_late_threshold(double seconds) { late_threshold_sec = seconds; }
+
+  // audio thread only, around the whole callback
+  clock::time_point begin() const { return clock::now(); }
+  void end(clock::time_point start, std::uint32_t num_frames,
+           double sample_rate);
+
+  // one reader thread only, takes in what was measured since the last call
+  AudioLoadStats collect();
+
+private:
+  struct Callback {
+    float duration_sec;
+    float period_sec;
+    std::uint32_t num_frames;
+    bool is_late;
+  };
+
+  SpscRingBuffer<Callback> callbacks{1 << 12};
+  std::atomic<std::uint64_t> num_dropped{0};
+
+  // how much of the way to an early callback the due time moves
+  static constexpr double early_pull = 1.0 / 16;
+  static constexpr std::uint64_t settle_callbacks = 64;
+
+  double late_threshold_sec = 0;
+
+  // only touched by the audio thread
+  bool has_due = false;
+  clock::time_point due;
+  std::uint64_t num_started = 0;
+
+  // only touched by the reader
+  AudioLoadStats stats;
+  std::vector<float> window;
+  std::size_t window_next = 0;
+  std::vector<float> sorted;
+};
+
+// collects from a meter once a second on a thread of its own, warns on stderr
+// as soon as callbacks overload or run late and prints the whole stats every
+// report_interval (never when it's 0), nothing is printed before the device
+// has run
+class AudioLoadReporter {
+public:
+  AudioLoadReporter(AudioLoadMeter &meter,
+                    std::chrono::seconds report_interval);
+  ~AudioLoadReporter();
+
+  AudioLoadReporter(const AudioLoadReporter &) = delete;
+  AudioLoadReporter &operator=(const AudioLoadReporter &) = delete;
+
+private:
+  void run();
+
+  AudioLoadMeter &meter;
+  std::chrono::seconds report_interval;
+  std::mutex mutex;
+  std::condition_variable wake;
+  bool should_stop = false;
+  std::thread thread;
+};
+
+#endif // AUDIO_LOAD_METER_HPP
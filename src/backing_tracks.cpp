@@ -0,0 +1,343 @@
+#include "backing_tracks.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#include "miniaudio/miniaudio.h"
+#include "simd.hpp"
+
+namespace {
+
+// further off than this and a track jumps instead of being pulled back, well
+// over how late a callback can run so jitter never makes a track jump
+constexpr double max_drift_sec = 0.1;
+// how far off a track may be before a frame is dropped or doubled to pull it
+// back, the error is smoothed over callbacks first so one early or late
+// callback doesn't move it
+constexpr double allowed_drift_sec = 0.001;
+constexpr double drift_smoothing = 0.05;
+// how long the read ahead thread waits when every ring is full
+constexpr auto read_ahead_interval = std::chrono::milliseconds(5);
+
+} // namespace
+
+struct BackingTrackPlayer::Stream {
+  ~Stream() {
+    if (is_open)
+      ma_decoder_uninit(&decoder);
+  }
+
+  ma_decoder decoder;
+  bool is_open = false;
+  std::uint64_t num_frames = 0;
+  // the song frame the track starts on
+  std::int64_t start_frame = 0;
+  SpscRingBuffer<Block> blocks{ring_blocks};
+
+  // the audio thread asks for a seek by writing seek_frame and then bumping
+  // seek_generation
+  std::atomic<std::uint64_t> seek_frame{0};
+  std::atomic<std::uint32_t> seek_generation{0};
+
+  // read ahead thread only
+  std::uint32_t read_generation = 0;
+  std::uint64_t read_frame = 0;
+
+  // audio thread only, the frame it plays next (below 0 until the track
+  // starts) and how far behind the song it has been, smoothed
+  std::uint32_t generation = 0;
+  std::int64_t position = 0;
+  double drift = 0;
+};
+
+// what miniaudio reads the tracks through, the base has to come first
+struct BackingTrackSoundSource {
+  ma_data_source_base base;
+  BackingTrackPlayer *player;
+  ma_sound sound;
+};
+
+namespace {
+
+ma_result read_backing_tracks(ma_data_source *data_source, void *frames_out,
+                              ma_uint64 frame_count, ma_uint64 *frames_read) {
+  auto *source = static_cast<BackingTrackSoundSource *>(data_source);
+  auto *frames = static_cast<float *>(frames_out);
+  std::fill(frames, frames + 2 * frame_count, 0.0f);
+  source->player->render(frames, static_cast<std::uint32_t>(frame_count),
+                         FrameClock::clock::now());
+  if (frames_read)
+    *frames_read = frame_count;
+  return MA_SUCCESS;
+}
+
+ma_result get_backing_tracks_data_format(ma_data_source *data_source,
+                                         ma_format *format,
+                                         ma_uint32 *num_channels,
+                                         ma_uint32 *sample_rate,
+                                         ma_channel *channel_map,
+                                         size_t channel_map_capacity) {
+  auto *source = static_cast<BackingTrackSoundSource *>(data_source);
+  *format = ma_format_f32;
+  *num_channels = 2;
+  *sample_rate = static_cast<ma_uint32>(source->player->get_sample_rate());
+  ma_channel_map_init_standard(ma_standard_channel_map_default, channel_map,
+                               channel_map_capacity, 2);
+  return MA_SUCCESS;
+}
+
+// follows the song, so it never ends and the engine can't seek it
+ma_data_source_vtable backing_tracks_vtable = {
+    read_backing_tracks, NULL, get_backing_tracks_data_format, NULL, NULL,
+    NULL, 0,
+};
+
+} // namespace
+
+BackingTrackPlayer::BackingTrackPlayer(const std::vector<BackingTrack> &tracks,
+                                       unsigned int bpm,
+                                       const FrameClock &bar_clock,
+                                       double sample_rate)
+    : sample_rate(sample_rate), bar_sec(60.0 / bpm), bar_clock(bar_clock),
+      scratch(2 * (block_frames + 1)) {
+  for (const BackingTrack &track : tracks) {
+    auto stream = std::make_unique<Stream>();
+    ma_decoder_config config = ma_decoder_config_init(
+        ma_format_f32, 2, static_cast<ma_uint32>(sample_rate));
+    if (ma_decoder_init_file(track.path.c_str(), &config, &stream->decoder) !=
+        MA_SUCCESS) {
+      throw std::runtime_error("Could not open track " + track.name + ": " +
+                               track.path);
+    }
+    stream->is_open = true;
+    ma_uint64 num_frames = 0;
+    ma_decoder_get_length_in_pcm_frames(&stream->decoder, &num_frames);
+    if (num_frames == 0) {
+      throw std::runtime_error("Track " + track.name +
+                               " is empty or its length can't be told");
+    }
+    stream->num_frames = num_frames;
+    stream->start_frame = std::llround(track.start_bar * bar_sec * sample_rate);
+    streams.push_back(std::move(stream));
+  }
+  reading_thread = std::thread([this]() { read_ahead(); });
+}
+
+BackingTrackPlayer::~BackingTrackPlayer() {
+  detach();
+  is_reading = false;
+  if (reading_thread.joinable())
+    reading_thread.join();
+}
+
+void BackingTrackPlayer::attach(ma_engine &engine) {
+  if (sound_source)
+    return;
+  if (ma_engine_get_sample_rate(&engine) != sample_rate) {
+    throw std::runtime_error(
+        "Backing tracks have to play at the audio engine's sample rate");
+  }
+
+  auto source = std::make_unique<BackingTrackSoundSource>();
+  source->player = this;
+  ma_data_source_config config = ma_data_source_config_init();
+  config.vtable = &backing_tracks_vtable;
+  if (ma_data_source_init(&config, &source->base) != MA_SUCCESS)
+    throw std::runtime_error("Could not set up the tracks' data source");
+  if (ma_sound_init_from_data_source(&engine, &source->base,
+                                     MA_SOUND_FLAG_NO_SPATIALIZATION |
+                                         MA_SOUND_FLAG_NO_PITCH,
+                                     NULL, &source->sound) != MA_SUCCESS) {
+    ma_data_source_uninit(&source->base);
+    throw std::runtime_error("Could not connect the tracks to the engine");
+  }
+  ma_sound_start(&source->sound);
+  sound_source = std::move(source);
+}
+
+void BackingTrackPlayer::detach() {
+  if (!sound_source)
+    return;
+  ma_sound_uninit(&sound_source->sound);
+  ma_data_source_uninit(&sound_source->base);
+  sound_source.reset();
+}
+
+void BackingTrackPlayer::read_ahead() {
+  // a block is 8 KB, too big for the stack of every platform's threads
+  auto block = std::make_unique<Block>();
+  while (is_reading.load()) {
+    bool did_read = false;
+    for (auto &stream : streams)
+      did_read = fill(*stream, *block) || did_read;
+    if (!did_read)
+      std::this_thread::sleep_for(read_ahead_interval);
+  }
+}
+
+// decodes the stream's next block into its ring when there's room for it
+bool BackingTrackPlayer::fill(Stream &stream, Block &block) {
+  const std::uint32_t generation =
+      stream.seek_generation.load(std::memory_order_acquire);
+  if (generation != stream.read_generation) {
+    stream.read_generation = generation;
+    stream.read_frame = stream.seek_frame.load(std::memory_order_relaxed);
+    ma_decoder_seek_to_pcm_frame(&stream.decoder, stream.read_frame);
+  }
+  // only this thread pushes so the ring can't fill up after this
+  if (stream.blocks.size() >= stream.blocks.capacity())
+    return false;
+
+  // the song plays the track again when it loops, so its start is read ahead
+  // as soon as its end is
+  if (stream.read_frame >= stream.num_frames) {
+    stream.read_frame = 0;
+    ma_decoder_seek_to_pcm_frame(&stream.decoder, 0);
+  }
+  ma_uint64 num_frames = 0;
+  ma_decoder_read_pcm_frames(&stream.decoder, block.samples, block_frames,
+                             &num_frames);
+  if (num_frames == 0) {
+    // the file ended before its length said it would
+    stream.read_frame = stream.num_frames;
+    return false;
+  }
+  block.generation = generation;
+  block.num_frames = static_cast<std::uint32_t>(num_frames);
+  block.first_frame = stream.read_frame;
+  stream.blocks.try_push(block);
+  stream.read_frame += num_frames;
+  return true;
+}
+
+// moves the stream to a frame, what's read ahead is kept when it starts
+// there (the track coming round again after the song looped finds its start
+// waiting), otherwise the read ahead thread is asked to seek
+void BackingTrackPlayer::jump(Stream &stream, std::int64_t frame) {
+  num_jumps.fetch_add(1, std::memory_order_relaxed);
+  stream.position = frame;
+  stream.drift = 0;
+  const auto needed = static_cast<std::uint64_t>(std::max<std::int64_t>(
+      frame, 0));
+  if (needed >= stream.num_frames)
+    return;
+
+  while (const Block *block = stream.blocks.peek()) {
+    if (block->generation != stream.generation) {
+      stream.blocks.try_discard();
+      continue;
+    }
+    if (block->first_frame <= needed &&
+        needed < block->first_frame + block->num_frames)
+      return;
+    break;
+  }
+  ++stream.generation;
+  stream.seek_frame.store(needed, std::memory_order_relaxed);
+  stream.seek_generation.store(stream.generation, std::memory_order_release);
+}
+
+// the stream's next frames, silence before it starts, after it ends and where
+// nothing was read ahead in time (ran_out is set then)
+void BackingTrackPlayer::read_frames(Stream &stream, float *frames,
+                                     std::uint32_t num_frames, bool &ran_out) {
+  std::uint32_t done = 0;
+  while (done < num_frames) {
+    float *out = frames + 2 * done;
+    std::uint32_t count = num_frames - done;
+    if (stream.position < 0) {
+      count = static_cast<std::uint32_t>(
+          std::min<std::int64_t>(count, -stream.position));
+    } else if (static_cast<std::uint64_t>(stream.position) <
+               stream.num_frames) {
+      const auto position = static_cast<std::uint64_t>(stream.position);
+      const Block *block = stream.blocks.peek();
+      if (block && (block->generation != stream.generation ||
+                    (block->first_frame <= position &&
+                     block->first_frame + block->num_frames <= position))) {
+        stream.blocks.try_discard();
+        continue;
+      }
+      if (block && block->first_frame <= position) {
+        const auto offset =
+            static_cast<std::uint32_t>(position - block->first_frame);
+        count = std::min(count, block->num_frames - offset);
+        std::memcpy(out, block->samples + 2 * offset,
+                    2 * count * sizeof(float));
+        if (offset + count == block->num_frames)
+          stream.blocks.try_discard();
+        stream.position += count;
+        done += count;
+        continue;
+      }
+      ran_out = true;
+      if (block)
+        count = static_cast<std::uint32_t>(
+            std::min<std::uint64_t>(count, block->first_frame - position));
+    }
+    std::fill(out, out + 2 * count, 0.0f);
+    stream.position += count;
+    done += count;
+  }
+}
+
+void BackingTrackPlayer::render(float *frames, std::uint32_t num_frames,
+                                FrameClock::clock::time_point time) {
+  std::uint64_t bar = 0;
+  FrameClock::clock::time_point bar_time;
+  if (num_frames == 0 || !bar_clock.read(bar, bar_time))
+    return;
+  const double since_bar_sec =
+      std::chrono::duration<double>(time - bar_time).count();
+  // the sequencer is paused, the tracks carry on from here when it resumes
+  if (since_bar_sec > 2 * bar_sec)
+    return;
+  const std::int64_t song_frame =
+      std::llround((bar * bar_sec + since_bar_sec) * sample_rate);
+  const double max_drift_frames = max_drift_sec * sample_rate;
+  const double allowed_drift_frames = allowed_drift_sec * sample_rate;
+
+  bool ran_out = false;
+  for (auto &stream_pointer : streams) {
+    Stream &stream = *stream_pointer;
+    const std::int64_t target = song_frame - stream.start_frame;
+    const auto error = static_cast<double>(target - stream.position);
+    if (std::abs(error) > max_drift_frames)
+      jump(stream, target);
+    else
+      stream.drift += (error - stream.drift) * drift_smoothing;
+
+    std::uint32_t done = 0;
+    // a track that drifted plays one frame more (behind) or less (ahead) than
+    // the callback asks for, spread over the first block so it can't be heard
+    int correction = 0;
+    if (stream.drift > allowed_drift_frames)
+      correction = 1;
+    else if (stream.drift < -allowed_drift_frames)
+      correction = -1;
+    if (correction != 0 && num_frames > 1) {
+      const std::uint32_t count = std::min(num_frames, block_frames);
+      const std::uint32_t num_read = count + correction;
+      read_frames(stream, scratch.data(), num_read, ran_out);
+      for (std::uint32_t i = 0; i < count; ++i) {
+        const std::uint32_t source = static_cast<std::uint32_t>(
+            std::uint64_t(i) * (num_read - 1) / (count - 1));
+        frames[2 * i] += scratch[2 * source];
+        frames[2 * i + 1] += scratch[2 * source + 1];
+      }
+      stream.drift -= correction;
+      done = count;
+    }
+    while (done < num_frames) {
+      const std::uint32_t count = std::min(num_frames - done, block_frames);
+      read_frames(stream, scratch.data(), count, ran_out);
+      mix_into(frames + 2 * done, scratch.data(), 2 * count);
+      done += count;
+    }
+  }
+  if (ran_out)
+    num_underruns.fetch_add(1, std::memory_order_relaxed);
+}
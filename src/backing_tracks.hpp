@@ -0,0 +1,96 @@
+#ifndef BACKING_TRACKS_HPP
+#define BACKING_TRACKS_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "frame_clock.hpp"
+#include "jam_file_parsing.hpp"
+#include "spsc_ring_buffer.hpp"
+
+struct ma_engine;
+struct BackingTrackSoundSource;
+
+// plays the TRACKS of a jam file through the engine alongside the patterns
+//
+// files are never loaded whole: a read ahead thread decodes each track a block
+// at a time into a ring of its own and the audio callback mixes them from
+// there, so a track takes ring_blocks blocks of memory however long its file
+// is, and the audio thread never touches the disk, locks or allocates
+//
+// the tracks follow the sequencer's bar clock: every callback works out which
+// frame of the song it is playing from the bar that started last, a track that
+// drifts from it is pulled back a frame at a time and one that is far off
+// (the song looped, the sequencer was reset) jumps, tracks hold while the
+// sequencer is paused
+class BackingTrackPlayer {
+public:
+  static constexpr std::uint32_t block_frames = 1024;
+  // about 1.4 seconds of every track at 48 kHz
+  static constexpr std::size_t ring_blocks = 64;
+
+  // opens every file, converted to stereo at sample_rate, and starts reading
+  // ahead, throws when a file can't be opened, bar_clock counts the song's
+  // bars (Sequencer::get_bar_clock) and has to outlive the player
+  BackingTrackPlayer(const std::vector<BackingTrack> &tracks, unsigned int bpm,
+                     const FrameClock &bar_clock, double sample_rate);
+  ~BackingTrackPlayer();
+
+  BackingTrackPlayer(const BackingTrackPlayer &) = delete;
+  BackingTrackPlayer &operator=(const BackingTrackPlayer &) = delete;
+
+  // engine has to run at the player's sample rate and outlive it or detach()
+  void attach(ma_engine &engine);
+  void detach();
+
+  // adds the tracks into interleaved stereo frames, the first of which plays
+  // at time, audio thread only (attach() calls it from the engine)
+  void render(float *frames, std::uint32_t num_frames,
+              FrameClock::clock::time_point time);
+
+  double get_sample_rate() const { return sample_rate; }
+  std::size_t get_num_tracks() const { return streams.size(); }
+  // callbacks where a track had nothing read ahead for a frame it had to play
+  std::uint64_t get_num_underruns() const { return num_underruns.load(); }
+  // times a track jumped to catch up with the song
+  std::uint64_t get_num_jumps() const { return num_jumps.load(); }
+
+private:
+  struct Block {
+    // of the seek it was read after, blocks from before the latest seek are
+    // thrown away
+    std::uint32_t generation;
+    std::uint32_t num_frames;
+    std::uint64_t first_frame;
+    float samples[2 * block_frames];
+  };
+
+  struct Stream;
+
+  void read_ahead();
+  bool fill(Stream &stream, Block &block);
+  void jump(Stream &stream, std::int64_t frame);
+  void read_frames(Stream &stream, float *frames, std::uint32_t num_frames,
+                   bool &ran_out);
+
+  double sample_rate;
+  double bar_sec;
+  const FrameClock &bar_clock;
+  std::vector<std::unique_ptr<Stream>> streams;
+
+  std::atomic<bool> is_reading{true};
+  std::thread reading_thread;
+
+  // audio thread only
+  std::vector<float> scratch;
+
+  std::atomic<std::uint64_t> num_underruns{0};
+  std::atomic<std::uint64_t> num_jumps{0};
+
+  std::unique_ptr<BackingTrackSoundSource> sound_source;
+};
+
+#endif // BACKING_TRACKS_HPP
@@ -0,0 +1,84 @@
+#include "batch_generation.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "midi_file.hpp"
+#include "song_compiler.hpp"
+
+void generate_variants(const JamFileData &jam_data, std::size_t num_variants,
+                       const std::string &output_directory,
+                       unsigned int num_threads) {
+  if (!jam_data.has_generative_arrangement) {
+    throw std::runtime_error(
+        "Batch generation needs a jam file with a GENERATIVE section and no "
+        "ARRANGEMENT section");
+  }
+
+  if (num_threads == 0)
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  num_threads = static_cast<unsigned int>(std::min<std::size_t>(
+      num_threads, std::max<std::size_t>(num_variants, 1)));
+
+  std::filesystem::create_directories(output_directory);
+
+  auto start = std::chrono::steady_clock::now();
+
+  // parsing the bars of every pattern is the expensive part, it happens once
+  // here and every thread reads from the same copy
+  const CompiledPatterns patterns = compile_patterns(jam_data);
+
+  std::atomic<std::size_t> next_variant{0};
+  std::mutex error_mutex;
+  std::vector<std::string> errors;
+
+  auto worker = [&]() {
+    for (std::size_t i = next_variant++; i < num_variants;
+         i = next_variant++) {
+      const std::uint64_t seed = jam_data.seed + i;
+      const std::string path =
+          (std::filesystem::path(output_directory) /
+           ("variant_" + std::to_string(i) + "_seed_" + std::to_string(seed) +
+            ".mid"))
+              .string();
+      try {
+        std::vector<PatternData> arrangement =
+            generate_arrangement(jam_data, seed);
+        write_midi_file(path, compile_song(patterns, arrangement));
+      } catch (const std::exception &e) {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        errors.push_back(path + ": " + e.what());
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  threads.reserve(num_threads);
+  for (unsigned int t = 0; t < num_threads; ++t) {
+    threads.emplace_back(worker);
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  double elapsed_sec = std::chrono::duration<double>(
+                           std::chrono::steady_clock::now() - start)
+                           .count();
+
+  for (const std::string &error : errors) {
+    std::cerr << "Failed to generate variant " << error << "\n";
+  }
+
+  std::cout << "Generated " << num_variants - errors.size() << " of "
+            << num_variants << " variants into " << output_directory << " in "
+            << elapsed_sec << " s using " << num_threads << " threads ("
+            << (num_variants - errors.size()) / elapsed_sec
+            << " variants/s)\n";
+}
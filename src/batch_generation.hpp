@@ -0,0 +1,19 @@
+#ifndef BATCH_GENERATION_HPP
+#define BATCH_GENERATION_HPP
+
+#include <cstddef>
+#include <string>
+
+#include "jam_file_parsing.hpp"
+
+// draws num_variants arrangements from the generative layers of an already
+// parsed jam file and writes each one as a midi file into output_directory,
+// variant i uses seed jam_data.seed + i so any variant can be reproduced on
+// its own by putting its seed into the DATA section, the work is spread over
+// num_threads threads (0 means one per core) which only share the parsed file
+// and the compiled patterns, both read only
+void generate_variants(const JamFileData &jam_data, std::size_t num_variants,
+                       const std::string &output_directory,
+                       unsigned int num_threads = 0);
+
+#endif // BATCH_GENERATION_HPP
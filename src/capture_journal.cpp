@@ -0,0 +1,194 @@
+#include "capture_journal.hpp"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <stdexcept>
+#include <unistd.h>
+
+namespace {
+
+constexpr char journal_magic[8] = {'J', 'A', 'M', 'S', 'C', 'A', 'P', '1'};
+constexpr std::uint32_t journal_version = 2;
+constexpr std::size_t header_size = 8 + 4 + 4 + 8 + 4 + 4 + 8;
+// magic, version and record size, the same in every version
+constexpr std::size_t header_prefix_size = 8 + 4 + 4;
+constexpr std::size_t record_size = 8 + 4 + 1 + 3;
+// records written per write call
+constexpr std::size_t records_per_block = 4096;
+
+// the fields are copied one by one rather than the whole struct so padding
+// never ends up in the file, all supported targets are little endian
+template <typename T> unsigned char *put(unsigned char *out, T value) {
+  std::memcpy(out, &value, sizeof(T));
+  return out + sizeof(T);
+}
+
+template <typename T>
+const unsigned char *get(const unsigned char *in, T &value) {
+  std::memcpy(&value, in, sizeof(T));
+  return in + sizeof(T);
+}
+
+void encode_record(const CapturedMidiMessage &message, unsigned char *out) {
+  out = put(out, message.timestamp_sec);
+  out = put(out, message.callback_lag_sec);
+  out = put(out, message.size);
+  std::memcpy(out, message.bytes, 3);
+}
+
+CapturedMidiMessage decode_record(const unsigned char *in) {
+  CapturedMidiMessage message{};
+  in = get(in, message.timestamp_sec);
+  in = get(in, message.callback_lag_sec);
+  in = get(in, message.size);
+  std::memcpy(message.bytes, in, 3);
+  return message;
+}
+
+bool write_all(int fd, const unsigned char *data, std::size_t size) {
+  while (size > 0) {
+    ssize_t written = ::write(fd, data, size);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    data += written;
+    size -= static_cast<std::size_t>(written);
+  }
+  return true;
+}
+
+} // namespace
+
+CaptureJournalWriter::CaptureJournalWriter(
+    const std::string &path, const CaptureJournalHeader &header,
+    std::chrono::milliseconds sync_interval)
+    : path(path), sync_interval(sync_interval),
+      buffer(records_per_block * record_size) {
+  fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+  if (fd < 0) {
+    throw std::runtime_error("Could not create capture journal " + path +
+                             ": " + std::strerror(errno));
+  }
+
+  unsigned char header_bytes[header_size];
+  unsigned char *out = header_bytes;
+  std::memcpy(out, journal_magic, sizeof(journal_magic));
+  out += sizeof(journal_magic);
+  out = put(out, journal_version);
+  out = put(out, static_cast<std::uint32_t>(record_size));
+  out = put(out, header.bpm);
+  out = put(out, header.beats_per_bar);
+  out = put(out, header.num_bars);
+  put(out, header.latency_offset_sec);
+
+  // the header is synced straight away so even a take that dies in the
+  // first second leaves a readable file
+  if (!write_all(fd, header_bytes, header_size) || ::fsync(fd) != 0) {
+    std::string reason = std::strerror(errno);
+    ::close(fd);
+    throw std::runtime_error("Could not write capture journal " + path + ": " +
+                             reason);
+  }
+  last_sync = std::chrono::steady_clock::now();
+}
+
+CaptureJournalWriter::~CaptureJournalWriter() { close(); }
+
+void CaptureJournalWriter::append(const CapturedMidiMessage &message) {
+  if (fd < 0 || !ok())
+    return;
+
+  encode_record(message, buffer.data() + buffered_bytes);
+  buffered_bytes += record_size;
+  ++num_records;
+
+  if (buffered_bytes == buffer.size())
+    write_buffer();
+  maybe_sync();
+}
+
+void CaptureJournalWriter::maybe_sync() {
+  if (num_synced_records != num_records &&
+      std::chrono::steady_clock::now() - last_sync >= sync_interval)
+    sync();
+}
+
+void CaptureJournalWriter::write_buffer() {
+  if (buffered_bytes == 0)
+    return;
+  if (!write_all(fd, buffer.data(), buffered_bytes))
+    error = std::strerror(errno);
+  buffered_bytes = 0;
+}
+
+void CaptureJournalWriter::sync() {
+  if (fd < 0 || !ok())
+    return;
+  write_buffer();
+  if (ok() && ::fsync(fd) != 0)
+    error = std::strerror(errno);
+  last_sync = std::chrono::steady_clock::now();
+  num_synced_records = num_records;
+}
+
+void CaptureJournalWriter::close() {
+  if (fd < 0)
+    return;
+  sync();
+  ::close(fd);
+  fd = -1;
+}
+
+CaptureJournal read_capture_journal(const std::string &path) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    throw std::runtime_error("Could not open capture journal: " + path);
+  }
+
+  unsigned char header_bytes[header_size];
+  if (!file.read(reinterpret_cast<char *>(header_bytes), header_prefix_size) ||
+      std::memcmp(header_bytes, journal_magic, sizeof(journal_magic)) != 0) {
+    throw std::runtime_error(path + " is not a capture journal");
+  }
+
+  CaptureJournal journal;
+  const unsigned char *in = header_bytes + sizeof(journal_magic);
+  std::uint32_t version = 0;
+  std::uint32_t file_record_size = 0;
+  in = get(in, version);
+  in = get(in, file_record_size);
+  if (version < 1 || version > journal_version ||
+      file_record_size != record_size) {
+    throw std::runtime_error(path + " is a capture journal version this "
+                                    "build can't read");
+  }
+
+  const std::size_t file_header_size = version == 1 ? header_size - 8
+                                                    : header_size;
+  if (!file.read(reinterpret_cast<char *>(header_bytes) + header_prefix_size,
+                 file_header_size - header_prefix_size)) {
+    throw std::runtime_error(path + " is not a capture journal");
+  }
+  in = get(in, journal.header.bpm);
+  in = get(in, journal.header.beats_per_bar);
+  in = get(in, journal.header.num_bars);
+  if (version >= 2)
+    get(in, journal.header.latency_offset_sec);
+
+  std::vector<unsigned char> block(records_per_block * record_size);
+  while (file) {
+    file.read(reinterpret_cast<char *>(block.data()), block.size());
+    std::size_t num_bytes = static_cast<std::size_t>(file.gcount());
+    std::size_t num_whole_records = num_bytes / record_size;
+    for (std::size_t i = 0; i < num_whole_records; ++i)
+      journal.events.push_back(decode_record(block.data() + i * record_size));
+    if (num_bytes % record_size != 0)
+      journal.was_truncated = true;
+  }
+
+  return journal;
+}
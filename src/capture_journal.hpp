@@ -0,0 +1,87 @@
+#ifndef CAPTURE_JOURNAL_HPP
+#define CAPTURE_JOURNAL_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "midi_recorder.hpp"
+
+// what a take was recorded with, so it can be quantized again later without
+// having to remember the settings
+struct CaptureJournalHeader {
+  // 0 when the take was played without a click
+  double bpm = 120.0;
+  std::uint32_t beats_per_bar = 4;
+  // bars that were asked for including the count in, 0 when open ended
+  std::uint32_t num_bars = 0;
+  // the input latency of the devices it was recorded on, the records are
+  // stored as captured and this is taken off when quantizing
+  double latency_offset_sec = 0;
+};
+
+// an append only file of captured midi messages: a fixed header followed by
+// fixed size records, records are buffered and written in blocks and the file
+// is fsynced every sync_interval so a crash loses at most that much input, a
+// half written record at the end of the file (the process died mid write) is
+// ignored when reading, memory use stays the same however long the session is
+//
+// layout, little endian:
+//   header:  "JAMSCAP1" | u32 version | u32 record size | f64 bpm
+//            | u32 beats per bar | u32 num bars | f64 latency offset sec
+//            (version 1 files end the header before the latency offset)
+//   records: f64 timestamp sec | f32 callback lag sec | u8 size | u8 bytes[3]
+class CaptureJournalWriter {
+public:
+  CaptureJournalWriter(const std::string &path,
+                       const CaptureJournalHeader &header,
+                       std::chrono::milliseconds sync_interval =
+                           std::chrono::milliseconds(1000));
+  ~CaptureJournalWriter();
+
+  CaptureJournalWriter(const CaptureJournalWriter &) = delete;
+  CaptureJournalWriter &operator=(const CaptureJournalWriter &) = delete;
+
+  // buffers a record, writes the buffer out when it is full and syncs when the
+  // last sync is older than the sync interval
+  void append(const CapturedMidiMessage &message);
+  // syncs when there are records since the last sync and it is older than the
+  // sync interval, called regularly so records buffered before the input goes
+  // quiet don't wait for the next one
+  void maybe_sync();
+  // writes out everything buffered and fsyncs
+  void sync();
+  void close();
+
+  const std::string &get_path() const { return path; }
+  std::uint64_t get_num_records() const { return num_records; }
+  // false once a write or sync failed, later appends are dropped
+  bool ok() const { return error.empty(); }
+  const std::string &get_error() const { return error; }
+
+private:
+  void write_buffer();
+
+  std::string path;
+  int fd = -1;
+  std::chrono::steady_clock::duration sync_interval;
+  std::chrono::steady_clock::time_point last_sync;
+  std::vector<unsigned char> buffer;
+  std::size_t buffered_bytes = 0;
+  std::uint64_t num_records = 0;
+  std::uint64_t num_synced_records = 0;
+  std::string error;
+};
+
+struct CaptureJournal {
+  CaptureJournalHeader header;
+  std::vector<CapturedMidiMessage> events;
+  // true when the file ended part way through a record
+  bool was_truncated = false;
+};
+
+// reads a whole journal, throws when the file isn't one
+CaptureJournal read_capture_journal(const std::string &path);
+
+#endif // CAPTURE_JOURNAL_HPP
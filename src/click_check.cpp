@@ -0,0 +1,141 @@
+#include "click_check.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "audio_engine.hpp"
+#include "latency_calibration.hpp"
+#include "metronome.hpp"
+#include "midi_recorder.hpp"
+
+namespace {
+
+// a click starts on its first sample this loud
+constexpr float onset_threshold = 0.01f;
+// how much audio is mixed between looks at what the metronome has to schedule,
+// about what a device asks for at a time
+constexpr std::uint64_t offline_block_frames = 256;
+
+bool is_loud(const float *frame) {
+  return std::abs(frame[0]) >= onset_threshold ||
+         std::abs(frame[1]) >= onset_threshold;
+}
+
+// frames from the start of a click sound to its first loud frame (mp3s start
+// with a little silence), decoded at the engine's rate like the engine does
+std::uint64_t sound_onset_frames(const std::string &path,
+                                 double sample_rate) {
+  ma_decoder_config config = ma_decoder_config_init(
+      ma_format_f32, 2, static_cast<ma_uint32>(sample_rate));
+  ma_uint64 num_frames = 0;
+  void *frames = nullptr;
+  if (ma_decode_file(path.c_str(), &config, &num_frames, &frames) !=
+      MA_SUCCESS) {
+    throw std::runtime_error("Could not load click sound: " + path);
+  }
+  const auto *samples = static_cast<const float *>(frames);
+  std::uint64_t onset = 0;
+  while (onset < num_frames && !is_loud(samples + 2 * onset))
+    ++onset;
+  ma_free(frames, NULL);
+  return onset;
+}
+
+std::uint64_t num_clicks_for(const ClickCheckSettings &settings) {
+  return static_cast<std::uint64_t>(settings.num_bars) * settings.subdivision *
+         settings.beats_per_bar / 4;
+}
+
+void check_click_frames(const ClickCheckSettings &settings,
+                        ClickCheckResult &result) {
+  AudioEngine audio(AudioBackend::offline);
+  ma_engine &engine = audio.get();
+  result.sample_rate = ma_engine_get_sample_rate(&engine);
+  const std::uint64_t tick_onset =
+      sound_onset_frames(settings.tick_path, result.sample_rate);
+  const std::uint64_t tock_onset =
+      sound_onset_frames(settings.tock_path, result.sample_rate);
+
+  Metronome metronome(engine, settings.tick_path, settings.tock_path);
+  SessionClock clock;
+  metronome.start(settings.bpm, settings.subdivision, settings.beats_per_bar,
+                  clock, false);
+
+  // engine frames from 0, up to where the click after the last one would be
+  const std::uint64_t num_clicks = num_clicks_for(settings);
+  const std::uint64_t end_frame = metronome.click_frame(num_clicks);
+  std::vector<float> mixed(2 * end_frame);
+  for (std::uint64_t frame = 0; frame < end_frame;
+       frame += offline_block_frames) {
+    metronome.schedule_ahead();
+    audio.read(mixed.data() + 2 * frame,
+               std::min(offline_block_frames, end_frame - frame));
+  }
+  metronome.stop();
+  result.num_missed_clicks += metronome.get_num_missed_clicks();
+
+  // each click is looked for from halfway since the click before
+  for (std::uint64_t click = 0; click < num_clicks; ++click) {
+    const std::uint64_t click_frame = metronome.click_frame(click);
+    const std::uint64_t from =
+        click == 0 ? 0
+                   : (metronome.click_frame(click - 1) + click_frame) / 2;
+    const std::uint64_t to = metronome.click_frame(click + 1);
+    const std::uint64_t expected =
+        click_frame +
+        (metronome.is_first_of_bar(click) ? tock_onset : tick_onset);
+    for (std::uint64_t frame = from; frame < to; ++frame) {
+      if (is_loud(mixed.data() + 2 * frame)) {
+        ++result.num_clicks_found;
+        result.click_errors_frames.add(static_cast<double>(frame) -
+                                       static_cast<double>(expected));
+        break;
+      }
+    }
+  }
+}
+
+void check_recorded_taps(const ClickCheckSettings &settings,
+                         ClickCheckResult &result) {
+  AudioEngine audio(AudioBackend::null);
+  Metronome metronome(audio.get(), settings.tick_path, settings.tock_path);
+  SessionClock clock;
+  metronome.start(settings.bpm, settings.subdivision, settings.beats_per_bar,
+                  clock);
+  MidiRecorder recorder(1 << 10, false);
+  recorder.start(clock);
+
+  // a driver stamps the first message when it arrives and every one after by
+  // the time since the one before
+  const double click_interval_sec =
+      60.0 / settings.bpm * 4.0 / settings.subdivision;
+  const std::uint64_t num_clicks = num_clicks_for(settings);
+  const std::vector<unsigned char> note_on = {0x90, 60, 100};
+  for (std::uint64_t click = 0; click < num_clicks; ++click) {
+    std::this_thread::sleep_until(
+        clock.time_point_at(click * click_interval_sec));
+    recorder.inject(click == 0 ? 0.0 : click_interval_sec, note_on);
+  }
+  std::this_thread::sleep_until(
+      clock.time_point_at(num_clicks * click_interval_sec));
+
+  metronome.stop();
+  recorder.stop();
+  result.num_missed_clicks += metronome.get_num_missed_clicks();
+  result.tap_offsets =
+      measure_tap_offsets(recorder.get_events(), click_interval_sec, 0,
+                          static_cast<int>(num_clicks));
+}
+
+} // namespace
+
+ClickCheckResult check_clicks(const ClickCheckSettings &settings) {
+  ClickCheckResult result;
+  result.num_clicks = num_clicks_for(settings);
+  check_click_frames(settings, result);
+  check_recorded_taps(settings, result);
+  return result;
+}
@@ -0,0 +1,48 @@
+#ifndef CLICK_CHECK_HPP
+#define CLICK_CHECK_HPP
+
+#include <cstdint>
+#include <string>
+
+#include "stats.hpp"
+
+struct ClickCheckSettings {
+  double bpm = 120;
+  // the clicks have to be further apart than a click is long (about 0.2
+  // seconds) for each one to be found in the audio
+  int subdivision = 4;
+  int beats_per_bar = 4;
+  int num_bars = 2;
+  std::string tick_path = "tick.mp3";
+  std::string tock_path = "tock.mp3";
+};
+
+struct ClickCheckResult {
+  double sample_rate = 0;
+  std::uint64_t num_clicks = 0;
+  // clicks whose start was found in the mixed audio
+  std::uint64_t num_clicks_found = 0;
+  // how many frames after its frame each click started in the mixed audio
+  RunningStats click_errors_frames;
+  // clicks the metronome missed in either run
+  std::uint64_t num_missed_clicks = 0;
+  // where the recorder put a made up tap on every click, seconds from the
+  // click
+  RunningStats tap_offsets;
+};
+
+// runs the metronome and the recorder without a sound card or a midi port,
+// twice:
+//
+// on an offline engine, where the clicks are mixed as fast as they can be and
+// found in the audio to check each one starts on the exact frame it was
+// scheduled on
+//
+// in real time on the null device, with a made up note on handed to the
+// recorder on every click the way a midi port would, which should come back
+// stamped on the clicks
+//
+// throws when the click sounds can't be loaded or an engine can't be started
+ClickCheckResult check_clicks(const ClickCheckSettings &settings = {});
+
+#endif // CLICK_CHECK_HPP
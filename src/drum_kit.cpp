@@ -0,0 +1,55 @@
+#include "drum_kit.hpp"
+
+#include <cstring>
+#include <stdexcept>
+
+#include "miniaudio/miniaudio.h"
+
+namespace {
+
+std::shared_ptr<const DrumSample> decode_sample(const std::string &path,
+                                                double sample_rate) {
+  ma_decoder_config config = ma_decoder_config_init(
+      ma_format_f32, 2, static_cast<ma_uint32>(sample_rate));
+  ma_uint64 num_frames = 0;
+  void *frames = nullptr;
+  if (ma_decode_file(path.c_str(), &config, &num_frames, &frames) !=
+      MA_SUCCESS) {
+    throw std::runtime_error("Could not decode sample: " + path);
+  }
+
+  auto sample = std::make_shared<DrumSample>();
+  sample->path = path;
+  sample->num_frames = num_frames;
+  // two frames to a float4
+  sample->data.resize((num_frames + 1) / 2, float4{});
+  std::memcpy(sample->data.data(), frames, num_frames * 2 * sizeof(float));
+  ma_free(frames, NULL);
+  return sample;
+}
+
+} // namespace
+
+std::shared_ptr<const DrumKit>
+load_drum_kit(const std::unordered_map<int, std::string> &note_to_sample_path,
+              const std::vector<unsigned int> &channels, double sample_rate) {
+  auto kit = std::make_shared<DrumKit>();
+  kit->sample_rate = sample_rate;
+
+  std::unordered_map<std::string, std::shared_ptr<const DrumSample>> decoded;
+  for (const auto &[note, path] : note_to_sample_path) {
+    if (note < 0 || note > 127)
+      continue;
+    auto &sample = decoded[path];
+    if (!sample)
+      sample = decode_sample(path, sample_rate);
+    kit->samples[note] = sample;
+  }
+  kit->num_files = decoded.size();
+
+  for (unsigned int channel : channels) {
+    if (channel >= 1 && channel <= 16)
+      kit->plays_on_channel[channel - 1] = true;
+  }
+  return kit;
+}
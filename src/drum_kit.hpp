@@ -0,0 +1,45 @@
+#ifndef DRUM_KIT_HPP
+#define DRUM_KIT_HPP
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "simd.hpp"
+
+// a sample decoded into memory as interleaved stereo at the kit's sample
+// rate, kept in float4s (so aligned for simd) and padded with silence to a
+// whole number of them
+struct DrumSample {
+  std::string path;
+  std::uint64_t num_frames = 0;
+  std::vector<float4> data;
+
+  const float *frames() const {
+    return reinterpret_cast<const float *>(data.data());
+  }
+};
+
+// the samples of a jam file's legend by midi note, nothing in here changes
+// once it's loaded so one kit is shared by every synth playing it, on any
+// thread
+struct DrumKit {
+  double sample_rate = 0;
+  // empty for notes without a sample
+  std::array<std::shared_ptr<const DrumSample>, 128> samples;
+  // channels 1 - 16 as 0 - 15
+  std::array<bool, 16> plays_on_channel = {};
+  std::size_t num_files = 0;
+};
+
+// decodes every sample once, converted to stereo at the given sample rate,
+// notes naming the same file share it, channels are 1 - 16, throws when a file
+// can't be decoded
+std::shared_ptr<const DrumKit>
+load_drum_kit(const std::unordered_map<int, std::string> &note_to_sample_path,
+              const std::vector<unsigned int> &channels, double sample_rate);
+
+#endif // DRUM_KIT_HPP
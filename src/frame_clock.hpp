@@ -0,0 +1,73 @@
+#ifndef FRAME_CLOCK_HPP
+#define FRAME_CLOCK_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// where an audio clock (frames rendered so far) is against steady_clock, the
+// audio thread publishes a pair every callback and any other thread can turn
+// a frame into the steady_clock time it is rendered at, which follows the
+// audio device's clock however much it drifts from the system's
+//
+// the count doesn't have to be frames, the sequencer publishes its bars on one
+//
+// the pair is kept consistent with a sequence lock, publishing never waits
+// and reading only retries while a publish is half done
+class FrameClock {
+public:
+  using clock = std::chrono::steady_clock;
+
+  // one thread only
+  void publish(std::uint64_t frame, clock::time_point time) {
+    const std::uint32_t sequence =
+        sequence_number.load(std::memory_order_relaxed);
+    sequence_number.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    published_frame.store(frame, std::memory_order_relaxed);
+    published_time_ns.store(time.time_since_epoch().count(),
+                            std::memory_order_relaxed);
+    sequence_number.store(sequence + 2, std::memory_order_release);
+  }
+
+  // false until something was published
+  bool read(std::uint64_t &frame, clock::time_point &time) const {
+    while (true) {
+      const std::uint32_t before =
+          sequence_number.load(std::memory_order_acquire);
+      if (before == 0)
+        return false;
+      frame = published_frame.load(std::memory_order_relaxed);
+      const clock::rep time_ns =
+          published_time_ns.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if ((before & 1) == 0 &&
+          sequence_number.load(std::memory_order_relaxed) == before) {
+        time = clock::time_point(clock::duration(time_ns));
+        return true;
+      }
+    }
+  }
+
+  // when the frame is (or was) rendered, from the latest published pair
+  bool time_of_frame(std::uint64_t frame, double sample_rate,
+                     clock::time_point &time) const {
+    std::uint64_t published;
+    clock::time_point published_time;
+    if (!read(published, published_time))
+      return false;
+    const double offset_sec =
+        (static_cast<double>(frame) - static_cast<double>(published)) /
+        sample_rate;
+    time = published_time + std::chrono::duration_cast<clock::duration>(
+                                std::chrono::duration<double>(offset_sec));
+    return true;
+  }
+
+private:
+  std::atomic<std::uint32_t> sequence_number{0};
+  std::atomic<std::uint64_t> published_frame{0};
+  std::atomic<clock::rep> published_time_ns{0};
+};
+
+#endif // FRAME_CLOCK_HPP
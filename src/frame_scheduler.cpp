@@ -0,0 +1,182 @@
+#include "frame_scheduler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+namespace {
+
+// how long the sender sleeps at most while nothing is due, short enough to
+// pick up what the next callback hands it well before it is due
+constexpr auto sender_poll_interval = std::chrono::milliseconds(1);
+
+} // namespace
+
+FrameScheduler::FrameScheduler(const CompiledSong &song, double sample_rate,
+                               const FrameSchedulerOutputs &outputs,
+                               std::uint64_t first_frame)
+    : sample_rate(sample_rate), pass_duration_sec(song.duration_sec),
+      midi_events(outputs.midi_events), first_frame(first_frame) {
+  const auto pass_frames =
+      static_cast<std::uint64_t>(std::llround(song.duration_sec * sample_rate));
+  // an event and whether it rang past the end of the pass it belongs to
+  struct Placed {
+    FramedMidiEvent event;
+    bool wrapped;
+  };
+  std::vector<Placed> synth_events;
+  std::vector<Placed> midi_events_placed;
+  for (const TimedMidiEvent &event : song.events) {
+    auto frame =
+        static_cast<std::uint64_t>(std::llround(event.time_sec * sample_rate));
+    // note offs of notes ringing past the end land at the start of the next
+    // pass, which keeps every pass's events in order
+    const bool wrapped = pass_frames > 0 && frame >= pass_frames;
+    if (pass_frames > 0)
+      frame %= pass_frames;
+    const bool to_midi = (outputs.midi_channels >> (event.status & 0x0F)) & 1;
+    if (to_midi && !midi_events)
+      continue;
+    (to_midi ? midi_events_placed : synth_events)
+        .push_back({{frame, event.status, event.data1, event.data2}, wrapped});
+  }
+  // on a frame, what the pass before left ringing ends first, then note offs
+  // come before note ons the way compile_song puts them, so a note held to
+  // the end of the song doesn't cut off the same note starting the next pass
+  const auto is_note_on = [](const FramedMidiEvent &event) {
+    return (event.status & 0xF0) == 0x90 && event.data2 > 0;
+  };
+  for (auto [placed, output] : {std::make_pair(&synth_events, &synth),
+                                std::make_pair(&midi_events_placed, &midi)}) {
+    std::stable_sort(placed->begin(), placed->end(),
+                     [&is_note_on](const Placed &a, const Placed &b) {
+                       if (a.event.frame != b.event.frame)
+                         return a.event.frame < b.event.frame;
+                       if (a.wrapped != b.wrapped)
+                         return a.wrapped;
+                       return !is_note_on(a.event) && is_note_on(b.event);
+                     });
+    for (const Placed &event : *placed)
+      output->events.push_back(event.event);
+  }
+
+  // the output heard sooner waits out the difference, and everything waits
+  // out the lead midi events are handed over with
+  const double slowest_sec =
+      std::max(outputs.latency.audio_sec, outputs.latency.midi_sec);
+  const auto to_frames = [sample_rate](double sec) {
+    return static_cast<std::uint64_t>(std::llround(sec * sample_rate));
+  };
+  const std::uint64_t lead =
+      midi.events.empty() ? 0 : to_frames(midi_lead_sec);
+  synth.dispatch_delay =
+      to_frames(slowest_sec - outputs.latency.audio_sec) + lead;
+  synth.stamp_delay = synth.dispatch_delay;
+  midi.stamp_delay = to_frames(slowest_sec - outputs.latency.midi_sec) + lead;
+  midi.dispatch_delay = midi.stamp_delay - lead;
+  for (Output *output : {&synth, &midi})
+    output->pass_start = first_frame;
+}
+
+// every pass starts from the first frame rather than the pass before so
+// rounding never adds up
+std::uint64_t FrameScheduler::pass_start_frame(std::uint64_t pass) const {
+  const double offset = pass * pass_duration_sec * sample_rate;
+  return first_frame + static_cast<std::uint64_t>(std::llround(offset));
+}
+
+std::uint64_t FrameScheduler::next_dispatch_frame(const Output &output) const {
+  if (output.events.empty())
+    return std::numeric_limits<std::uint64_t>::max();
+  return output.pass_start + output.events[output.next_event].frame +
+         output.dispatch_delay;
+}
+
+std::uint64_t FrameScheduler::next_event_frame() {
+  return std::min(next_dispatch_frame(synth), next_dispatch_frame(midi));
+}
+
+void FrameScheduler::advance(Output &output) {
+  if (++output.next_event == output.events.size()) {
+    output.next_event = 0;
+    output.pass_start = pass_start_frame(++output.pass);
+    // a pass is done once every output is done with it
+    num_passes.store(std::min(synth.events.empty() ? midi.pass : synth.pass,
+                              midi.events.empty() ? synth.pass : midi.pass),
+                     std::memory_order_relaxed);
+  }
+}
+
+void FrameScheduler::dispatch_due_events(std::uint64_t frame,
+                                         Synth &synth_out) {
+  while (next_dispatch_frame(synth) <= frame) {
+    const FramedMidiEvent &event = synth.events[synth.next_event];
+    synth_out.handle_event(event.status, event.data1, event.data2);
+    advance(synth);
+  }
+  while (next_dispatch_frame(midi) <= frame) {
+    const FramedMidiEvent &event = midi.events[midi.next_event];
+    const std::uint64_t due = midi.pass_start + event.frame + midi.stamp_delay;
+    if (!midi_events->try_push({due, event.status, event.data1, event.data2}))
+      num_midi_dropped.fetch_add(1, std::memory_order_relaxed);
+    advance(midi);
+  }
+}
+
+FramedMidiSender::FramedMidiSender(RtMidiOut &midi_out,
+                                   const FrameClock &frame_clock,
+                                   double sample_rate)
+    : FramedMidiSender(
+          [&midi_out](std::vector<unsigned char> &message) {
+            midi_out.sendMessage(&message);
+          },
+          frame_clock, sample_rate) {}
+
+FramedMidiSender::FramedMidiSender(Send send, const FrameClock &frame_clock,
+                                   double sample_rate)
+    : send(std::move(send)), frame_clock(frame_clock),
+      sample_rate(sample_rate) {}
+
+FramedMidiSender::~FramedMidiSender() { stop(); }
+
+void FramedMidiSender::start() {
+  stop();
+  is_running = true;
+  sending_thread = std::thread([this]() { run(); });
+}
+
+void FramedMidiSender::stop() {
+  is_running = false;
+  if (sending_thread.joinable())
+    sending_thread.join();
+}
+
+void FramedMidiSender::run() {
+  std::vector<unsigned char> message;
+  message.reserve(3);
+  while (is_running.load()) {
+    const FramedMidiEvent *event = events.peek();
+    FrameClock::clock::time_point due;
+    if (!event || !frame_clock.time_of_frame(event->frame, sample_rate, due)) {
+      std::this_thread::sleep_for(sender_poll_interval);
+      continue;
+    }
+    // a later callback can still move the clock, so don't sleep past the
+    // next look at it
+    const auto now = FrameClock::clock::now();
+    if (due > now) {
+      std::this_thread::sleep_until(std::min(due, now + sender_poll_interval));
+      continue;
+    }
+
+    message.assign({event->status, event->data1});
+    // program change and channel pressure carry one data byte
+    const std::uint8_t type = event->status & 0xF0;
+    if (type != 0xC0 && type != 0xD0)
+      message.push_back(event->data2);
+    send(message);
+    FramedMidiEvent sent;
+    events.try_pop(sent);
+  }
+}
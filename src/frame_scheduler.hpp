@@ -0,0 +1,143 @@
+#ifndef FRAME_SCHEDULER_HPP
+#define FRAME_SCHEDULER_HPP
+
+#include <RtMidi.h>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "frame_clock.hpp"
+#include "song_compiler.hpp"
+#include "spsc_ring_buffer.hpp"
+#include "synth.hpp"
+
+// a midi message stamped with the audio frame it is due on
+struct FramedMidiEvent {
+  std::uint64_t frame;
+  std::uint8_t status;
+  std::uint8_t data1;
+  std::uint8_t data2;
+};
+
+// how long after an output is handed an event it is heard: the audio
+// device's buffer for the synth, the driver and the synth on the other end for
+// midi, only the difference between the two matters
+struct OutputLatency {
+  double audio_sec = 0;
+  double midi_sec = 0;
+};
+
+// which events a FrameScheduler sends where
+struct FrameSchedulerOutputs {
+  // channels 1 - 16 as bits 0 - 15 whose events go to midi_events instead of
+  // the synth, all of them plays the whole song over midi
+  std::uint16_t midi_channels = 0;
+  SpscRingBuffer<FramedMidiEvent> *midi_events = nullptr;
+  // the output that's heard sooner gets its events that much later, so
+  // a hit on both sounds at the same instant instead of flamming
+  OutputLatency latency;
+};
+
+// plays a compiled song, looping, with the audio callback as the clock: the
+// synth asks for the events due in the frames it is about to render and gets
+// each one on its exact frame, nothing is timed with steady_clock so the
+// song keeps to the audio device's clock however far that drifts
+//
+// each event goes to the synth or to midi_events (for a FramedMidiSender) by
+// its channel, each output with its own delay so both are heard together, a
+// midi event is stamped with the frame it is due on and handed over a little
+// ahead so the sender is already waiting on it, this runs on the audio thread
+// so it never locks or allocates
+class FrameScheduler : public SynthEventSource {
+public:
+  // how far ahead of its frame a midi event is handed to the sender, so the
+  // sender is already waiting on it and not between looks at its queue
+  static constexpr double midi_lead_sec = 0.005;
+
+  // the song starts on first_frame of the synth's clock, delayed by the
+  // latency compensation (and the midi lead when anything goes to midi)
+  FrameScheduler(const CompiledSong &song, double sample_rate,
+                 const FrameSchedulerOutputs &outputs = {},
+                 std::uint64_t first_frame = 0);
+
+  std::uint64_t next_event_frame() override;
+  void dispatch_due_events(std::uint64_t frame, Synth &synth) override;
+
+  // times the song has played through, read from any thread
+  std::uint64_t get_num_passes() const { return num_passes.load(); }
+  // midi messages lost because the sender fell behind
+  std::uint64_t get_num_midi_dropped() const { return num_midi_dropped.load(); }
+
+  // frames each output's events come after their place in the song
+  std::uint64_t get_synth_delay_frames() const { return synth.stamp_delay; }
+  std::uint64_t get_midi_delay_frames() const { return midi.stamp_delay; }
+
+private:
+  // the events of one output and where it is in the song
+  struct Output {
+    // one pass through the song, frames from the start of the pass
+    std::vector<FramedMidiEvent> events;
+    // an event is handed over dispatch_delay frames after its song frame and
+    // is due stamp_delay frames after it
+    std::uint64_t dispatch_delay = 0;
+    std::uint64_t stamp_delay = 0;
+
+    // only touched by the audio thread
+    std::uint64_t pass = 0;
+    std::uint64_t pass_start = 0;
+    std::size_t next_event = 0;
+  };
+
+  std::uint64_t pass_start_frame(std::uint64_t pass) const;
+  std::uint64_t next_dispatch_frame(const Output &output) const;
+  void advance(Output &output);
+
+  double sample_rate;
+  double pass_duration_sec;
+  SpscRingBuffer<FramedMidiEvent> *midi_events;
+  std::uint64_t first_frame;
+  Output synth;
+  Output midi;
+
+  std::atomic<std::uint64_t> num_passes{0};
+  std::atomic<std::uint64_t> num_midi_dropped{0};
+};
+
+// sends what a FrameScheduler stamped out of a midi port when the audio clock
+// says its frame is rendered, so midi and the synth share one clock
+class FramedMidiSender {
+public:
+  // called on the sending thread with every message when it's due
+  using Send = std::function<void(std::vector<unsigned char> &message)>;
+
+  FramedMidiSender(RtMidiOut &midi_out, const FrameClock &frame_clock,
+                   double sample_rate);
+  // sends somewhere other than a port, like a capture sink when checking
+  // timing
+  FramedMidiSender(Send send, const FrameClock &frame_clock,
+                   double sample_rate);
+  ~FramedMidiSender();
+
+  FramedMidiSender(const FramedMidiSender &) = delete;
+  FramedMidiSender &operator=(const FramedMidiSender &) = delete;
+
+  // the scheduler's end, it's the only producer
+  SpscRingBuffer<FramedMidiEvent> &get_events() { return events; }
+
+  void start();
+  void stop();
+
+private:
+  void run();
+
+  Send send;
+  const FrameClock &frame_clock;
+  double sample_rate;
+  SpscRingBuffer<FramedMidiEvent> events{1 << 12};
+  std::atomic<bool> is_running{false};
+  std::thread sending_thread;
+};
+
+#endif // FRAME_SCHEDULER_HPP
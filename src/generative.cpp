@@ -0,0 +1,193 @@
+#include "generative.hpp"
+
+#include <algorithm>
+#include <random>
+#include <stdexcept>
+#include <unordered_map>
+
+namespace {
+
+// dense matrices grow with num_patterns^(order + 1), this keeps a typo in a
+// big layer from trying to allocate gigabytes
+constexpr std::size_t max_transition_cells = 1 << 24;
+
+bool row_is_empty(const double *row, std::size_t n) {
+  return std::all_of(row, row + n, [](double w) { return w <= 0; });
+}
+
+} // namespace
+
+CompiledLayer compile_layer(const GenerativeLayer &generative_layer) {
+  CompiledLayer layer;
+  std::unordered_map<std::string, std::uint32_t> name_to_id;
+
+  auto id_of = [&](const std::string &name) {
+    auto [it, inserted] = name_to_id.emplace(
+        name, static_cast<std::uint32_t>(layer.pattern_names.size()));
+    if (inserted)
+      layer.pattern_names.push_back(name);
+    return it->second;
+  };
+
+  // patterns that only show up in transitions get a base weight of 0
+  std::vector<double> &base_weights = layer.base_weights;
+  for (const auto &[pattern_name, weight] : generative_layer.choices) {
+    std::uint32_t id = id_of(pattern_name);
+    base_weights.resize(layer.pattern_names.size(), 0.0);
+    base_weights[id] += weight;
+  }
+
+  unsigned int order = 0;
+  for (const LayerTransition &transition : generative_layer.transitions) {
+    if (transition.previous.empty() || transition.previous.size() > 2) {
+      throw std::runtime_error(
+          "Invalid generative layer: transitions must look back one or two "
+          "patterns");
+    }
+    order = std::max(order, static_cast<unsigned int>(
+                                transition.previous.size()));
+    for (const std::string &name : transition.previous)
+      id_of(name);
+    id_of(transition.next);
+  }
+
+  const std::size_t n = layer.pattern_names.size();
+  if (n == 0) {
+    throw std::runtime_error("Invalid generative layer: no patterns");
+  }
+  base_weights.resize(n, 0.0);
+
+  // a layer made only of transitions starts uniformly
+  if (row_is_empty(base_weights.data(), n)) {
+    std::fill(base_weights.begin(), base_weights.end(), 1.0);
+  }
+
+  try {
+    layer.pattern_table = AliasTable(base_weights);
+  } catch (const std::runtime_error &e) {
+    throw std::runtime_error(std::string("Invalid generative layer: ") +
+                             e.what());
+  }
+
+  std::size_t num_rows = 1;
+  for (unsigned int k = 1; k <= order; ++k) {
+    num_rows *= n;
+    if (num_rows * n > max_transition_cells) {
+      throw std::runtime_error(
+          "Invalid generative layer: too many patterns for an order " +
+          std::to_string(order) + " transition matrix");
+    }
+
+    TransitionMatrix matrix;
+    matrix.order = k;
+    matrix.num_patterns = n;
+    matrix.weights.assign(num_rows * n, 0.0);
+
+    for (const LayerTransition &transition : generative_layer.transitions) {
+      if (transition.previous.size() != k)
+        continue;
+      std::size_t state = 0;
+      for (const std::string &name : transition.previous)
+        state = state * n + name_to_id.at(name);
+      matrix.weights[state * n + name_to_id.at(transition.next)] +=
+          transition.weight;
+    }
+
+    // back off to the lower order row, which only depends on the most recent
+    // pattern(s), that is the last k - 1 digits of the state
+    for (std::size_t state = 0; state < num_rows; ++state) {
+      double *row = matrix.weights.data() + state * n;
+      if (!row_is_empty(row, n))
+        continue;
+      const double *fallback =
+          k == 1 ? base_weights.data()
+                 : layer.transition_matrices.back().row(state % (num_rows / n));
+      std::copy(fallback, fallback + n, row);
+    }
+
+    matrix.rows = AliasRows(matrix.weights, n);
+    layer.transition_matrices.push_back(std::move(matrix));
+  }
+
+  return layer;
+}
+
+namespace {
+
+// the row index of the transition matrix that applies after history, or
+// npos when there is no history yet and the base weights apply
+std::size_t history_state(const CompiledLayer &layer,
+                          const std::uint32_t *history,
+                          std::size_t history_length, unsigned int &order) {
+  order = static_cast<unsigned int>(
+      std::min<std::size_t>(history_length, layer.order()));
+  std::size_t state = 0;
+  for (std::size_t j = history_length - order; j < history_length; ++j)
+    state = state * layer.pattern_names.size() + history[j];
+  return state;
+}
+
+} // namespace
+
+const double *CompiledLayer::weights_after(const std::uint32_t *history,
+                                           std::size_t history_length) const {
+  unsigned int order;
+  std::size_t state = history_state(*this, history, history_length, order);
+  if (order == 0)
+    return base_weights.data();
+  return transition_matrices[order - 1].row(state);
+}
+
+unsigned int CompiledLayer::sample_after(const std::uint32_t *history,
+                                         std::size_t history_length,
+                                         Xoshiro256 &rng) const {
+  unsigned int order;
+  std::size_t state = history_state(*this, history, history_length, order);
+  if (order == 0)
+    return pattern_table.sample(rng);
+  return transition_matrices[order - 1].rows.sample(state, rng);
+}
+
+std::vector<CompiledLayer>
+compile_layers(const std::vector<GenerativeLayer> &layers) {
+  std::vector<CompiledLayer> compiled;
+  compiled.reserve(layers.size());
+  for (const auto &layer : layers) {
+    compiled.push_back(compile_layer(layer));
+  }
+  return compiled;
+}
+
+std::vector<std::uint32_t> generate_pattern_ids(const CompiledLayer &layer,
+                                                std::size_t length,
+                                                Xoshiro256 &rng) {
+  std::vector<std::uint32_t> ids(length);
+  for (std::size_t i = 0; i < length; ++i) {
+    ids[i] = layer.sample_after(ids.data(), i, rng);
+  }
+
+  return ids;
+}
+
+AllSequences generate_sequences(const std::vector<CompiledLayer> &layers,
+                                int target_length, std::uint64_t seed) {
+  AllSequences sequences;
+  sequences.reserve(layers.size());
+  Xoshiro256 rng(seed);
+
+  for (const auto &layer : layers) {
+    Sequence sequence;
+    sequence.reserve(target_length);
+    for (std::uint32_t id : generate_pattern_ids(layer, target_length, rng)) {
+      sequence.push_back(layer.pattern_names[id]);
+    }
+    sequences.push_back(std::move(sequence));
+  }
+
+  return sequences;
+}
+
+std::uint64_t random_seed() {
+  std::random_device rd;
+  return (static_cast<std::uint64_t>(rd()) << 32) | rd();
+}
@@ -0,0 +1,93 @@
+#ifndef GENERATIVE_HPP
+#define GENERATIVE_HPP
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "weighted_sampling.hpp"
+
+using LayerChoices = std::vector<std::pair<std::string, unsigned>>;
+using Sequence = std::vector<std::string>;
+using AllSequences = std::vector<Sequence>;
+
+// a weighted transition written as "- A -> B: 5" (first order) or
+// "- A B -> C: 2" (second order) inside a layer
+struct LayerTransition {
+  // the patterns drawn in the blocks just before, oldest first
+  std::vector<std::string> previous;
+  std::string next;
+  unsigned weight;
+};
+
+// one layer of the GENERATIVE section as it was written in the file, without
+// transitions every block is an independent weighted draw from choices
+struct GenerativeLayer {
+  LayerChoices choices;
+  std::vector<LayerTransition> transitions;
+};
+
+// the weights for drawing the next pattern given the last order patterns,
+// rows are indexed by the pattern ids of the history read as a base
+// num_patterns number (oldest digit first) and each row has one column per
+// pattern id
+struct TransitionMatrix {
+  unsigned int order;
+  std::size_t num_patterns;
+  std::vector<double> weights; // row-major, num_patterns^order rows
+  AliasRows rows;
+
+  std::size_t num_rows() const { return weights.size() / num_patterns; }
+  const double *row(std::size_t state) const {
+    return weights.data() + state * num_patterns;
+  }
+};
+
+// a generative layer after its weights have been turned into alias tables,
+// this is built once when the jam file is loaded and is read only afterwards,
+// so drawing a pattern costs one random number and no walk over the choices
+struct CompiledLayer {
+  // pattern id -> pattern name
+  std::vector<std::string> pattern_names;
+  // used for blocks that don't have any history yet (or for every block when
+  // the layer has no transitions)
+  std::vector<double> base_weights;
+  AliasTable pattern_table;
+  // transition_matrices[k] conditions on the last k + 1 blocks, rows that
+  // weren't written in the file hold the next lower order row
+  std::vector<TransitionMatrix> transition_matrices;
+
+  unsigned int order() const {
+    return static_cast<unsigned int>(transition_matrices.size());
+  }
+
+  const std::string &sample(Xoshiro256 &rng) const {
+    return pattern_names[pattern_table.sample(rng)];
+  }
+
+  // the weights and alias row used to draw the block after history, which
+  // holds the pattern ids of every block drawn so far in this layer
+  const double *weights_after(const std::uint32_t *history,
+                              std::size_t history_length) const;
+  unsigned int sample_after(const std::uint32_t *history,
+                            std::size_t history_length, Xoshiro256 &rng) const;
+};
+
+CompiledLayer compile_layer(const GenerativeLayer &layer);
+std::vector<CompiledLayer>
+compile_layers(const std::vector<GenerativeLayer> &layers);
+
+// draws length pattern ids from a single layer following its transitions
+std::vector<std::uint32_t> generate_pattern_ids(const CompiledLayer &layer,
+                                                std::size_t length,
+                                                Xoshiro256 &rng);
+
+// draws target_length patterns per layer, the same seed always gives the same
+// sequences
+AllSequences generate_sequences(const std::vector<CompiledLayer> &layers,
+                                int target_length, std::uint64_t seed);
+
+std::uint64_t random_seed();
+
+#endif // GENERATIVE_HPP
@@ -1,11 +1,12 @@
 #include "jam_file_parsing.hpp"
 #include <algorithm>
+#include <filesystem>
 #include <iostream>
 #include <numeric> // std::lcm (C++17)
-#include <random>
 #include <regex>
 #include <stdexcept>
 #include <string>
+#include <tuple>
 #include <unordered_map>
 #include <vector>
 
@@ -44,6 +45,63 @@ parse_legend_to_symbol_to_note(std::istream &in) {
   return legend;
 }
 
+std::unordered_map<int, std::string>
+parse_legend_samples(std::istream &in, const std::string &jam_file_path) {
+  std::unordered_map<int, std::string> note_to_sample_path;
+  const std::filesystem::path directory =
+      std::filesystem::path(jam_file_path).parent_path();
+  std::regex entry_regex(R"((.*?):\s*(\d+)([',]*)\s+(\S.*?)\s*$)");
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line_should_be_skipped(line))
+      continue;
+    if (line.find("LEGEND END") != std::string::npos)
+      break;
+    std::smatch match;
+    if (!std::regex_search(line, match, entry_regex))
+      continue;
+    int note = std::stoi(match[2].str()) + 60;
+    for (char modifier : match[3].str())
+      note += modifier == '\'' ? 12 : -12;
+    if (note < 0 || note > 127) {
+      throw std::runtime_error("Legend entry " + trim(match[1].str()) +
+                               " is outside the midi note range");
+    }
+    std::filesystem::path sample_path = match[4].str();
+    if (sample_path.is_relative())
+      sample_path = directory / sample_path;
+    note_to_sample_path[note] = sample_path.string();
+  }
+  return note_to_sample_path;
+}
+
+std::vector<BackingTrack> parse_tracks(std::istream &in,
+                                       const std::string &jam_file_path) {
+  std::vector<BackingTrack> tracks;
+  const std::filesystem::path directory =
+      std::filesystem::path(jam_file_path).parent_path();
+  std::regex entry_regex(R"((.*?):\s*(\d+)\s+(\S.*?)\s*$)");
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line_should_be_skipped(line))
+      continue;
+    if (line.find("TRACKS END") != std::string::npos)
+      break;
+    std::smatch match;
+    if (!std::regex_search(line, match, entry_regex)) {
+      throw std::runtime_error("Track needs a name, a start bar and a file: " +
+                               trim(line));
+    }
+    std::filesystem::path track_path = match[3].str();
+    if (track_path.is_relative())
+      track_path = directory / track_path;
+    tracks.push_back({trim(match[1].str()),
+                      static_cast<unsigned int>(std::stoul(match[2].str())),
+                      track_path.string()});
+  }
+  return tracks;
+}
+
 std::vector<std::string>
 flatten_bar_strings(const std::vector<std::string> &lines) {
   std::vector<std::string> bars;
@@ -69,7 +127,8 @@ flatten_bar_strings(const std::vector<std::string> &lines) {
 std::pair<PatternMap, std::unordered_map<std::string, unsigned int>>
 parse_patterns(
     std::istream &in,
-    const std::unordered_map<std::string, std::string> &symbol_to_midi_note) {
+    const std::unordered_map<std::string, std::string> &symbol_to_midi_note,
+    std::vector<std::string> *grid_pattern_names) {
   PatternMap pattern_name_to_bars;
   std::unordered_map<std::string, unsigned int> pattern_name_to_channel;
 
@@ -93,6 +152,8 @@ parse_patterns(
     if (is_grid) {
       pattern_name_to_bars[current_pattern_name] = parse_grid_pattern(
           current_bars, symbol_to_midi_note, current_pattern_name);
+      if (grid_pattern_names)
+        grid_pattern_names->push_back(current_pattern_name);
     } else {
       pattern_name_to_bars[current_pattern_name] =
           flatten_bar_strings(current_bars);
@@ -196,25 +257,33 @@ std::vector<PatternData> parse_arrangement(
               return a.start_bar < b.start_bar;
             });
 
+  // for every pattern name, the bar each of its groups ends on -> the index
+  // of that group, so finding the group an entry extends doesn't need a scan
+  // over every group (long generated arrangements have thousands of them)
+  std::unordered_map<std::string, std::unordered_map<unsigned int, size_t>>
+      name_to_group_end_bars;
+
   std::vector<PatternData> grouped;
   for (const auto &entry : raw_entries) {
-    bool merged = false; // To track if a match was found and merged
-
-    for (auto &group : grouped) {
-      unsigned int num_bars_in_pattern =
-          pattern_name_to_bars.at(entry.name).size();
-      unsigned int last_end_bar =
-          group.start_bar + (group.num_repeats * num_bars_in_pattern);
-
-      if (group.name == entry.name && last_end_bar == entry.start_bar) {
-        group.num_repeats += entry.num_repeats;
-        merged = true;
-        break; // Exit the loop once merged
-      }
-    }
-
-    if (!merged) {
+    unsigned int num_bars_in_pattern =
+        pattern_name_to_bars.at(entry.name).size();
+    auto &end_bar_to_group = name_to_group_end_bars[entry.name];
+
+    auto it = end_bar_to_group.find(entry.start_bar);
+    if (it != end_bar_to_group.end()) {
+      size_t group_index = it->second;
+      end_bar_to_group.erase(it);
+
+      PatternData &group = grouped[group_index];
+      group.num_repeats += entry.num_repeats;
+      end_bar_to_group.emplace(group.start_bar + (group.num_repeats *
+                                                  num_bars_in_pattern),
+                               group_index);
+    } else {
       grouped.push_back(entry);
+      end_bar_to_group.emplace(entry.start_bar + (entry.num_repeats *
+                                                  num_bars_in_pattern),
+                               grouped.size() - 1);
     }
   }
 
@@ -359,10 +428,66 @@ std::vector<std::string> parse_grid_pattern(
   return bars;
 }
 
-std::vector<LayerChoices> parse_generative(std::istream &stream) {
-  std::vector<LayerChoices> result;
+// "A B -> C" gives ({"A", "B"}, "C"), an underscore stands for the blank
+// pattern since a blank can't be written between other names
+std::pair<std::vector<std::string>, std::string>
+parse_transition_names(const std::string &name) {
+  auto arrow_pos = name.find("->");
+  auto to_pattern_name = [](const std::string &token) {
+    return token == "_" ? std::string(" ") : token;
+  };
+
+  std::vector<std::string> previous;
+  std::stringstream lhs(name.substr(0, arrow_pos));
+  std::string token;
+  while (lhs >> token) {
+    previous.push_back(to_pattern_name(token));
+  }
+
+  std::string next = trim(name.substr(arrow_pos + 2));
+  if (next.empty() || next.find(' ') != std::string::npos) {
+    throw std::runtime_error("Invalid transition \"" + name +
+                             "\" in GENERATIVE section, expected one pattern "
+                             "after ->");
+  }
+  if (previous.empty() || previous.size() > 2) {
+    throw std::runtime_error("Invalid transition \"" + name +
+                             "\" in GENERATIVE section, expected one or two "
+                             "patterns before ->");
+  }
+
+  return {previous, to_pattern_name(next)};
+}
+
+void add_constraint(ArrangementConstraints &constraints,
+                    const std::string &key, unsigned int value) {
+  if (key == "max_simultaneous_layers") {
+    constraints.max_simultaneous_layers = value;
+  } else if (key == "min_simultaneous_layers") {
+    constraints.min_simultaneous_layers = value;
+  } else if (key == "max_repeats") {
+    constraints.max_repeats = value;
+  } else if (key == "require_channel") {
+    if (value < 1 || value > 16) {
+      throw std::runtime_error("require_channel must be between 1 and 16");
+    }
+    constraints.required_channels.push_back(value);
+  } else {
+    throw std::runtime_error("Unknown constraint \"" + key +
+                             "\" in GENERATIVE section");
+  }
+}
+
+std::pair<std::vector<GenerativeLayer>, ArrangementConstraints>
+parse_generative(std::istream &stream) {
+  std::vector<GenerativeLayer> result;
+  ArrangementConstraints constraints;
+  bool in_constraints_block = false;
   std::string line;
-  LayerChoices current_layer;
+  GenerativeLayer current_layer;
+  auto layer_is_empty = [](const GenerativeLayer &layer) {
+    return layer.choices.empty() && layer.transitions.empty();
+  };
   bool in_layer_block = false;
 
   std::cout << "Starting parse_generative..." << std::endl;
@@ -392,14 +517,30 @@ std::vector<LayerChoices> parse_generative(std::istream &stream) {
         std::cout << "Found new layer header: \"" << trimmed << "\""
                   << std::endl;
 
-        if (!current_layer.empty()) {
-          std::cout << "Storing current layer with " << current_layer.size()
-                    << " entries." << std::endl;
+        if (!layer_is_empty(current_layer)) {
+          std::cout << "Storing current layer with "
+                    << current_layer.choices.size() << " entries and "
+                    << current_layer.transitions.size() << " transitions."
+                    << std::endl;
           result.push_back(std::move(current_layer));
-          current_layer.clear();
+          current_layer = GenerativeLayer();
         }
 
-        in_layer_block = true;
+        in_constraints_block =
+            trim(trimmed.substr(1, trimmed.find(':') - 1)) == "constraints";
+        in_layer_block = !in_constraints_block;
+      } else if (in_constraints_block) {
+        auto colon_pos = trimmed.find(':');
+        std::string key = trim(trimmed.substr(1, colon_pos - 1));
+        std::string value_str = trim(trimmed.substr(colon_pos + 1));
+        try {
+          add_constraint(constraints, key, std::stoul(value_str));
+          std::cout << "Adding constraint " << key << " = " << value_str
+                    << std::endl;
+        } catch (const std::invalid_argument &) {
+          throw std::runtime_error("Invalid value \"" + value_str +
+                                   "\" for constraint " + key);
+        }
       } else {
         auto colon_pos = trimmed.find(':');
         std::string name = trimmed.substr(0, colon_pos);
@@ -418,9 +559,16 @@ std::vector<LayerChoices> parse_generative(std::istream &stream) {
 
         try {
           unsigned count = static_cast<unsigned>(std::stoul(count_str));
-          std::cout << "Adding (\"" << name << "\", " << count
-                    << ") to current layer." << std::endl;
-          current_layer.emplace_back(name, count);
+          if (name.find("->") != std::string::npos) {
+            auto [previous, next] = parse_transition_names(name);
+            std::cout << "Adding transition \"" << trim(name) << "\" with "
+                      << count << " to current layer." << std::endl;
+            current_layer.transitions.push_back({previous, next, count});
+          } else {
+            std::cout << "Adding (\"" << name << "\", " << count
+                      << ") to current layer." << std::endl;
+            current_layer.choices.emplace_back(name, count);
+          }
         } catch (const std::invalid_argument &) {
           std::cout << "Invalid count \"" << count_str << "\" for entry \""
                     << name << "\", skipping." << std::endl;
@@ -432,14 +580,15 @@ std::vector<LayerChoices> parse_generative(std::istream &stream) {
     }
   }
 
-  if (!current_layer.empty()) {
-    std::cout << "Storing final layer with " << current_layer.size()
-              << " entries." << std::endl;
+  if (!layer_is_empty(current_layer)) {
+    std::cout << "Storing final layer with " << current_layer.choices.size()
+              << " entries and " << current_layer.transitions.size()
+              << " transitions." << std::endl;
     result.push_back(std::move(current_layer));
   }
 
   std::cout << "Finished parsing. Total layers: " << result.size() << std::endl;
-  return result;
+  return {std::move(result), std::move(constraints)};
 }
 
 AllSequences duplicate_sequence_elements(const AllSequences &input, int n) {
@@ -462,28 +611,6 @@ AllSequences duplicate_sequence_elements(const AllSequences &input, int n) {
   return output;
 }
 
-// Function to sample a string based on weight
-std::string sample_string(const LayerChoices &choices, std::mt19937 &rng) {
-  unsigned total_weight = 0;
-  for (const auto &[_, weight] : choices) {
-    total_weight += weight;
-  }
-
-  std::uniform_int_distribution<> dist(1, total_weight);
-  unsigned r = dist(rng);
-
-  unsigned cumulative = 0;
-  for (const auto &[str, weight] : choices) {
-    cumulative += weight;
-    if (r <= cumulative) {
-      return str;
-    }
-  }
-
-  // Fallback (shouldn't happen if weights are valid)
-  return choices.back().first;
-}
-
 std::string to_multiline_string(const AllSequences &sequences) {
   std::ostringstream oss;
 
@@ -497,25 +624,9 @@ std::string to_multiline_string(const AllSequences &sequences) {
   return oss.str();
 }
 
-AllSequences generate_sequences(const std::vector<LayerChoices> &channels,
-                                int target_length) {
-  AllSequences sequences;
-  std::random_device rd;
-  std::mt19937 rng(rd());
-
-  for (const auto &channel : channels) {
-    Sequence sequence;
-    for (int i = 0; i < target_length; ++i) {
-      sequence.push_back(sample_string(channel, rng));
-    }
-    sequences.push_back(sequence);
-  }
-
-  return sequences;
-}
-
-unsigned int parse_data_section_for_bpm(std::stringstream &data_stream,
-                                        unsigned int default_bpm = 120) {
+std::unordered_map<std::string, std::string>
+parse_data_section(std::istream &data_stream) {
+  std::unordered_map<std::string, std::string> key_to_value;
   std::string line;
   while (std::getline(data_stream, line)) {
     if (line.empty())
@@ -543,20 +654,100 @@ unsigned int parse_data_section_for_bpm(std::stringstream &data_stream,
     value.erase(0, value.find_first_not_of(" \t"));
     value.erase(value.find_last_not_of(" \t") + 1);
 
-    if (key == "bpm") {
-      try {
-        return static_cast<unsigned int>(std::stoi(value));
-      } catch (...) {
-        break; // fall back to default
+    // the first occurrence of a key wins
+    key_to_value.emplace(key, value);
+  }
+
+  return key_to_value;
+}
+
+unsigned int parse_data_section_for_bpm(
+    const std::unordered_map<std::string, std::string> &data,
+    unsigned int default_bpm = 120) {
+  auto it = data.find("bpm");
+  if (it == data.end())
+    return default_bpm;
+  try {
+    return static_cast<unsigned int>(std::stoi(it->second));
+  } catch (...) {
+    return default_bpm; // fall back to default
+  }
+}
+
+// when the file doesn't pin a seed a fresh one is drawn, it is printed and
+// stored in the returned data so that a song you like can be reproduced
+std::uint64_t parse_data_section_for_seed(
+    const std::unordered_map<std::string, std::string> &data) {
+  auto it = data.find("seed");
+  if (it != data.end()) {
+    try {
+      return std::stoull(it->second);
+    } catch (...) {
+      std::cerr << "Invalid seed \"" << it->second
+                << "\" in DATA section, using a random one\n";
+    }
+  }
+  return random_seed();
+}
+
+unsigned int parse_data_section_for_num_blocks(
+    const std::unordered_map<std::string, std::string> &data,
+    unsigned int default_num_blocks = 20) {
+  auto it = data.find("num_blocks");
+  if (it == data.end())
+    return default_num_blocks;
+  try {
+    return static_cast<unsigned int>(std::stoul(it->second));
+  } catch (...) {
+    return default_num_blocks;
+  }
+}
+
+// the channel every pattern of every layer plays on, 0 for the blank pattern
+// and for names that aren't patterns (which the arrangement skips)
+std::vector<std::vector<unsigned int>>
+layer_pattern_channels(const JamFileData &jam_data) {
+  std::vector<std::vector<unsigned int>> channels;
+  for (const CompiledLayer &layer : jam_data.compiled_layers) {
+    std::vector<unsigned int> &layer_channels = channels.emplace_back();
+    for (const std::string &name : layer.pattern_names) {
+      unsigned int channel = 0;
+      if (jam_data.pattern_name_to_bars.count(name)) {
+        auto it = jam_data.pattern_name_to_channel.find(name);
+        channel = it == jam_data.pattern_name_to_channel.end() ? 1 : it->second;
       }
+      layer_channels.push_back(channel);
     }
   }
+  return channels;
+}
 
-  return default_bpm;
+// the legend's samples play on the channels of the grid patterns, the others
+// keep playing notes even when they share a note number with a sample
+void add_legend_samples(JamFileData &jam_data, const std::string &legend,
+                        const std::vector<std::string> &grid_pattern_names,
+                        const std::string &path) {
+  std::istringstream legend_stream(legend);
+  jam_data.note_to_sample_path = parse_legend_samples(legend_stream, path);
+  if (jam_data.note_to_sample_path.empty())
+    return;
+  for (const std::string &name : grid_pattern_names) {
+    auto channel_it = jam_data.pattern_name_to_channel.find(name);
+    unsigned int channel = channel_it == jam_data.pattern_name_to_channel.end()
+                               ? 1
+                               : channel_it->second;
+    if (std::find(jam_data.sample_channels.begin(),
+                  jam_data.sample_channels.end(),
+                  channel) == jam_data.sample_channels.end())
+      jam_data.sample_channels.push_back(channel);
+  }
 }
 
-JamFileData load_jam_file(const std::string &path) {
+JamFileData parse_jam_file(const std::string &path) {
   std::ifstream file(path);
+  if (!file) {
+    throw std::runtime_error("Could not open jam file: " + path);
+  }
   std::string line;
 
   std::stringstream data_stream;
@@ -564,6 +755,7 @@ JamFileData load_jam_file(const std::string &path) {
   std::stringstream patterns_stream;
   std::stringstream arrangement_stream;
   std::stringstream generative_stream;
+  std::stringstream tracks_stream;
 
   std::stringstream *current_stream = nullptr;
 
@@ -585,59 +777,180 @@ JamFileData load_jam_file(const std::string &path) {
       current_stream = &arrangement_stream;
     } else if (line.find("GENERATIVE START") != std::string::npos) {
       current_stream = &generative_stream;
+    } else if (line.find("TRACKS START") != std::string::npos) {
+      current_stream = &tracks_stream;
     } else if (current_stream) {
       *current_stream << line << '\n';
     }
   }
 
-  unsigned int bpm = parse_data_section_for_bpm(data_stream);
-  std::cout << "Using BPM: " << bpm << "\n";
+  JamFileData jam_data;
+
+  auto data = parse_data_section(data_stream);
+  jam_data.bpm = parse_data_section_for_bpm(data);
+  std::cout << "Using BPM: " << jam_data.bpm << "\n";
   auto legend_symbol_to_midi_note =
       parse_legend_to_symbol_to_note(legend_stream);
-  auto [pattern_name_to_bars, pattern_name_to_channel] =
-      parse_patterns(patterns_stream, legend_symbol_to_midi_note);
+  std::vector<std::string> grid_pattern_names;
+  std::tie(jam_data.pattern_name_to_bars, jam_data.pattern_name_to_channel) =
+      parse_patterns(patterns_stream, legend_symbol_to_midi_note,
+                     &grid_pattern_names);
+  add_legend_samples(jam_data, legend_stream.str(), grid_pattern_names, path);
+  jam_data.backing_tracks = parse_tracks(tracks_stream, path);
+
+  jam_data.num_generative_blocks = parse_data_section_for_num_blocks(data);
+  std::tie(jam_data.generative_layers, jam_data.constraints) =
+      parse_generative(generative_stream);
+  jam_data.compiled_layers = compile_layers(jam_data.generative_layers);
+
+  jam_data.has_generative_arrangement = !manual_arrangement;
+  if (manual_arrangement) {
+    jam_data.arrangement =
+        parse_arrangement(arrangement_stream, jam_data.pattern_name_to_bars);
+    // nothing is drawn, so there's no seed to pin
+    jam_data.seed = 0;
+  } else {
+    jam_data.seed = parse_data_section_for_seed(data);
+    std::cout << "Using seed: " << jam_data.seed << "\n";
+  }
 
-  auto layers_of_pattern_to_weight = parse_generative(generative_stream);
+  return jam_data;
+}
 
-  std::vector<PatternData> arrangement;
-  if (manual_arrangement) {
-    arrangement = parse_arrangement(arrangement_stream, pattern_name_to_bars);
-  } else { // generative
+std::vector<PatternData> generate_arrangement(const JamFileData &jam_data,
+                                              std::uint64_t seed,
+                                              bool print_sequences) {
+  int target_length = static_cast<int>(jam_data.num_generative_blocks);
+
+  AllSequences result =
+      jam_data.constraints.empty()
+          ? generate_sequences(jam_data.compiled_layers, target_length, seed)
+          : search_sequences(jam_data.compiled_layers, jam_data.constraints,
+                             layer_pattern_channels(jam_data), target_length,
+                             seed);
+  AllSequences duplicated_result = duplicate_sequence_elements(result, 4);
+
+  std::string multiline_input = to_multiline_string(duplicated_result);
+  multiline_input = "num_bars_per_block = 4\n" + multiline_input;
+  std::istringstream in_stream(multiline_input);
+
+  std::vector<PatternData> arrangement =
+      parse_arrangement(in_stream, jam_data.pattern_name_to_bars);
+
+  if (!print_sequences)
+    return arrangement;
+
+  std::cout << "generated arrangement" << std::endl;
+  std::cout << multiline_input << std::endl;
+
+  // Print the result
+  for (size_t i = 0; i < result.size(); ++i) {
+    std::cout << "Channel " << i << ": ";
+    for (const auto &s : result[i]) {
+      std::cout << s << " ";
+    }
+    std::cout << '\n';
+  }
 
-    int target_length = 20; // temp bad remove me
+  // Print the result
+  for (size_t i = 0; i < duplicated_result.size(); ++i) {
+    std::cout << "Channel " << i << ": ";
+    for (const auto &s : duplicated_result[i]) {
+      std::cout << s << " ";
+    }
+    std::cout << '\n';
+  }
 
-    AllSequences result =
-        generate_sequences(layers_of_pattern_to_weight, target_length);
-    AllSequences duplicated_result = duplicate_sequence_elements(result, 4);
+  return arrangement;
+}
 
-    std::string multiline_input = to_multiline_string(duplicated_result);
-    multiline_input = "ARRANGEMENT START\nnum_bars_per_block = 4\n" +
-                      multiline_input + "\nARRANGEMENT END";
-    std::cout << "generated arrangement" << std::endl;
-    std::cout << multiline_input << std::endl;
-    std::istringstream in_stream(multiline_input);
+JamFileData load_jam_file_pattern(const std::string &path,
+                                  const std::string &pattern_name) {
+  std::ifstream file(path);
+  if (!file) {
+    throw std::runtime_error("Could not open jam file: " + path);
+  }
+
+  std::stringstream data_stream;
+  std::stringstream legend_stream;
+  std::stringstream pattern_stream;
+  std::stringstream *current_stream = nullptr;
 
-    arrangement = parse_arrangement(in_stream, pattern_name_to_bars);
+  bool in_patterns = false;
+  bool in_wanted_pattern = false;
+  bool found = false;
 
-    // Print the result
-    for (size_t i = 0; i < result.size(); ++i) {
-      std::cout << "Channel " << i << ": ";
-      for (const auto &s : result[i]) {
-        std::cout << s << " ";
-      }
-      std::cout << '\n';
-    }
+  std::string line;
+  while (std::getline(file, line)) {
+    if (line_should_be_skipped(line))
+      continue;
+
+    // most lines are pattern lines, only look for section markers in lines
+    // that could be one
+    bool maybe_marker = line.find("START") != std::string::npos ||
+                        line.find("END") != std::string::npos;
 
-    // Print the result
-    for (size_t i = 0; i < duplicated_result.size(); ++i) {
-      std::cout << "Channel " << i << ": ";
-      for (const auto &s : duplicated_result[i]) {
-        std::cout << s << " ";
+    if (maybe_marker && line.find("DATA START") != std::string::npos) {
+      current_stream = &data_stream;
+    } else if (maybe_marker &&
+               line.find("LEGEND START") != std::string::npos) {
+      current_stream = &legend_stream;
+    } else if (maybe_marker &&
+               line.find("PATTERNS START") != std::string::npos) {
+      current_stream = nullptr;
+      in_patterns = true;
+    } else if (maybe_marker &&
+               line.find("PATTERNS END") != std::string::npos) {
+      in_patterns = false;
+      in_wanted_pattern = false;
+    } else if (maybe_marker &&
+               (line.find("ARRANGEMENT START") != std::string::npos ||
+                line.find("GENERATIVE START") != std::string::npos ||
+                line.find("TRACKS START") != std::string::npos)) {
+      current_stream = nullptr;
+    } else if (in_patterns) {
+      // only the lines of the wanted pattern are kept, everything else is
+      // skipped without being parsed, a header is "name(channel):" or
+      // "name:", comparing the name by hand keeps this scan cheap on files
+      // with thousands of patterns
+      size_t last = line.find_last_not_of(" \t\r");
+      if (last != std::string::npos && line[last] == ':') {
+        std::string name = trim(line.substr(0, line.find_first_of("(:")));
+        in_wanted_pattern = name == pattern_name;
+        found = found || in_wanted_pattern;
       }
-      std::cout << '\n';
+      if (in_wanted_pattern)
+        pattern_stream << line << '\n';
+    } else if (current_stream) {
+      *current_stream << line << '\n';
     }
   }
 
-  return {bpm, pattern_name_to_bars, pattern_name_to_channel, arrangement,
-          layers_of_pattern_to_weight};
+  if (!found) {
+    throw std::runtime_error("Pattern " + pattern_name + " not found in " +
+                             path);
+  }
+
+  JamFileData jam_data;
+  auto data = parse_data_section(data_stream);
+  jam_data.bpm = parse_data_section_for_bpm(data);
+  jam_data.seed = 0;
+  jam_data.num_generative_blocks = 0;
+  jam_data.has_generative_arrangement = false;
+  auto legend_symbol_to_midi_note =
+      parse_legend_to_symbol_to_note(legend_stream);
+  std::vector<std::string> grid_pattern_names;
+  std::tie(jam_data.pattern_name_to_bars, jam_data.pattern_name_to_channel) =
+      parse_patterns(pattern_stream, legend_symbol_to_midi_note,
+                     &grid_pattern_names);
+  add_legend_samples(jam_data, legend_stream.str(), grid_pattern_names, path);
+  return jam_data;
+}
+
+JamFileData load_jam_file(const std::string &path) {
+  JamFileData jam_data = parse_jam_file(path);
+  if (jam_data.has_generative_arrangement) {
+    jam_data.arrangement = generate_arrangement(jam_data, jam_data.seed, true);
+  }
+  return jam_data;
 }
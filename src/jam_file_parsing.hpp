@@ -1,6 +1,7 @@
 #ifndef JAM_FILE_PARSING_HPP
 #define JAM_FILE_PARSING_HPP
 
+#include <cstdint>
 #include <fstream>
 #include <iostream>
 #include <regex>
@@ -9,9 +10,8 @@
 #include <unordered_map>
 #include <vector>
 
-using LayerChoices = std::vector<std::pair<std::string, unsigned>>;
-using Sequence = std::vector<std::string>;
-using AllSequences = std::vector<Sequence>;
+#include "arrangement_search.hpp"
+#include "generative.hpp"
 
 struct LegendEntry {
   std::string name;
@@ -30,6 +30,14 @@ struct PatternData {
   unsigned int num_repeats;
 };
 
+// an audio file played along with the patterns, from the TRACKS section
+struct BackingTrack {
+  std::string name;
+  // the arrangement bar it starts on, 0 is the first
+  unsigned int start_bar;
+  std::string path;
+};
+
 // this is what is returned, and used to create the music,
 // the arrangement contains the structural information of the song over time
 // the other mappings are used to figure out what notes and what channels to
@@ -41,7 +49,25 @@ struct JamFileData {
   PatternMap pattern_name_to_bars;
   std::unordered_map<std::string, unsigned int> pattern_name_to_channel;
   std::vector<PatternData> arrangement;
-  std::vector<LayerChoices> layers_of_pattern_to_weight;
+  std::vector<GenerativeLayer> generative_layers;
+  std::vector<CompiledLayer> compiled_layers;
+  ArrangementConstraints constraints;
+  // how many blocks a generative arrangement is drawn for, "- num_blocks: ..."
+  // in the DATA section
+  unsigned int num_generative_blocks;
+  // the seed the generative arrangement was drawn with, put it in the DATA
+  // section as "- seed: ..." to get the same song again
+  std::uint64_t seed;
+  // true when the file has no ARRANGEMENT section and the arrangement is drawn
+  // from the generative layers
+  bool has_generative_arrangement;
+  // LEGEND entries that name a sample, the midi note to the sample's path
+  std::unordered_map<int, std::string> note_to_sample_path;
+  // the channels of patterns written as grids of legend names, the ones the
+  // samples play on
+  std::vector<unsigned int> sample_channels;
+  // audio files streamed alongside the song, in the order they are listed
+  std::vector<BackingTrack> backing_tracks;
 
   friend std::ostream &operator<<(std::ostream &os, const JamFileData &data) {
     os << "\n=== Parsed Pattern Bars ===\n";
@@ -67,29 +93,83 @@ struct JamFileData {
     os << "===========================\n";
 
     os << "=== Parsed Generative ===\n";
-    for (size_t i = 0; i < data.layers_of_pattern_to_weight.size(); ++i) {
+    if (data.has_generative_arrangement)
+      os << "Seed: " << data.seed << "\n";
+    for (size_t i = 0; i < data.generative_layers.size(); ++i) {
       os << "Layer " << i << ":\n";
       for (const auto &[pattern_name, weight] :
-           data.layers_of_pattern_to_weight[i]) {
+           data.generative_layers[i].choices) {
         os << "  \"" << pattern_name << "\": " << weight << "\n";
       }
+      for (const auto &transition : data.generative_layers[i].transitions) {
+        os << " ";
+        for (const std::string &previous : transition.previous) {
+          os << " \"" << previous << "\"";
+        }
+        os << " -> \"" << transition.next << "\": " << transition.weight
+           << "\n";
+      }
     }
+    if (data.constraints.max_simultaneous_layers)
+      os << "max_simultaneous_layers: "
+         << data.constraints.max_simultaneous_layers << "\n";
+    if (data.constraints.min_simultaneous_layers)
+      os << "min_simultaneous_layers: "
+         << data.constraints.min_simultaneous_layers << "\n";
+    if (data.constraints.max_repeats)
+      os << "max_repeats: " << data.constraints.max_repeats << "\n";
+    for (unsigned int channel : data.constraints.required_channels)
+      os << "require_channel: " << channel << "\n";
     os << "===========================\n";
 
+    for (const BackingTrack &track : data.backing_tracks)
+      os << "Track " << track.name << " from bar " << track.start_bar << ": "
+         << track.path << "\n";
+
     return os;
   }
 };
 
+std::string trim(const std::string &s);
+// blank lines and # comments
+bool line_should_be_skipped(const std::string &line);
+std::unordered_map<std::string, std::string>
+parse_data_section(std::istream &data_stream);
 std::unordered_map<std::string, std::string>
 parse_legend_to_symbol_to_note(std::istream &in);
+// "Kick: 0,, samples/kick.wav", the midi note of every legend entry that
+// names a sample to the sample's path, relative paths are taken from the jam
+// file's directory
+std::unordered_map<int, std::string>
+parse_legend_samples(std::istream &in, const std::string &jam_file_path);
+// "Drums: 16 stems/drums.wav", a track's name, the bar it starts on and its
+// file, relative paths are taken from the jam file's directory
+std::vector<BackingTrack> parse_tracks(std::istream &in,
+                                       const std::string &jam_file_path);
+// the names of the patterns written as grids are added to grid_pattern_names
+// when it's given
 std::pair<PatternMap, std::unordered_map<std::string, unsigned int>>
 parse_patterns(std::istream &in,
-               const std::unordered_map<std::string, std::string> &legend);
+               const std::unordered_map<std::string, std::string> &legend,
+               std::vector<std::string> *grid_pattern_names = nullptr);
 Arrangement parse_arrangement(std::istream &in);
 std::vector<std::string>
 parse_grid_pattern(const std::vector<std::string> &lines,
                    const std::unordered_map<std::string, std::string> &legend,
                    const std::string &pattern_name);
+// reads every section of the file but leaves the arrangement empty when it is
+// generative, the result is never modified afterwards so it can be shared
+// between threads drawing different arrangements
+JamFileData parse_jam_file(const std::string &path);
+std::vector<PatternData> generate_arrangement(const JamFileData &jam_data,
+                                              std::uint64_t seed,
+                                              bool print_sequences = false);
+// reads only what is needed to play a single pattern: the DATA and LEGEND
+// sections and that pattern's lines, every other pattern is skipped without
+// being parsed, the arrangement is left empty
+JamFileData load_jam_file_pattern(const std::string &path,
+                                  const std::string &pattern_name);
+// parse_jam_file followed by generate_arrangement with the file's seed
 JamFileData load_jam_file(const std::string &path);
 
 #endif // JAM_FILE_PARSING_HPP
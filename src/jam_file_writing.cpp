@@ -0,0 +1,520 @@
+#include "jam_file_writing.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <numeric>
+#include <regex>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+
+#include "jam_file_parsing.hpp"
+
+namespace {
+
+// "2'" -> 74, the inverse of midi_to_pitch_class
+int note_string_to_midi(const std::string &note) {
+  std::size_t digits_end = 0;
+  int midi_note = 60 + std::stoi(note, &digits_end);
+  for (char c : note.substr(digits_end)) {
+    if (c == '\'')
+      midi_note += 12;
+    else if (c == ',')
+      midi_note -= 12;
+  }
+  return midi_note;
+}
+
+// a step lasts slots_per_step / slots_per_beat beats, so giving every beat
+// slots_per_beat slots puts every step on a slot: straight sixteenths are 4
+// slots per beat, eighth triplets 3 and dotted sixteenths 8 with a note on
+// every third slot
+struct StepSlots {
+  long slots_per_beat;
+  long slots_per_step;
+};
+
+StepSlots slots_for_steps(const QuantizeSettings &settings) {
+  long p = settings.note_value;
+  long q = 4;
+  if (settings.feel == GridFeel::triplet) {
+    p *= 3;
+    q *= 2;
+  } else if (settings.feel == GridFeel::dotted) {
+    p *= 2;
+    q *= 3;
+  }
+  long divisor = std::gcd(p, q);
+  return {p / divisor, q / divisor};
+}
+
+// a note as written in a bar group, its length is kept in beats so it stays
+// the same when the bar is put on a different grid
+struct SlotNote {
+  std::string pitch; // "4'", as written
+  int midi_note;
+  int velocity; // 0 when the note doesn't give one
+  double length_beats;
+};
+
+// everything starting on one slot of a bar, controllers are kept by name
+// ("c1", "b", "p") so a later value on the same slot replaces an earlier one
+struct Slot {
+  std::vector<SlotNote> notes;
+  std::map<std::string, int> controls;
+
+  bool empty() const { return notes.empty() && controls.empty(); }
+
+  bool has_note(int midi_note) const {
+    return std::any_of(notes.begin(), notes.end(),
+                       [midi_note](const SlotNote &note) {
+                         return note.midi_note == midi_note;
+                       });
+  }
+};
+
+// what a take plays on every slot of beats [first_beat, first_beat +
+// num_beats): notes with their velocity and length, and the last value of
+// every controller on a slot (controllers are thinned out first and then put
+// on the nearest slot), program changes and poly pressure have no way to be
+// written in a bar and are left out
+std::vector<Slot> take_slots(const QuantizedTake &take,
+                             const StepSlots &step_slots, long first_beat,
+                             long num_beats,
+                             const PerformanceSettings &performance_settings) {
+  const long p = step_slots.slots_per_beat;
+  const double beat_sec = 60.0 / take.settings.bpm;
+  // notes still held when the take ends last to the end of its grid
+  const Performance performance =
+      extract_performance(take.events, performance_settings,
+                          take.num_steps() * take.step_duration_sec);
+  std::vector<std::int32_t> event_note(take.events.size(), -1);
+  for (std::size_t n = 0; n < performance.notes.size(); ++n)
+    event_note[performance.notes[n].event_index] = static_cast<std::int32_t>(n);
+
+  std::vector<Slot> slots(num_beats * p);
+  for (std::size_t step = 0; step < take.num_steps(); ++step) {
+    long slot = static_cast<long>(step) * step_slots.slots_per_step -
+                first_beat * p;
+    if (slot < 0 || slot >= static_cast<long>(slots.size()))
+      continue;
+    for (std::size_t i = take.step_begin(step); i < take.step_end(step); ++i) {
+      std::int32_t n = event_note[take.step_event_indices[i]];
+      if (n < 0)
+        continue;
+      const PerformanceNote &note = performance.notes[n];
+      if (slots[slot].has_note(note.note))
+        continue;
+      slots[slot].notes.push_back({midi_to_pitch_class(note.note), note.note,
+                                   note.velocity,
+                                   note.duration_sec / beat_sec});
+    }
+  }
+
+  const double slot_sec = beat_sec / p;
+  for (const PerformanceControl &control : performance.controls) {
+    std::string name;
+    if (control.type() == 0xB0) {
+      name = "c" + std::to_string(control.data1);
+    } else if (control.type() == 0xE0) {
+      name = "b";
+    } else if (control.type() == 0xD0) {
+      name = "p";
+    } else {
+      continue;
+    }
+    long slot = std::lround(control.time_sec / slot_sec) - first_beat * p;
+    if (slot < 0 || slot >= static_cast<long>(slots.size()))
+      continue;
+    slots[slot].controls[name] = control.value();
+  }
+  return slots;
+}
+
+// "(4:96~2.5 7:80 c1=64)" or "-", lengths are written in slots of a bar with
+// num_slots slots and left out when they are one slot
+std::string format_slot(const Slot &slot, long num_slots) {
+  if (slot.empty())
+    return "-";
+
+  std::string group = "(";
+  auto add_token = [&group](const std::string &token) {
+    if (group.size() > 1)
+      group += " ";
+    group += token;
+  };
+  for (const SlotNote &note : slot.notes) {
+    std::string token = note.pitch;
+    if (note.velocity > 0)
+      token += ":" + std::to_string(note.velocity);
+    const double length_slots = note.length_beats * num_slots;
+    if (std::abs(length_slots - 1) >= 0.005) {
+      char length[32];
+      std::snprintf(length, sizeof(length), "%.2f", length_slots);
+      std::string trimmed = length;
+      trimmed.erase(trimmed.find_last_not_of('0') + 1);
+      if (trimmed.back() == '.')
+        trimmed.pop_back();
+      token += "~" + trimmed;
+    }
+    add_token(token);
+  }
+  for (const auto &[name, value] : slot.controls)
+    add_token(name + "=" + std::to_string(value));
+  return group + ")";
+}
+
+// a pattern header is "name(channel):" or "name:"
+bool is_pattern_header(const std::string &line, std::string &name) {
+  if (line_should_be_skipped(line))
+    return false;
+  std::string trimmed = trim(line);
+  if (trimmed.empty() || trimmed.back() != ':')
+    return false;
+  name = trim(trimmed.substr(0, trimmed.find_first_of("(:")));
+  return true;
+}
+
+} // namespace
+
+std::string midi_to_pitch_class(int midi_note) {
+  const int base_midi = 60; // MIDI note number for '0'
+  if (midi_note < 0 || midi_note > 127)
+    throw std::out_of_range("MIDI note must be between 0 and 127");
+
+  int diff = midi_note - base_midi;
+  int pitch_class = (diff % 12 + 12) % 12; // ensures pitch_class is always 0–11
+  // floor division, plain / rounds towards zero which put the notes just
+  // below middle c an octave too high
+  int octave_shift = (diff - pitch_class) / 12;
+
+  std::string suffix;
+  if (octave_shift > 0) {
+    suffix = std::string(octave_shift, '\'');
+  } else if (octave_shift < 0) {
+    suffix = std::string(-octave_shift, ',');
+  }
+
+  return std::to_string(pitch_class) + suffix;
+}
+
+std::vector<std::string> format_take_as_pattern(
+    const QuantizedTake &take, const std::string &pattern_name,
+    unsigned int channel, TakeFormat format,
+    const std::unordered_map<std::string, std::string> &legend_symbol_to_note,
+    int skip_bars, const PerformanceSettings &performance_settings) {
+  const QuantizeSettings &settings = take.settings;
+  const StepSlots step_slots = slots_for_steps(settings);
+  const long p = step_slots.slots_per_beat;
+  const long q = step_slots.slots_per_step;
+
+  const long num_beats =
+      (static_cast<long>(take.num_steps()) * q + p - 1) / p;
+  const long first_beat =
+      static_cast<long>(std::max(skip_bars, 0)) * settings.beats_per_bar;
+  if (num_beats <= first_beat) {
+    throw std::runtime_error("The take is too short to make a pattern from");
+  }
+
+  // what starts on every slot, from the first kept beat on
+  std::vector<Slot> slots = take_slots(take, step_slots, first_beat,
+                                       num_beats - first_beat,
+                                       performance_settings);
+  std::set<int> used_notes;
+  for (Slot &slot : slots) {
+    std::sort(slot.notes.begin(), slot.notes.end(),
+              [](const SlotNote &a, const SlotNote &b) {
+                return a.midi_note < b.midi_note;
+              });
+    for (const SlotNote &note : slot.notes)
+      used_notes.insert(note.midi_note);
+  }
+
+  std::vector<std::string> lines;
+  lines.push_back(pattern_name + "(" + std::to_string(channel) + "):");
+
+  if (format == TakeFormat::notes) {
+    std::string line;
+    for (std::size_t slot = 0; slot < slots.size(); ++slot) {
+      if (slot % p == 0)
+        line += "| ";
+      line += format_slot(slots[slot], p) + " ";
+
+      long beat = static_cast<long>(slot) / p;
+      bool is_last_of_beat = (slot + 1) % p == 0;
+      bool is_last_of_bar =
+          is_last_of_beat && (beat + 1) % settings.beats_per_bar == 0;
+      if (is_last_of_bar || slot + 1 == slots.size()) {
+        lines.push_back(line + "|");
+        line.clear();
+      }
+    }
+    return lines;
+  }
+
+  if (used_notes.empty()) {
+    throw std::runtime_error("The take has no notes to write as a grid");
+  }
+
+  // several legend names can share a note, pick the same one every time
+  std::map<int, std::string> midi_note_to_name;
+  for (const auto &[name, note] : legend_symbol_to_note) {
+    int midi_note = note_string_to_midi(note);
+    auto it = midi_note_to_name.find(midi_note);
+    if (it == midi_note_to_name.end() || name < it->second)
+      midi_note_to_name[midi_note] = name;
+  }
+
+  std::size_t name_width = 0;
+  for (int midi_note : used_notes) {
+    auto it = midi_note_to_name.find(midi_note);
+    if (it == midi_note_to_name.end()) {
+      throw std::runtime_error("Recorded note " +
+                               midi_to_pitch_class(midi_note) +
+                               " has no name in the legend");
+    }
+    name_width = std::max(name_width, it->second.size());
+  }
+
+  // highest note first, which for general midi drums puts the cymbals above
+  // the kick like the patterns people write by hand
+  for (auto it = used_notes.rbegin(); it != used_notes.rend(); ++it) {
+    const std::string &name = midi_note_to_name.at(*it);
+    std::string line = "(" + name + ")" +
+                       std::string(name_width - name.size() + 1, ' ');
+    for (std::size_t slot = 0; slot < slots.size(); ++slot) {
+      if (slot % p == 0)
+        line += "|";
+      line += slots[slot].has_note(*it) ? 'x' : '-';
+    }
+    lines.push_back(line + "|");
+  }
+  return lines;
+}
+
+std::vector<std::string>
+merge_take_into_bars(const std::vector<std::string> &bar_strings,
+                     const QuantizedTake &take,
+                     const PerformanceSettings &performance_settings) {
+  static const std::regex group_regex(R"(\(([^)]*)\)|-)");
+  // the same tokens Bar reads
+  static const std::regex token_regex(R"(c(\d+)=(\d+)|([bp])=(\d+)|)"
+                                      R"((\d+[',]*)(?::(\d+))?)"
+                                      R"((?:~(\d*\.?\d+))?)");
+
+  const StepSlots step_slots = slots_for_steps(take.settings);
+  const long p = step_slots.slots_per_beat;
+  std::vector<Slot> recorded_slots =
+      take_slots(take, step_slots, 0, static_cast<long>(bar_strings.size()),
+                 performance_settings);
+
+  std::vector<std::string> merged_bars = bar_strings;
+  for (std::size_t beat = 0; beat < bar_strings.size(); ++beat) {
+    const std::string &bar = bar_strings[beat];
+
+    // what is already there, one slot per group, kept as written
+    std::vector<Slot> groups;
+    std::set<int> existing_notes;
+    for (auto it = std::sregex_iterator(bar.begin(), bar.end(), group_regex);
+         it != std::sregex_iterator(); ++it) {
+      const std::string contents = (*it)[1].str();
+      groups.emplace_back();
+      for (auto tit = std::sregex_iterator(contents.begin(), contents.end(),
+                                           token_regex);
+           tit != std::sregex_iterator(); ++tit) {
+        const std::smatch &token = *tit;
+        if (token[1].matched) {
+          groups.back().controls["c" + token[1].str()] =
+              std::stoi(token[2].str());
+        } else if (token[3].matched) {
+          groups.back().controls[token[3].str()] = std::stoi(token[4].str());
+        } else {
+          int midi_note = note_string_to_midi(token[5].str());
+          int velocity = token[6].matched ? std::stoi(token[6].str()) : 0;
+          double length = token[7].matched ? std::stod(token[7].str()) : 1.0;
+          // lengths are in groups of this bar until the grid is known
+          groups.back().notes.push_back(
+              {token[5].str(), midi_note, velocity, length});
+          existing_notes.insert(midi_note);
+        }
+      }
+    }
+    if (groups.empty())
+      groups.emplace_back();
+
+    // both grids fit on one with the least common multiple of their slots
+    const long num_groups = static_cast<long>(groups.size());
+    const long num_slots = std::lcm(num_groups, p);
+    std::vector<Slot> slots(num_slots);
+    for (long i = 0; i < num_groups; ++i) {
+      for (SlotNote &note : groups[i].notes)
+        note.length_beats /= num_groups;
+      slots[i * (num_slots / num_groups)] = std::move(groups[i]);
+    }
+
+    bool has_changed = false;
+    for (long j = 0; j < p; ++j) {
+      const Slot &recorded = recorded_slots[beat * p + j];
+      Slot &slot = slots[j * (num_slots / p)];
+      for (const SlotNote &note : recorded.notes) {
+        // a note that is already in the bar (anywhere) isn't doubled
+        if (!existing_notes.insert(note.midi_note).second)
+          continue;
+        slot.notes.push_back(note);
+        has_changed = true;
+      }
+      // a recorded controller value replaces one on the same slot
+      for (const auto &[name, value] : recorded.controls) {
+        auto [it, is_new] = slot.controls.emplace(name, value);
+        if (is_new || it->second != value) {
+          it->second = value;
+          has_changed = true;
+        }
+      }
+    }
+    if (!has_changed)
+      continue;
+
+    // the coarsest grid that still has everything on a slot
+    long stride = num_slots;
+    for (long i = 0; i < num_slots; ++i) {
+      if (!slots[i].empty())
+        stride = std::gcd(stride, i);
+    }
+
+    std::string merged;
+    for (long i = 0; i < num_slots; i += stride) {
+      if (!merged.empty())
+        merged += " ";
+      merged += format_slot(slots[i], num_slots / stride);
+    }
+    merged_bars[beat] = merged;
+  }
+  return merged_bars;
+}
+
+std::unordered_map<std::string, std::string>
+read_jam_file_legend(const std::string &path) {
+  std::ifstream file(path);
+  if (!file) {
+    throw std::runtime_error("Could not open jam file: " + path);
+  }
+
+  std::stringstream legend_stream;
+  bool in_legend = false;
+  std::string line;
+  while (std::getline(file, line)) {
+    if (line.find("LEGEND START") != std::string::npos) {
+      in_legend = true;
+    } else if (line.find("LEGEND END") != std::string::npos) {
+      break;
+    } else if (in_legend) {
+      legend_stream << line << '\n';
+    }
+  }
+  return parse_legend_to_symbol_to_note(legend_stream);
+}
+
+void write_pattern_to_jam_file(const std::string &path,
+                               const std::string &pattern_name,
+                               const std::vector<std::string> &pattern_lines) {
+  std::vector<std::string> lines;
+  bool ends_with_newline = true;
+  {
+    std::ifstream file(path);
+    if (file) {
+      std::stringstream contents;
+      contents << file.rdbuf();
+      std::string text = contents.str();
+      ends_with_newline = text.empty() || text.back() == '\n';
+      std::stringstream text_stream(text);
+      std::string line;
+      while (std::getline(text_stream, line))
+        lines.push_back(line);
+    }
+  }
+
+  std::size_t patterns_start = lines.size();
+  std::size_t patterns_end = lines.size();
+  for (std::size_t i = 0; i < lines.size(); ++i) {
+    if (lines[i].find("PATTERNS START") != std::string::npos) {
+      patterns_start = i;
+    } else if (patterns_start < lines.size() &&
+               lines[i].find("PATTERNS END") != std::string::npos) {
+      patterns_end = i;
+      break;
+    }
+  }
+
+  if (patterns_start == lines.size()) {
+    // no patterns yet, give the file a section of its own
+    if (!lines.empty() && !trim(lines.back()).empty())
+      lines.push_back("");
+    lines.push_back("PATTERNS START");
+    lines.push_back("");
+    lines.insert(lines.end(), pattern_lines.begin(), pattern_lines.end());
+    lines.push_back("");
+    lines.push_back("PATTERNS END");
+  } else {
+    if (patterns_end == lines.size()) {
+      throw std::runtime_error("PATTERNS section of " + path +
+                               " is never closed");
+    }
+
+    // the existing pattern runs from its header to its last line before the
+    // next header, blank lines and comments after it are left where they are
+    std::size_t replace_begin = patterns_end;
+    std::size_t replace_end = patterns_end;
+    for (std::size_t i = patterns_start + 1; i < patterns_end; ++i) {
+      std::string name;
+      if (!is_pattern_header(lines[i], name) || name != pattern_name)
+        continue;
+      replace_begin = i;
+      replace_end = i + 1;
+      for (std::size_t j = i + 1; j < patterns_end; ++j) {
+        std::string next_name;
+        if (is_pattern_header(lines[j], next_name))
+          break;
+        if (!line_should_be_skipped(lines[j]))
+          replace_end = j + 1;
+      }
+      break;
+    }
+
+    if (replace_begin < patterns_end) {
+      lines.erase(lines.begin() + replace_begin, lines.begin() + replace_end);
+      lines.insert(lines.begin() + replace_begin, pattern_lines.begin(),
+                   pattern_lines.end());
+    } else {
+      std::vector<std::string> added;
+      if (!trim(lines[patterns_end - 1]).empty())
+        added.push_back("");
+      added.insert(added.end(), pattern_lines.begin(), pattern_lines.end());
+      added.push_back("");
+      lines.insert(lines.begin() + patterns_end, added.begin(), added.end());
+    }
+  }
+
+  const std::string temporary_path = path + ".tmp";
+  {
+    std::ofstream out(temporary_path, std::ios::trunc);
+    if (!out) {
+      throw std::runtime_error("Could not write " + temporary_path);
+    }
+    for (std::size_t i = 0; i < lines.size(); ++i) {
+      out << lines[i];
+      if (i + 1 < lines.size() || ends_with_newline)
+        out << '\n';
+    }
+    if (!out.flush()) {
+      throw std::runtime_error("Could not write " + temporary_path);
+    }
+  }
+  if (std::rename(temporary_path.c_str(), path.c_str()) != 0) {
+    std::remove(temporary_path.c_str());
+    throw std::runtime_error("Could not replace " + path);
+  }
+}
@@ -0,0 +1,66 @@
+#ifndef JAM_FILE_WRITING_HPP
+#define JAM_FILE_WRITING_HPP
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "performance.hpp"
+#include "quantizer.hpp"
+
+// notes are written relative to middle c the way Bar reads them, 60 is "0",
+// 71 is "11", 72 is "0'" and 59 is "11,"
+std::string midi_to_pitch_class(int midi_note);
+
+enum class TakeFormat {
+  // | (0 4 7) - (2) - | ... one pitch list per step
+  notes,
+  // (Kick) |x---|... one row per drum, named through the LEGEND
+  grid
+};
+
+// turns a quantized take into the lines of a PATTERNS entry, header included,
+// every jam bar (one beat) gets the same number of steps and each line holds
+// one bar of the take, the first skip_bars bars (the count in) are left out,
+// swing isn't written since the pattern format has no way to say it
+//
+// the notes format keeps how the take was played: every note gets its
+// velocity and (when it isn't one step) its length, 4:96~2.5, and controllers
+// are thinned out with performance_settings and written on the nearest step,
+// c1=64, b=8192, p=100, the grid format only has hits and throws when a
+// recorded note has no name in the legend
+std::vector<std::string>
+format_take_as_pattern(const QuantizedTake &take,
+                       const std::string &pattern_name, unsigned int channel,
+                       TakeFormat format,
+                       const std::unordered_map<std::string, std::string>
+                           &legend_symbol_to_note,
+                       int skip_bars = 0,
+                       const PerformanceSettings &performance_settings = {});
+
+// adds the notes of a take to the bars of a pattern, one bar string per jam
+// bar (beat) starting at the take's time 0, the way PatternBars splits them:
+// notes already in a bar are kept as written and recorded notes that aren't
+// in it yet are added on a grid fine enough for both, with their velocity and
+// length like format_take_as_pattern writes them, recorded controller values
+// replace ones on the same step, bars nothing was added to come back
+// unchanged, the take's steps past the last bar are left out
+std::vector<std::string>
+merge_take_into_bars(const std::vector<std::string> &bar_strings,
+                     const QuantizedTake &take,
+                     const PerformanceSettings &performance_settings = {});
+
+// the LEGEND section of a jam file, empty when the file has none
+std::unordered_map<std::string, std::string>
+read_jam_file_legend(const std::string &path);
+
+// puts a pattern into the PATTERNS section of a jam file: an existing pattern
+// with the same name is replaced in place, otherwise it is added at the end of
+// the section (and the section is created when there isn't one), every other
+// line of the file is written back untouched, the file is replaced with a
+// rename so a failed write never leaves half a file behind
+void write_pattern_to_jam_file(const std::string &path,
+                               const std::string &pattern_name,
+                               const std::vector<std::string> &pattern_lines);
+
+#endif // JAM_FILE_WRITING_HPP
@@ -0,0 +1,104 @@
+#include "latency_calibration.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+std::string calibration_device_key(const std::string &midi_input_name,
+                                   const std::string &audio_output_name) {
+  return midi_input_name + " -> " + audio_output_name;
+}
+
+std::string output_calibration_key(const std::string &midi_output_name,
+                                   const std::string &audio_output_name) {
+  return "midi out " + midi_output_name + " vs " + audio_output_name;
+}
+
+RunningStats measure_tap_offsets(const std::vector<CapturedMidiMessage> &events,
+                                 double click_interval_sec, int first_click,
+                                 int num_clicks) {
+  RunningStats offsets;
+  for (const CapturedMidiMessage &event : events) {
+    bool is_note_on = event.size == 3 && (event.bytes[0] & 0xF0) == 0x90 &&
+                      event.bytes[2] > 0;
+    if (!is_note_on)
+      continue;
+
+    long click = std::lround(event.timestamp_sec / click_interval_sec);
+    if (click < first_click || click >= first_click + num_clicks)
+      continue;
+
+    double offset = event.timestamp_sec - click * click_interval_sec;
+    if (std::abs(offset) > click_interval_sec / 4)
+      continue;
+    offsets.add(offset);
+  }
+  return offsets;
+}
+
+// a line is "offset_ms stddev_ms num_taps key", the key goes last since it can
+// have spaces in it
+std::optional<LatencyCalibration>
+load_latency_calibration(const std::string &path, const std::string &key) {
+  std::ifstream file(path);
+  std::string line;
+  while (std::getline(file, line)) {
+    std::istringstream line_stream(line);
+    double offset_ms = 0;
+    double stddev_ms = 0;
+    std::uint64_t num_taps = 0;
+    if (!(line_stream >> offset_ms >> stddev_ms >> num_taps))
+      continue;
+    std::string line_key;
+    line_stream >> std::ws;
+    std::getline(line_stream, line_key);
+    if (line_key == key)
+      return LatencyCalibration{offset_ms / 1e3, stddev_ms / 1e3, num_taps};
+  }
+  return std::nullopt;
+}
+
+void save_latency_calibration(const std::string &path, const std::string &key,
+                              const LatencyCalibration &calibration) {
+  std::vector<std::string> kept_lines;
+  {
+    std::ifstream file(path);
+    std::string line;
+    while (std::getline(file, line)) {
+      std::istringstream line_stream(line);
+      double offset_ms, stddev_ms;
+      std::uint64_t num_taps;
+      std::string line_key;
+      if (line_stream >> offset_ms >> stddev_ms >> num_taps) {
+        line_stream >> std::ws;
+        std::getline(line_stream, line_key);
+        if (line_key == key)
+          continue;
+      }
+      kept_lines.push_back(line);
+    }
+  }
+
+  const std::string temporary_path = path + ".tmp";
+  {
+    std::ofstream out(temporary_path, std::ios::trunc);
+    for (const std::string &line : kept_lines)
+      out << line << '\n';
+    out << calibration.offset_sec * 1e3 << ' ' << calibration.stddev_sec * 1e3
+        << ' ' << calibration.num_taps << ' ' << key << '\n';
+    if (!out.flush())
+      throw std::runtime_error("Could not write " + temporary_path);
+  }
+  if (std::rename(temporary_path.c_str(), path.c_str()) != 0) {
+    std::remove(temporary_path.c_str());
+    throw std::runtime_error("Could not replace " + path);
+  }
+}
+
+void compensate_latency(std::vector<CapturedMidiMessage> &events,
+                        double offset_sec) {
+  for (CapturedMidiMessage &event : events)
+    event.timestamp_sec -= offset_sec;
+}
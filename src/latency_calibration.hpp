@@ -0,0 +1,53 @@
+#ifndef LATENCY_CALIBRATION_HPP
+#define LATENCY_CALIBRATION_HPP
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "midi_recorder.hpp"
+#include "stats.hpp"
+
+// how late input played along to the click arrives, which is the audio output
+// latency plus the player's reaction plus the midi input latency, measured per
+// pair of midi input and audio output since all three change with the devices
+struct LatencyCalibration {
+  double offset_sec = 0;
+  double stddev_sec = 0;
+  std::uint64_t num_taps = 0;
+};
+
+// where calibrations are kept, next to song.jam and the click sounds
+inline const char *default_calibration_path = "latency_calibration.txt";
+
+// identifies a midi input and audio output pair in the calibration file
+std::string calibration_device_key(const std::string &midi_input_name,
+                                   const std::string &audio_output_name);
+// identifies a midi output measured against an audio output, its calibration's
+// offset is how much later midi sent to the output is heard than audio handed
+// to the audio output at the same time (negative when it's heard sooner)
+std::string output_calibration_key(const std::string &midi_output_name,
+                                   const std::string &audio_output_name);
+
+// how far every tap was from its closest click, for clicks
+// [first_click, first_click + num_clicks) at click_interval_sec apart starting
+// at time 0, taps further than a quarter of the interval from any click are
+// taken to be mistakes and left out
+RunningStats measure_tap_offsets(const std::vector<CapturedMidiMessage> &events,
+                                 double click_interval_sec, int first_click,
+                                 int num_clicks);
+
+// the stored calibration for a device, nothing when there isn't one
+std::optional<LatencyCalibration>
+load_latency_calibration(const std::string &path, const std::string &key);
+// replaces the device's line in the file, other devices are kept
+void save_latency_calibration(const std::string &path, const std::string &key,
+                              const LatencyCalibration &calibration);
+
+// moves every message earlier by the offset so that notes played on a click
+// land on the click
+void compensate_latency(std::vector<CapturedMidiMessage> &events,
+                        double offset_sec);
+
+#endif // LATENCY_CALIBRATION_HPP
@@ -3,147 +3,1476 @@
 #include <atomic>
 #include <chrono>
 #include <cmath>
+#include <ctime>
+#include <filesystem>
+#include <future>
 #include <iomanip>
 #include <iostream>
+#include <memory>
 #include <mutex>
+#include <optional>
+#include <regex>
 #include <sstream>
 #include <string>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
 #include "miniaudio/miniaudio.h"
 
+#include "batch_generation.hpp"
+#include "alignment_check.hpp"
+#include "audio_engine.hpp"
+#include "backing_tracks.hpp"
+#include "capture_journal.hpp"
+#include "click_check.hpp"
+#include "frame_scheduler.hpp"
 #include "jam_file_parsing.hpp"
+#include "jam_file_writing.hpp"
+#include "latency_calibration.hpp"
+#include "metronome.hpp"
+#include "midi_recorder.hpp"
 #include "music_elements.hpp"
+#include "offline_render.hpp"
+#include "overdub.hpp"
+#include "performance.hpp"
+#include "quantizer.hpp"
+#include "startup_timer.hpp"
+#include "synth.hpp"
+#include "tempo_detection.hpp"
 
-std::string midi_to_pitch_class(int midi_note) {
-  const int base_midi = 60; // MIDI note number for '0'
-  if (midi_note < 0 || midi_note > 127)
-    throw std::out_of_range("MIDI note must be between 0 and 127");
+std::atomic<bool> keep_recording{true};
+
+// prints which notes start on every step of the grid, one bar per line with
+// the beats separated by |
+void print_quantized_take(const QuantizedTake &take) {
+  const QuantizeSettings &settings = take.settings;
+  const double steps_per_beat = (60.0 / settings.bpm) / take.step_duration_sec;
+  auto beat_of_step = [&](std::size_t step) {
+    return static_cast<long>(std::floor(step / steps_per_beat + 1e-9));
+  };
 
-  int diff = midi_note - base_midi;
-  int pitch_class = (diff % 12 + 12) % 12; // ensures pitch_class is always 0–11
-  int octave_shift = diff / 12;
+  std::cout << "\nQuantized MIDI Grid:\n";
+
+  for (std::size_t step = 0; step < take.num_steps(); ++step) {
+    long beat = beat_of_step(step);
+    if (beat % settings.beats_per_bar == 0 &&
+        (step == 0 || beat_of_step(step - 1) != beat))
+      std::cout << "|";
 
-  std::string suffix;
-  if (octave_shift > 0) {
-    suffix = std::string(octave_shift, '\'');
-  } else if (octave_shift < 0) {
-    suffix = std::string(-octave_shift, ',');
+    if (take.step_begin(step) == take.step_end(step)) {
+      std::cout << "- ";
+    } else {
+      std::cout << "(";
+      for (std::size_t i = take.step_begin(step); i < take.step_end(step);
+           ++i) {
+        const CapturedMidiMessage &event =
+            take.events[take.step_event_indices[i]];
+        std::cout << midi_to_pitch_class(event.bytes[1]);
+        if (i != take.step_end(step) - 1)
+          std::cout << " ";
+      }
+      std::cout << ") ";
+    }
+
+    long next_beat = beat_of_step(step + 1);
+    if (next_beat != beat) {
+      std::cout << "|";
+      if (next_beat / settings.beats_per_bar != beat / settings.beats_per_bar)
+        std::cout << "\n";
+    }
   }
+  std::cout << "\n";
 
-  return std::to_string(pitch_class) + suffix;
+  if (take.num_outside_window > 0) {
+    std::cout << take.num_outside_window
+              << " notes were outside the quantize window and kept their "
+                 "timing\n";
+  }
 }
 
-struct MIDIEvent {
-  std::vector<unsigned char> message;
-  double timestamp;
+// what the record command was asked to do besides recording
+struct RecordOptions {
+  QuantizeSettings quantize_settings;
+  // when set the take is written into this jam file as pattern_name
+  std::string jam_file_path;
+  std::string pattern_name = "R";
+  unsigned int channel = 1;
+  TakeFormat format = TakeFormat::notes;
+  // where the raw input is streamed to, a timestamped name when empty
+  std::string journal_path;
+  // replay only, 0 uses the bpm the journal was recorded at
+  double bpm = 0;
+  // --bpm auto, the tempo, first beat and grid are found from the take
+  bool detect_tempo = false;
+  // --grid was given, otherwise record quantizes to the subdivision it asks
+  // for
+  bool has_grid = false;
+  // overrides the calibrated input latency when set
+  std::optional<double> latency_sec;
+  // how much of the controller streams is written
+  PerformanceSettings performance_settings;
+  // overdub only, how many bars a pattern that doesn't exist yet gets
+  unsigned int num_bars = 4;
 };
 
-std::vector<MIDIEvent> recorded_events;
-std::mutex event_mutex;
-auto start_time = std::chrono::high_resolution_clock::now();
-std::atomic<bool> keep_recording{true};
+// how the notes paired up and how much of the controllers is kept
+void print_performance_summary(const Performance &performance) {
+  std::cout << performance.notes.size() << " notes";
+  if (performance.num_held_at_end > 0)
+    std::cout << ", " << performance.num_held_at_end
+              << " still held at the end";
+  if (performance.num_unmatched_note_offs > 0) {
+    std::cout << ", " << performance.num_unmatched_note_offs
+              << " note offs without a note";
+  }
+  std::cout << "\n";
+  if (!performance.controls.empty() || performance.num_controls_dropped > 0) {
+    std::cout << "Kept " << performance.controls.size()
+              << " controller messages, thinned out "
+              << performance.num_controls_dropped << "\n";
+  }
+}
+
+// reads the optional flags of the record and replay commands, e.g.
+// jams record --beats 3 --grid 8t --swing 58 --strength 80 --window 40
+//             --into song.jam --name Take1 --channel 2 --format grid
+//             --journal take.jamcap --cc-interval 10 --cc-change 1
+RecordOptions parse_record_flags(const std::vector<std::string> &args,
+                                 std::size_t first_flag = 1) {
+  RecordOptions options;
+  QuantizeSettings &settings = options.quantize_settings;
+  for (std::size_t i = first_flag; i < args.size(); i += 2) {
+    const std::string &flag = args[i];
+    if (i + 1 == args.size())
+      throw std::runtime_error("Missing value for " + flag);
+    const std::string &value = args[i + 1];
+    if (flag == "--beats") {
+      settings.beats_per_bar = std::stoi(value);
+    } else if (flag == "--grid") {
+      // a note value optionally followed by t for triplets or d for dotted
+      std::size_t digits_end = 0;
+      settings.note_value = std::stoi(value, &digits_end);
+      options.has_grid = true;
+      std::string feel = value.substr(digits_end);
+      if (feel == "t") {
+        settings.feel = GridFeel::triplet;
+      } else if (feel == "d") {
+        settings.feel = GridFeel::dotted;
+      } else if (!feel.empty()) {
+        throw std::runtime_error("Unknown grid: " + value);
+      }
+    } else if (flag == "--swing") {
+      settings.swing_percent = std::stod(value);
+    } else if (flag == "--strength") {
+      settings.strength_percent = std::stod(value);
+    } else if (flag == "--window") {
+      settings.window_percent = std::stod(value);
+    } else if (flag == "--journal") {
+      options.journal_path = value;
+    } else if (flag == "--bpm") {
+      if (value == "auto") {
+        options.detect_tempo = true;
+      } else {
+        options.bpm = std::stod(value);
+      }
+    } else if (flag == "--latency") {
+      options.latency_sec = std::stod(value) / 1e3;
+    } else if (flag == "--into") {
+      options.jam_file_path = value;
+    } else if (flag == "--name") {
+      static const std::regex name_regex(R"([A-Za-z0-9_]+)");
+      if (!std::regex_match(value, name_regex))
+        throw std::runtime_error("Pattern names are letters, digits and _");
+      options.pattern_name = value;
+    } else if (flag == "--channel") {
+      options.channel = std::stoul(value);
+      if (options.channel < 1 || options.channel > 16)
+        throw std::runtime_error("Channel has to be between 1 and 16");
+    } else if (flag == "--cc-interval") {
+      options.performance_settings.controller_min_interval_sec =
+          std::stod(value) / 1e3;
+    } else if (flag == "--cc-change") {
+      options.performance_settings.controller_min_change = std::stoi(value);
+    } else if (flag == "--length") {
+      options.num_bars = std::stoul(value);
+      if (options.num_bars == 0)
+        throw std::runtime_error("Length has to be at least one bar");
+    } else if (flag == "--format") {
+      if (value == "notes") {
+        options.format = TakeFormat::notes;
+      } else if (value == "grid") {
+        options.format = TakeFormat::grid;
+      } else {
+        throw std::runtime_error("Format is notes or grid");
+      }
+    } else {
+      throw std::runtime_error("Unknown record option: " + flag);
+    }
+  }
+  return options;
+}
+
+// puts a take into a jam file as a pattern and loads the file back to make
+// sure the sequencer can read it, a grid take with notes missing from the
+// legend is written as notes instead so it isn't lost
+void write_take_to_jam_file(const QuantizedTake &take,
+                            const RecordOptions &options) {
+  // the first recorded bar is the count in, a take the tempo was found for
+  // starts on its first note
+  const int count_in_bars = options.detect_tempo ? 0 : 1;
+  auto legend = read_jam_file_legend(options.jam_file_path);
+
+  std::vector<std::string> pattern_lines;
+  try {
+    pattern_lines = format_take_as_pattern(
+        take, options.pattern_name, options.channel, options.format, legend,
+        count_in_bars, options.performance_settings);
+  } catch (const std::runtime_error &e) {
+    if (options.format != TakeFormat::grid)
+      throw;
+    std::cerr << e.what() << ", writing the take as notes instead\n";
+    pattern_lines = format_take_as_pattern(
+        take, options.pattern_name, options.channel, TakeFormat::notes, legend,
+        count_in_bars, options.performance_settings);
+  }
+
+  write_pattern_to_jam_file(options.jam_file_path, options.pattern_name,
+                            pattern_lines);
+
+  JamFileData jam_data = load_jam_file(options.jam_file_path);
+  std::cout << "Wrote pattern " << options.pattern_name << " ("
+            << jam_data.pattern_name_to_bars.at(options.pattern_name).size()
+            << " lines) to " << options.jam_file_path << "\n";
+}
+
+// "16", "8t" or "16d", the way --grid takes it
+std::string grid_name(int note_value, GridFeel feel) {
+  std::string name = std::to_string(note_value);
+  if (feel == GridFeel::triplet)
+    name += "t";
+  else if (feel == GridFeel::dotted)
+    name += "d";
+  return name;
+}
+
+void print_tempo_analysis(const TempoAnalysis &analysis) {
+  const TempoEstimate &best = analysis.candidates.front();
+  std::cout << "Found " << best.bpm << " bpm on a "
+            << grid_name(best.note_value, best.feel)
+            << " grid, first beat at " << best.phase_sec << " s ("
+            << std::lround(best.grid_fit * 100) << "% fit over "
+            << analysis.num_onsets << " onsets)\n";
+  if (analysis.candidates.size() > 1) {
+    std::cout << "Also fits:";
+    const std::size_t num_shown =
+        std::min<std::size_t>(analysis.candidates.size(), 4);
+    for (std::size_t i = 1; i < num_shown; ++i) {
+      const TempoEstimate &other = analysis.candidates[i];
+      std::cout << " " << other.bpm << " bpm "
+                << grid_name(other.note_value, other.feel) << ",";
+    }
+    std::cout << " replay with --bpm and --grid to use one of those\n";
+  }
+}
 
-void midi_callback(double deltatime, std::vector<unsigned char> *message,
-                   void *userData) {
-  if (!keep_recording.load())
-    return;
+// takes the input latency off a take, finds its tempo when asked to,
+// quantizes it, prints it and writes it into a jam file when asked to
+int process_take(std::vector<CapturedMidiMessage> events,
+                 const RecordOptions &options, int num_bars,
+                 double recorded_latency_sec) {
+  double latency_sec = options.latency_sec.value_or(recorded_latency_sec);
+  if (latency_sec != 0) {
+    std::cout << "Compensating " << latency_sec * 1e3 << " ms of latency\n";
+    compensate_latency(events, latency_sec);
+  }
+
+  QuantizeSettings settings = options.quantize_settings;
+  if (options.detect_tempo) {
+    TempoAnalysis analysis = detect_tempo(events);
+    print_tempo_analysis(analysis);
+    const TempoEstimate &best = analysis.candidates.front();
+    settings.bpm = best.bpm;
+    settings.note_value = best.note_value;
+    settings.feel = best.feel;
+    // the first beat becomes time 0 and the grid runs to the last note
+    compensate_latency(events, best.phase_sec);
+    num_bars = 0;
+  }
+
+  QuantizedTake take = quantize(events, settings, num_bars);
+  print_quantized_take(take);
+  print_performance_summary(
+      extract_performance(take.events, options.performance_settings));
+
+  if (!options.jam_file_path.empty()) {
+    try {
+      write_take_to_jam_file(take, options);
+    } catch (const std::exception &e) {
+      std::cerr << "Could not write the take: " << e.what() << "\n";
+      return 1;
+    }
+  }
+  return 0;
+}
+
+// take_20250101_120000.jamcap
+std::string timestamped_journal_path() {
+  std::time_t now = std::time(nullptr);
+  char name[64];
+  std::strftime(name, sizeof(name), "take_%Y%m%d_%H%M%S.jamcap",
+                std::localtime(&now));
+  return name;
+}
+
+// jams replay take.jamcap [record flags]
+// quantizes a recorded journal again, with different settings if wanted
+int run_replay(const std::vector<std::string> &args) {
+  if (args.size() < 2) {
+    std::cerr << "usage: jams replay <take.jamcap> [--grid 16] [--swing 50] "
+                 "[--strength 100] [--window 100] [--bpm bpm|auto] [--into "
+                 "song.jam --name R --channel 1 --format notes]\n";
+    return 1;
+  }
+
+  RecordOptions options;
+  CaptureJournal journal;
+  try {
+    options = parse_record_flags(args, 2);
+    journal = read_capture_journal(args[1]);
+  } catch (const std::exception &e) {
+    std::cerr << "Replay failed: " << e.what() << "\n";
+    return 1;
+  }
+
+  if (journal.was_truncated) {
+    std::cout << "The journal ends part way through a message, the take was "
+                 "cut short\n";
+  }
+  std::cout << "Replaying " << journal.events.size() << " messages ";
+  if (journal.header.bpm > 0)
+    std::cout << "recorded at " << journal.header.bpm << " bpm\n";
+  else
+    std::cout << "played without a click\n";
 
-  std::lock_guard<std::mutex> lock(event_mutex);
+  QuantizeSettings &settings = options.quantize_settings;
+  settings.bpm = options.bpm > 0 ? options.bpm : journal.header.bpm;
+  // a take played without a click has no tempo until one is found
+  if (settings.bpm <= 0)
+    options.detect_tempo = true;
+  // the journal knows the bar length unless it was overridden
+  bool beats_given =
+      std::find(args.begin(), args.end(), "--beats") != args.end();
+  if (!beats_given)
+    settings.beats_per_bar = journal.header.beats_per_bar;
 
-  double time_since_start =
-      std::chrono::duration<double>(std::chrono::high_resolution_clock::now() -
-                                    start_time)
-          .count();
+  try {
+    return process_take(std::move(journal.events), options,
+                        journal.header.num_bars,
+                        journal.header.latency_offset_sec);
+  } catch (const std::exception &e) {
+    std::cerr << "Replay failed: " << e.what() << "\n";
+    return 1;
+  }
+}
+
+// jams batch song.jam num_variants [output_directory] [num_threads]
+int run_batch(const std::vector<std::string> &args) {
+  if (args.size() < 3) {
+    std::cerr << "usage: jams batch <song.jam> <num_variants> "
+                 "[output_directory] [num_threads]\n";
+    return 1;
+  }
 
-  recorded_events.push_back({*message, time_since_start});
+  try {
+    std::size_t num_variants = std::stoul(args[2]);
+    std::string output_directory = args.size() > 3 ? args[3] : "variants";
+    unsigned int num_threads = args.size() > 4 ? std::stoul(args[4]) : 0;
 
-  std::cout << "Received MIDI message at " << time_since_start << "s: ";
-  for (unsigned char byte : *message) {
-    std::cout << std::hex << (int)byte << " ";
+    JamFileData jam_data = parse_jam_file(args[1]);
+    generate_variants(jam_data, num_variants, output_directory, num_threads);
+  } catch (const std::exception &e) {
+    std::cerr << "Batch generation failed: " << e.what() << "\n";
+    return 1;
   }
-  std::cout << std::dec << std::endl;
+
+  return 0;
 }
 
-void quantize_events(std::vector<MIDIEvent> &events, double bpm, int total_bars,
-                     int subdivisions_per_beat) {
+// how a song is played, e.g. jams --synth --program 2=bass --program 3=4
+struct PlaybackOptions {
+  // plays through the built in synth instead of the first midi output
+  bool use_synth = false;
+  // the synth's program for a channel, by name or index
+  std::vector<std::pair<int, int>> programs;
+  // --clock audio, events are timed by the audio device's callback instead of
+  // steady_clock
+  bool audio_clock = false;
+  VoicePolicy voice_policy;
+  // --midi-channels 2,10, channels 1 - 16 as bits 0 - 15 that go to the midi
+  // output while the synth plays the rest
+  std::uint16_t midi_channels = 0;
+  // --audio-latency and --midi-latency in ms, how long after it's handed an
+  // event each output is heard, for lining the two up
+  std::optional<double> audio_latency_sec;
+  std::optional<double> midi_latency_sec;
+};
 
-  double seconds_per_beat = 60.0 / bpm;
-  double seconds_per_subdiv = seconds_per_beat / subdivisions_per_beat;
-  int beats_per_bar = 4;
-  int total_beats = total_bars * beats_per_bar;
+// --steal oldest|quietest, --voice-limit <channel>=<voices> and
+// --same-note retrigger|stack into the synth's voice policy, false when the
+// flag is none of them
+bool parse_voice_flag(const std::string &flag, const std::string &value,
+                      VoicePolicy &policy) {
+  if (flag == "--steal") {
+    policy.stealing = parse_voice_stealing(value);
+  } else if (flag == "--voice-limit") {
+    std::size_t equals = value.find('=');
+    if (equals == std::string::npos)
+      throw std::runtime_error("--voice-limit takes <channel>=<voices>");
+    int channel = std::stoi(value.substr(0, equals));
+    int limit = std::stoi(value.substr(equals + 1));
+    if (channel < 1 || channel > 16 || limit < 0 || limit > Synth::max_voices)
+      throw std::runtime_error("Invalid voice limit: " + value);
+    policy.channel_limits[channel - 1] = static_cast<std::uint8_t>(limit);
+  } else if (flag == "--same-note") {
+    if (value != "retrigger" && value != "stack")
+      throw std::runtime_error("--same-note takes retrigger or stack");
+    policy.retrigger_same_note = value == "retrigger";
+  } else {
+    return false;
+  }
+  return true;
+}
 
-  // grid: total_beats x subdivisions_per_beat
-  std::vector<std::vector<std::vector<int>>> grid(
-      total_beats, std::vector<std::vector<int>>(subdivisions_per_beat));
+// "12 voices stolen, 3 at a channel's limit, 40 notes retriggered"
+std::string describe_voice_stats(const VoiceStats &stats) {
+  return std::to_string(stats.num_stolen) + " voices stolen, " +
+         std::to_string(stats.num_stolen_by_channel_limit) +
+         " at a channel's limit, " + std::to_string(stats.num_retriggered) +
+         " notes retriggered";
+}
 
-  for (auto &event : events) {
-    double q_time =
-        std::round(event.timestamp / seconds_per_subdiv) * seconds_per_subdiv;
-    int total_subdiv_index = static_cast<int>(q_time / seconds_per_subdiv);
+// "2=bass" or "2=1", a channel and a synth program by name or index
+std::pair<int, int> parse_program_flag(const std::string &value) {
+  std::size_t equals = value.find('=');
+  if (equals == std::string::npos)
+    throw std::runtime_error("--program takes <channel>=<program>");
+  int channel = std::stoi(value.substr(0, equals));
+  std::string name = value.substr(equals + 1);
+  int program = find_synth_program(name);
+  if (program < 0 && !name.empty() &&
+      std::all_of(name.begin(), name.end(), ::isdigit))
+    program = std::stoi(name);
+  if (channel < 1 || channel > 16 || program < 0)
+    throw std::runtime_error("Unknown channel or program: " + value);
+  return {channel, program};
+}
 
-    int beat_index = total_subdiv_index / subdivisions_per_beat;
-    int subdiv_index = total_subdiv_index % subdivisions_per_beat;
+PlaybackOptions parse_playback_flags(const std::vector<std::string> &args,
+                                     std::size_t first_flag) {
+  PlaybackOptions options;
+  for (std::size_t i = first_flag; i < args.size(); ++i) {
+    const std::string &flag = args[i];
+    if (flag == "--synth") {
+      options.use_synth = true;
+    } else if (flag == "--program") {
+      if (i + 1 == args.size())
+        throw std::runtime_error("Missing value for " + flag);
+      options.programs.push_back(parse_program_flag(args[++i]));
+      options.use_synth = true;
+    } else if (flag == "--clock") {
+      if (i + 1 == args.size())
+        throw std::runtime_error("Missing value for " + flag);
+      const std::string &value = args[++i];
+      if (value != "audio" && value != "system")
+        throw std::runtime_error("--clock takes audio or system");
+      options.audio_clock = value == "audio";
+    } else if (flag == "--steal" || flag == "--voice-limit" ||
+               flag == "--same-note") {
+      if (i + 1 == args.size())
+        throw std::runtime_error("Missing value for " + flag);
+      parse_voice_flag(flag, args[++i], options.voice_policy);
+      options.use_synth = true;
+    } else if (flag == "--midi-channels") {
+      if (i + 1 == args.size())
+        throw std::runtime_error("Missing value for " + flag);
+      std::istringstream channels(args[++i]);
+      std::string channel;
+      while (std::getline(channels, channel, ',')) {
+        const int number = std::stoi(channel);
+        if (number < 1 || number > 16)
+          throw std::runtime_error("Unknown channel: " + channel);
+        options.midi_channels |= static_cast<std::uint16_t>(1 << (number - 1));
+      }
+      // only the audio clock keeps the two outputs on one timeline
+      options.use_synth = true;
+      options.audio_clock = true;
+    } else if (flag == "--audio-latency" || flag == "--midi-latency") {
+      if (i + 1 == args.size())
+        throw std::runtime_error("Missing value for " + flag);
+      const double latency_sec = std::stod(args[++i]) / 1e3;
+      if (flag == "--audio-latency")
+        options.audio_latency_sec = latency_sec;
+      else
+        options.midi_latency_sec = latency_sec;
+    } else {
+      throw std::runtime_error("Unknown option: " + flag);
+    }
+  }
+  return options;
+}
 
-    if (beat_index >= total_beats)
-      continue;
+// the samples named in the jam file's legend, none when it names none
+std::shared_ptr<const DrumKit> load_legend_drum_kit(const JamFileData &jam_data,
+                                                    double sample_rate) {
+  if (jam_data.note_to_sample_path.empty())
+    return nullptr;
+  auto kit = load_drum_kit(jam_data.note_to_sample_path,
+                           jam_data.sample_channels, sample_rate);
+  std::cout << "Loaded " << kit->num_files << " samples for channels";
+  for (unsigned int channel : jam_data.sample_channels)
+    std::cout << " " << channel;
+  std::cout << "\n";
+  return kit;
+}
+
+// a synth at the engine's rate with the programs asked for and the legend's
+// samples, not yet attached
+std::unique_ptr<Synth> make_synth(ma_engine &engine,
+                                  const PlaybackOptions &options,
+                                  const JamFileData &jam_data) {
+  const double sample_rate = ma_engine_get_sample_rate(&engine);
+  auto synth = std::make_unique<Synth>(sample_rate);
+  for (const auto &[channel, program] : options.programs)
+    synth->set_program(channel, program);
+  synth->set_drum_kit(load_legend_drum_kit(jam_data, sample_rate));
+  synth->set_voice_policy(options.voice_policy);
+  std::cout << "Playing through the built in synth at "
+            << synth->get_sample_rate() << " Hz\n";
+  return synth;
+}
+
+// a synth playing through the engine, taking its events from event_source
+// when it's given
+std::unique_ptr<Synth> start_synth(ma_engine &engine,
+                                   const PlaybackOptions &options,
+                                   const JamFileData &jam_data,
+                                   SynthEventSource *event_source = nullptr) {
+  auto synth = make_synth(engine, options, jam_data);
+  synth->set_event_source(event_source);
+  synth->attach(engine);
+  return synth;
+}
+
+// the first midi output port, throws when there isn't one
+std::unique_ptr<RtMidiOut> open_midi_output() {
+  RtMidiOut *raw_midi_out = nullptr;
+  if (!initialize_midi_output(raw_midi_out))
+    throw std::runtime_error("Failed to initialize MIDI output");
+  return std::unique_ptr<RtMidiOut>(raw_midi_out);
+}
+
+// opens the outputs playback needs on another thread, so that probing the
+// devices (which can take a good part of a second) overlaps reading and
+// parsing the song instead of coming before it, the audio engine must not be
+// touched until the future is ready, which rethrows when a device didn't open
+std::future<std::unique_ptr<RtMidiOut>>
+open_outputs_async(AudioEngine &audio, bool needs_audio, bool needs_midi,
+                   StartupTimer &timer) {
+  return std::async(std::launch::async, [&audio, needs_audio, needs_midi,
+                                         &timer]() {
+    std::unique_ptr<RtMidiOut> midi_out;
+    if (needs_audio) {
+      audio.get();
+      timer.mark("audio open");
+    }
+    if (needs_midi) {
+      midi_out = open_midi_output();
+      timer.mark("midi open");
+    }
+    return midi_out;
+  });
+}
+
+std::string audio_output_name(ma_engine &engine) {
+  char name[MA_MAX_DEVICE_NAME_LENGTH + 1] = "";
+  ma_device *device = ma_engine_get_device(&engine);
+  if (device)
+    ma_device_get_name(device, ma_device_type_playback, name, sizeof(name),
+                       NULL);
+  return name;
+}
+
+// how long after the synth renders a frame it's heard, at least the device's
+// buffer, 0 when there's no device
+double device_output_latency_sec(ma_engine &engine) {
+  ma_device *device = ma_engine_get_device(&engine);
+  if (!device || device->playback.internalSampleRate == 0)
+    return 0;
+  return static_cast<double>(device->playback.internalPeriodSizeInFrames) *
+         device->playback.internalPeriods /
+         device->playback.internalSampleRate;
+}
+
+// what each output adds when they play together: the flags when given,
+// otherwise the device's buffer for audio and the audio latency plus what
+// jams calibrate --output midi measured for midi, printed with where each
+// came from
+OutputLatency resolve_output_latency(ma_engine &engine, RtMidiOut &midi_out,
+                                     const PlaybackOptions &options) {
+  OutputLatency latency;
+  std::string audio_source = "set";
+  if (options.audio_latency_sec) {
+    latency.audio_sec = *options.audio_latency_sec;
+  } else {
+    latency.audio_sec = device_output_latency_sec(engine);
+    audio_source = "device buffer";
+  }
 
-    // Only include Note On messages with velocity > 0
-    if (event.message.size() >= 3) {
-      unsigned char status = event.message[0];
-      unsigned char note = event.message[1];
-      unsigned char velocity = event.message[2];
+  std::string midi_source = "set";
+  if (options.midi_latency_sec) {
+    latency.midi_sec = *options.midi_latency_sec;
+  } else {
+    const std::string key = output_calibration_key(
+        midi_out.getPortName(0), audio_output_name(engine));
+    if (auto calibration =
+            load_latency_calibration(default_calibration_path, key)) {
+      latency.midi_sec = latency.audio_sec + calibration->offset_sec;
+      midi_source = "calibrated";
+    } else {
+      midi_source = "not calibrated, run jams calibrate --output midi";
+    }
+  }
+
+  std::cout << "Output latency: audio " << latency.audio_sec * 1e3 << " ms ("
+            << audio_source << "), midi " << latency.midi_sec * 1e3 << " ms ("
+            << midi_source << ")\n";
+  return latency;
+}
+
+// prints the startup steps once the first note is out
+void report_startup_on_first_note(Sequencer &sequencer, StartupTimer &timer) {
+  sequencer.set_first_note_handler([&timer]() {
+    timer.mark("first note");
+    std::cout << "Startup: ";
+    timer.print(std::cout);
+    std::cout << std::endl;
+  });
+}
+
+// jams --clock audio [--synth] [--midi-channels 2,10]
+// plays the song with the audio callback as the clock: every callback takes
+// the events of the frames it renders from the compiled song, the synth plays
+// them on their exact frame and without --synth they go to the midi output
+// timed from the same frames (a silent synth keeps the clock going)
+//
+// with --midi-channels those channels go to the midi output and the rest to
+// the synth, each output's latency is made up for so the two are heard
+// together
+//
+// the song is compiled before this is called, while the devices open, and
+// midi_out is the opened midi output when anything goes to midi
+int play_on_audio_clock(ma_engine &engine, const JamFileData &jam_data,
+                        const CompiledSong &song,
+                        const PlaybackOptions &options,
+                        std::unique_ptr<RtMidiOut> midi_out,
+                        StartupTimer &timer) {
+  try {
+    const double sample_rate = ma_engine_get_sample_rate(&engine);
+
+    std::unique_ptr<Synth> synth =
+        options.use_synth ? make_synth(engine, options, jam_data)
+                          : std::make_unique<Synth>(sample_rate);
+    FrameSchedulerOutputs outputs;
+    outputs.midi_channels = options.use_synth ? options.midi_channels : 0xFFFF;
+    std::unique_ptr<FramedMidiSender> midi_sender;
+    if (outputs.midi_channels != 0) {
+      midi_sender = std::make_unique<FramedMidiSender>(
+          *midi_out, synth->get_frame_clock(), sample_rate);
+      outputs.midi_events = &midi_sender->get_events();
+      // with everything on midi there's nothing to line it up with
+      if (options.use_synth)
+        outputs.latency = resolve_output_latency(engine, *midi_out, options);
+    }
+    auto scheduler =
+        std::make_unique<FrameScheduler>(song, sample_rate, outputs);
+    if (outputs.midi_channels != 0 && options.use_synth) {
+      std::cout << "The synth is "
+                << scheduler->get_synth_delay_frames() * 1e3 / sample_rate
+                << " ms behind the song, midi "
+                << scheduler->get_midi_delay_frames() * 1e3 / sample_rate
+                << " ms\n";
+    }
+    synth->set_event_source(scheduler.get());
+    if (midi_sender)
+      midi_sender->start();
+    synth->attach(engine);
 
-      if ((status & 0xF0) == 0x90 && velocity > 0) {
-        grid[beat_index][subdiv_index].push_back(note);
+    timer.mark("playing");
+    std::cout << "Playing " << song.num_bars << " bars on the audio clock at "
+              << sample_rate << " Hz" << std::endl;
+    std::cout << "Startup: ";
+    timer.print(std::cout);
+    std::cout << std::endl;
+    std::uint64_t num_midi_dropped = 0;
+    std::uint64_t num_voices_taken = 0;
+    while (true) {
+      std::this_thread::sleep_for(std::chrono::seconds(1));
+      if (scheduler->get_num_midi_dropped() != num_midi_dropped) {
+        num_midi_dropped = scheduler->get_num_midi_dropped();
+        std::cerr << num_midi_dropped
+                  << " midi messages dropped, the sender fell behind\n";
+      }
+      // retriggers are what the policy asked for, only stealing is news
+      const VoiceStats voices = synth->get_voice_stats();
+      if (voices.num_stolen + voices.num_stolen_by_channel_limit !=
+          num_voices_taken) {
+        num_voices_taken =
+            voices.num_stolen + voices.num_stolen_by_channel_limit;
+        std::cerr << describe_voice_stats(voices) << "\n";
       }
     }
+  } catch (RtMidiError &error) {
+    error.printMessage();
+    return 1;
+  } catch (const std::exception &e) {
+    std::cerr << "Playback failed: " << e.what() << "\n";
+    return 1;
+  }
+  return 0;
+}
 
-    event.timestamp = q_time;
+// jams render song.jam [--wav song.wav] [--stems stems] [--threads 0]
+//                       [--sample-rate 48000] [--tail 2] [--program 2=bass]
+// bounces the song's arrangement through the built in synth
+int run_render(const std::vector<std::string> &args) {
+  if (args.size() < 2) {
+    std::cerr << "usage: jams render <song.jam> [--wav <out.wav>] "
+                 "[--stems <directory>]\n";
+    return 1;
   }
 
-  std::cout << "\nQuantized MIDI Grid:\n";
+  try {
+    RenderSettings settings;
+    std::string wav_path =
+        std::filesystem::path(args[1]).replace_extension(".wav").string();
+    for (std::size_t i = 2; i < args.size(); i += 2) {
+      const std::string &flag = args[i];
+      if (i + 1 == args.size())
+        throw std::runtime_error("Missing value for " + flag);
+      const std::string &value = args[i + 1];
+      if (flag == "--wav") {
+        wav_path = value;
+      } else if (flag == "--stems") {
+        settings.stems_directory = value;
+      } else if (flag == "--threads") {
+        settings.num_threads = std::stoul(value);
+      } else if (flag == "--sample-rate") {
+        settings.sample_rate = std::stoul(value);
+      } else if (flag == "--tail") {
+        settings.tail_sec = std::stod(value);
+      } else if (flag == "--program") {
+        settings.programs.push_back(parse_program_flag(value));
+      } else if (!parse_voice_flag(flag, value, settings.voice_policy)) {
+        throw std::runtime_error("Unknown render option: " + flag);
+      }
+    }
 
-  for (int beat = 0; beat < total_beats; ++beat) {
-    if (beat % beats_per_bar == 0)
-      std::cout << "|";
-    const auto &subdivs = grid[beat];
-    for (int subdiv = 0; subdiv < subdivisions_per_beat; ++subdiv) {
-      const auto &notes = subdivs[subdiv];
-      if (notes.empty()) {
-        std::cout << "- ";
+    JamFileData jam_data = load_jam_file(args[1]);
+    CompiledSong song =
+        compile_song(compile_patterns(jam_data), jam_data.arrangement);
+    settings.drum_kit =
+        load_legend_drum_kit(jam_data, settings.sample_rate);
+    RenderStats stats = render_song_to_wav(song, wav_path, settings);
+
+    std::cout << "Rendered " << stats.audio_sec << " s of audio to "
+              << wav_path << " in " << stats.render_sec << " s ("
+              << stats.audio_sec / stats.render_sec << "x real time) using "
+              << stats.num_threads << " threads\n";
+    if (!settings.stems_directory.empty()) {
+      std::cout << "Wrote " << stats.channels.size() << " stems to "
+                << settings.stems_directory << "\n";
+    }
+    if (stats.peak > 1) {
+      std::cout << "The mix peaks at " << 20 * std::log10(stats.peak)
+                << " dBFS, turn the channels down (c7=) before converting it "
+                   "to integer samples\n";
+    }
+    std::cout << describe_voice_stats(stats.voices) << "\n";
+  } catch (const std::exception &e) {
+    std::cerr << "Render failed: " << e.what() << "\n";
+    return 1;
+  }
+  return 0;
+}
+
+// jams audition song.jam pattern_name [--synth] [--program 1=keys]
+// loops a single pattern, only that pattern is read from the file so it starts
+// playing straight away even on big files
+int run_audition(const std::vector<std::string> &args,
+                 std::chrono::steady_clock::time_point launch_time,
+                 AudioEngine &audio) {
+  if (args.size() < 3) {
+    std::cerr << "usage: jams audition <song.jam> <pattern_name> [--synth]\n";
+    return 1;
+  }
+
+  PlaybackOptions playback_options;
+  try {
+    playback_options = parse_playback_flags(args, 3);
+  } catch (const std::exception &e) {
+    std::cerr << "Invalid audition options: " << e.what() << "\n";
+    return 1;
+  }
+  if (playback_options.midi_channels != 0) {
+    std::cerr << "--midi-channels only plays the whole song\n";
+    return 1;
+  }
+
+  StartupTimer timer(launch_time);
+  auto opening_outputs = open_outputs_async(audio, playback_options.use_synth,
+                                            !playback_options.use_synth, timer);
+
+  JamFileData jam_data;
+  std::unique_ptr<RtMidiOut> midi_out;
+  try {
+    jam_data = load_jam_file_pattern(args[1], args[2]);
+    timer.mark("pattern parsed");
+    midi_out = opening_outputs.get();
+  } catch (RtMidiError &error) {
+    error.printMessage();
+    return 1;
+  } catch (const std::exception &e) {
+    std::cerr << "Audition failed: " << e.what() << "\n";
+    // a bad pattern leaves the devices opening on the other thread
+    if (opening_outputs.valid())
+      opening_outputs.wait();
+    return 1;
+  }
+
+  const std::string &pattern_name = args[2];
+  auto channel_it = jam_data.pattern_name_to_channel.find(pattern_name);
+  unsigned int channel =
+      channel_it == jam_data.pattern_name_to_channel.end() ? 1
+                                                           : channel_it->second;
+
+  std::unique_ptr<Synth> synth;
+  if (playback_options.use_synth) {
+    try {
+      synth = start_synth(audio.get(), playback_options, jam_data);
+    } catch (const std::exception &e) {
+      std::cerr << "Audition failed: " << e.what() << "\n";
+      return 1;
+    }
+  }
+
+  std::unique_ptr<Sequencer> sequencer =
+      synth ? std::make_unique<Sequencer>(synth.get())
+            : std::make_unique<Sequencer>(std::move(midi_out));
+  sequencer->add(Pattern(jam_data.pattern_name_to_bars.at(pattern_name),
+                         channel, jam_data.bpm, true));
+  sequencer->set_bpm(jam_data.bpm);
+  report_startup_on_first_note(*sequencer, timer);
+
+  std::cout << "Auditioning " << pattern_name << std::endl;
+
+  while (true) {
+    sequencer->process_current_bar();
+  }
+
+  return 0;
+}
+
+// opens the first midi input for recording and returns its name
+std::string open_first_midi_input(RtMidiIn &midi_in) {
+  if (midi_in.getPortCount() == 0)
+    throw std::runtime_error("No MIDI input ports available.");
+  midi_in.openPort(0);
+  midi_in.ignoreTypes(false, false, false);
+  return midi_in.getPortName(0);
+}
+
+// plays the click and records from an open midi input for duration_sec, time
+// 0 of the recorded messages is the first click, the messages go to the
+// journal when there is one and are returned otherwise
+std::vector<CapturedMidiMessage>
+capture_with_click(ma_engine &engine, RtMidiIn &midi_in, double bpm,
+                   int subdivision, int beats_per_bar, double duration_sec,
+                   CaptureJournalWriter *journal) {
+  // the metronome puts the clock's epoch on its first click, the recorder
+  // is started after so that it stamps input against that same epoch
+  SessionClock session_clock;
+  Metronome metronome(engine);
+  metronome.start(bpm, subdivision, beats_per_bar, session_clock);
+
+  MidiRecorder midi_recorder;
+  midi_recorder.set_journal(journal);
+  midi_recorder.start(midi_in, session_clock);
+
+  std::cout << "Recording for " << duration_sec << " seconds...\n";
+
+  keep_recording = true;
+  std::thread timer_thread([&]() {
+    std::this_thread::sleep_until(session_clock.time_point_at(duration_sec));
+    keep_recording = false;
+  });
+
+  // main thread just keeps going until keep recording is done
+  while (keep_recording) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+
+  timer_thread.join();
+  metronome.stop();
+  midi_recorder.stop();
+  std::cout << "Recording finished.\n";
+  if (midi_recorder.get_num_overflowed() > 0 ||
+      midi_recorder.get_num_oversized() > 0) {
+    std::cout << "Dropped " << midi_recorder.get_num_overflowed()
+              << " messages because the capture buffer was full and "
+              << midi_recorder.get_num_oversized() << " sysex messages\n";
+  }
+  if (metronome.get_num_missed_clicks() > 0) {
+    std::cout << "The metronome missed " << metronome.get_num_missed_clicks()
+              << " clicks\n";
+  }
+  std::cout << "MIDI callback lag: ";
+  midi_recorder.get_callback_lag().print_ms(std::cout);
+  std::cout << "\n";
+
+  return midi_recorder.get_events();
+}
+
+// jams record --bpm auto [record flags]
+// records without a click until enter is pressed, the tempo, the first beat
+// and the grid are found from what was played afterwards, there is nothing to
+// play along to so no latency is taken off
+int run_free_record(RecordOptions options) {
+  try {
+    RtMidiIn midi_in;
+    open_first_midi_input(midi_in);
+
+    if (options.journal_path.empty())
+      options.journal_path = timestamped_journal_path();
+    CaptureJournalHeader journal_header;
+    journal_header.bpm = 0;
+    journal_header.beats_per_bar = options.quantize_settings.beats_per_bar;
+    CaptureJournalWriter journal(options.journal_path, journal_header);
+
+    MidiRecorder midi_recorder;
+    midi_recorder.set_journal(&journal);
+    SessionClock session_clock;
+    midi_recorder.start(midi_in, session_clock);
+    std::cout << "Recording, play freely and press enter when you're done\n";
+    std::string line;
+    std::getline(std::cin, line);
+    midi_recorder.stop();
+
+    journal.close();
+    if (!journal.ok()) {
+      std::cerr << "Writing the capture journal failed: " << journal.get_error()
+                << "\n";
+      return 1;
+    }
+    if (midi_recorder.get_num_overflowed() > 0) {
+      std::cout << "Dropped " << midi_recorder.get_num_overflowed()
+                << " messages because the capture buffer was full\n";
+    }
+    std::cout << "Saved " << journal.get_num_records() << " messages to "
+              << journal.get_path() << "\n";
+
+    CaptureJournal recorded = read_capture_journal(journal.get_path());
+    options.latency_sec = 0;
+    return process_take(std::move(recorded.events), options, 0, 0);
+  } catch (RtMidiError &error) {
+    error.printMessage();
+    return 1;
+  } catch (const std::exception &e) {
+    std::cerr << "Recording failed: " << e.what() << "\n";
+    return 1;
+  }
+}
+
+// the player taps along to hits played on the first midi output the way they
+// did to the click, the input and their reaction come out the same both times
+// so the taps' offset less the click calibration's is how much later midi is
+// heard than audio, stored for the midi output and audio output
+int calibrate_midi_output(AudioEngine &audio, int num_clicks, double bpm,
+                          int count_in_clicks) {
+  ma_engine &engine = audio.get();
+  RtMidiIn midi_in;
+  const std::string input_key = calibration_device_key(
+      open_first_midi_input(midi_in), audio_output_name(engine));
+  auto input_calibration =
+      load_latency_calibration(default_calibration_path, input_key);
+  if (!input_calibration) {
+    throw std::runtime_error("No latency calibration for " + input_key +
+                             ", run jams calibrate first");
+  }
+  std::unique_ptr<RtMidiOut> midi_out = open_midi_output();
+  const std::string key = output_calibration_key(midi_out->getPortName(0),
+                                                 audio_output_name(engine));
+
+  std::cout << "Tap a note on every hit from the midi output after the first "
+            << count_in_clicks << " (" << num_clicks << " taps)\n";
+  const double click_interval_sec = 60.0 / bpm;
+  const int num_hits = count_in_clicks + num_clicks;
+  // a moment to get ready before the first hit
+  SessionClock session_clock;
+  session_clock.epoch += std::chrono::milliseconds(500);
+  MidiRecorder midi_recorder;
+  midi_recorder.start(midi_in, session_clock);
+  // a side stick on the drum channel, loud and short on any general midi synth
+  std::vector<unsigned char> note_on = {0x99, 37, 110};
+  std::vector<unsigned char> note_off = {0x89, 37, 0};
+  for (int hit = 0; hit < num_hits; ++hit) {
+    std::this_thread::sleep_until(
+        session_clock.time_point_at(hit * click_interval_sec));
+    midi_out->sendMessage(&note_on);
+    std::this_thread::sleep_until(
+        session_clock.time_point_at((hit + 0.5) * click_interval_sec));
+    midi_out->sendMessage(&note_off);
+  }
+  std::this_thread::sleep_until(
+      session_clock.time_point_at((num_hits + 1) * click_interval_sec));
+  midi_recorder.stop();
+
+  RunningStats offsets =
+      measure_tap_offsets(midi_recorder.get_events(), click_interval_sec,
+                          count_in_clicks, num_clicks);
+  std::cout << "Tap offsets: ";
+  offsets.print_ms(std::cout);
+  std::cout << "\n";
+  if (offsets.count < static_cast<std::uint64_t>(num_clicks) / 2) {
+    std::cerr << "Only " << offsets.count << " of " << num_clicks
+              << " taps were close enough to a hit, try again\n";
+    return 1;
+  }
+
+  LatencyCalibration calibration{
+      offsets.mean - input_calibration->offset_sec, offsets.stddev(),
+      offsets.count};
+  save_latency_calibration(default_calibration_path, key, calibration);
+  std::cout << "Saved midi being heard " << calibration.offset_sec * 1e3
+            << " ms after audio for " << key << "\n";
+  return 0;
+}
+
+// jams calibrate [--clicks 16] [--bpm 100] [--output audio|midi]
+// the player taps a note on every click after a bar of count in, how late the
+// taps arrive on average is stored for this midi input and audio output and
+// taken off every take recorded on them, --output midi measures the midi
+// output against the audio output instead, see calibrate_midi_output
+int run_calibrate(AudioEngine &audio, const std::vector<std::string> &args) {
+  int num_clicks = 16;
+  double bpm = 100.0;
+  const int count_in_clicks = 4;
+  try {
+    bool measures_midi_output = false;
+    for (std::size_t i = 1; i + 1 < args.size(); i += 2) {
+      if (args[i] == "--clicks") {
+        num_clicks = std::stoi(args[i + 1]);
+      } else if (args[i] == "--bpm") {
+        bpm = std::stod(args[i + 1]);
+      } else if (args[i] == "--output") {
+        if (args[i + 1] != "audio" && args[i + 1] != "midi")
+          throw std::runtime_error("--output takes audio or midi");
+        measures_midi_output = args[i + 1] == "midi";
       } else {
-        std::cout << "(";
-        for (size_t i = 0; i < notes.size(); ++i) {
-          std::cout << midi_to_pitch_class(notes[i]);
-          if (i != notes.size() - 1)
-            std::cout << " ";
-        }
-        std::cout << ") ";
+        throw std::runtime_error("Unknown calibrate option: " + args[i]);
       }
     }
-    std::cout << "|";
-    if ((beat + 1) % beats_per_bar == 0)
-      std::cout << "\n";
+    if (measures_midi_output)
+      return calibrate_midi_output(audio, num_clicks, bpm, count_in_clicks);
+
+    ma_engine &engine = audio.get();
+    RtMidiIn midi_in;
+    std::string key = calibration_device_key(open_first_midi_input(midi_in),
+                                             audio_output_name(engine));
+
+    std::cout << "Tap a note on every click after the first " << count_in_clicks
+              << " (" << num_clicks << " taps)\n";
+    const double click_interval_sec = 60.0 / bpm;
+    std::vector<CapturedMidiMessage> events = capture_with_click(
+        engine, midi_in, bpm, 4, 4, (count_in_clicks + num_clicks + 1) *
+                                        click_interval_sec,
+        nullptr);
+
+    RunningStats offsets = measure_tap_offsets(events, click_interval_sec,
+                                               count_in_clicks, num_clicks);
+    std::cout << "Tap offsets: ";
+    offsets.print_ms(std::cout);
+    std::cout << "\n";
+    if (offsets.count < static_cast<std::uint64_t>(num_clicks) / 2) {
+      std::cerr << "Only " << offsets.count << " of " << num_clicks
+                << " taps were close enough to a click, try again\n";
+      return 1;
+    }
+
+    LatencyCalibration calibration{offsets.mean, offsets.stddev(),
+                                   offsets.count};
+    save_latency_calibration(default_calibration_path, key, calibration);
+    std::cout << "Saved a latency of " << calibration.offset_sec * 1e3
+              << " ms for " << key << "\n";
+  } catch (RtMidiError &error) {
+    error.printMessage();
+    return 1;
+  } catch (const std::exception &e) {
+    std::cerr << "Calibration failed: " << e.what() << "\n";
+    return 1;
+  }
+  return 0;
+}
+
+// the lines of a PATTERNS entry for bars, a musical bar per line
+std::vector<std::string>
+pattern_lines_for_bars(const std::string &pattern_name, unsigned int channel,
+                       const std::vector<std::string> &bar_strings,
+                       int beats_per_bar) {
+  std::vector<std::string> lines;
+  lines.push_back(pattern_name + "(" + std::to_string(channel) + "):");
+  std::string line;
+  for (std::size_t i = 0; i < bar_strings.size(); ++i) {
+    line += "| " + bar_strings[i] + " ";
+    if ((i + 1) % beats_per_bar == 0 || i + 1 == bar_strings.size()) {
+      lines.push_back(line + "|");
+      line.clear();
+    }
+  }
+  return lines;
+}
+
+// jams overdub song.jam pattern [record flags]
+// plays the song and records into a pattern at the same time, every time the
+// pattern comes round what was played over it is merged in and heard on the
+// next time round, the pattern is written back to the file on enter, a
+// pattern the file doesn't have yet is made empty (--length bars long, on
+// --channel) and looped over the whole song
+int run_overdub(const std::vector<std::string> &args) {
+  if (args.size() < 3) {
+    std::cerr << "usage: jams overdub <song.jam> <pattern> [--length 4] "
+                 "[--channel 1] [--grid 16] [--swing 50] [--strength 100] "
+                 "[--window 100] [--latency ms]\n";
+    return 1;
+  }
+  const std::string &jam_file_path = args[1];
+  const std::string &pattern_name = args[2];
+
+  RecordOptions options;
+  JamFileData jam_data;
+  try {
+    options = parse_record_flags(args, 3);
+    jam_data = load_jam_file(jam_file_path);
+  } catch (const std::exception &e) {
+    std::cerr << "Overdub failed: " << e.what() << "\n";
+    return 1;
+  }
+  QuantizeSettings &settings = options.quantize_settings;
+  settings.bpm = jam_data.bpm;
+
+  Sequencer sequencer;
+  std::unordered_map<std::string, std::shared_ptr<PatternBars>>
+      pattern_name_to_pattern_bars;
+  for (const PatternData &data : jam_data.arrangement) {
+    const auto &bar_sequence = jam_data.pattern_name_to_bars.at(data.name);
+    const auto &bar_channel = jam_data.pattern_name_to_channel.at(data.name);
+    auto &pattern_bars = pattern_name_to_pattern_bars[data.name];
+    if (!pattern_bars) {
+      pattern_bars = std::make_shared<PatternBars>(bar_sequence, bar_channel,
+                                                   jam_data.bpm);
+    }
+    sequencer.add(Pattern(pattern_bars, bar_channel, false, data.num_repeats,
+                          data.start_bar));
+  }
+
+  std::shared_ptr<PatternBars> &target =
+      pattern_name_to_pattern_bars[pattern_name];
+  unsigned int channel = options.channel;
+  if (!target) {
+    auto bars_it = jam_data.pattern_name_to_bars.find(pattern_name);
+    if (bars_it != jam_data.pattern_name_to_bars.end()) {
+      channel = jam_data.pattern_name_to_channel.at(pattern_name);
+      target = std::make_shared<PatternBars>(bars_it->second, channel,
+                                             jam_data.bpm);
+    } else {
+      std::cout << "Making a new pattern " << pattern_name << "\n";
+      std::vector<std::string> rests(options.num_bars * settings.beats_per_bar,
+                                     "-");
+      target = std::make_shared<PatternBars>(rests, channel, jam_data.bpm);
+    }
+    // not in the arrangement, so it loops along with the whole song
+    sequencer.add(Pattern(target, channel, true));
+  } else {
+    channel = target->get_channel();
+  }
+  if (target->empty()) {
+    std::cerr << "Pattern " << pattern_name << " has no bars\n";
+    return 1;
+  }
+  sequencer.align_song_length_to(static_cast<unsigned int>(target->size()));
+  sequencer.set_bpm(jam_data.bpm);
+  // everything is parsed up front, the warm up thread reads the patterns'
+  // bars which overdubbing swaps out under it
+  for (auto &[name, pattern_bars] : pattern_name_to_pattern_bars)
+    pattern_bars->compile();
+
+  try {
+    RtMidiIn midi_in;
+    open_first_midi_input(midi_in);
+
+    Overdubber overdubber(sequencer, target, settings,
+                          options.latency_sec.value_or(0),
+                          options.performance_settings);
+    MidiRecorder midi_recorder(1 << 14, false);
+    midi_recorder.set_message_handler(
+        [&overdubber](const CapturedMidiMessage &message) {
+          overdubber.push(message);
+        });
+
+    // the song starts a moment from now so nothing is due before the
+    // sequencer thread is up, everyone times against the same epoch
+    SessionClock clock;
+    clock.epoch = clock.time_point_at(0.1);
+    sequencer.start_clock(clock);
+    overdubber.start(clock);
+    midi_recorder.start(midi_in, clock);
+
+    std::atomic<bool> keep_playing{true};
+    std::thread playback_thread([&sequencer, &keep_playing]() {
+      while (keep_playing.load())
+        sequencer.process_current_bar();
+    });
+
+    std::cout << "Overdubbing " << pattern_name << " ("
+              << target->size() << " beats a pass), press enter to stop\n";
+    std::string line;
+    std::getline(std::cin, line);
+
+    midi_recorder.stop();
+    keep_playing = false;
+    playback_thread.join();
+    overdubber.stop();
+
+    std::cout << "Merged " << overdubber.get_num_notes_merged()
+              << " notes over " << overdubber.get_num_passes_merged()
+              << " passes\n";
+    if (overdubber.get_num_late() > 0 || overdubber.get_num_overflowed() > 0) {
+      std::cout << "Dropped " << overdubber.get_num_late()
+                << " messages that came in after their pass was merged and "
+                << overdubber.get_num_overflowed()
+                << " because the overdub buffer was full\n";
+    }
+    if (overdubber.get_num_passes_merged() == 0)
+      return 0;
+
+    write_pattern_to_jam_file(
+        jam_file_path, pattern_name,
+        pattern_lines_for_bars(pattern_name, channel,
+                               overdubber.get_pattern_bars()->get_bar_strings(),
+                               settings.beats_per_bar));
+    load_jam_file(jam_file_path);
+    std::cout << "Wrote pattern " << pattern_name << " to " << jam_file_path
+              << "\n";
+  } catch (RtMidiError &error) {
+    error.printMessage();
+    return 1;
+  } catch (const std::exception &e) {
+    std::cerr << "Overdub failed: " << e.what() << "\n";
+    return 1;
   }
+  return 0;
 }
 
-int main() {
+// jams check-clicks [--bpm 120] [--bars 2]
+// runs the metronome and the recorder with no sound card or midi port, see
+// check_clicks, and fails when a click is off its frame or a tap comes back
+// off its click, for machines that can't run the real thing
+int run_check_clicks(const std::vector<std::string> &args) {
+  ClickCheckSettings settings;
+  ClickCheckResult result;
+  try {
+    for (std::size_t i = 1; i < args.size(); ++i) {
+      const std::string &flag = args[i];
+      if (i + 1 == args.size())
+        throw std::runtime_error("Missing value for " + flag);
+      if (flag == "--bpm") {
+        settings.bpm = std::stod(args[++i]);
+      } else if (flag == "--bars") {
+        settings.num_bars = std::stoi(args[++i]);
+      } else {
+        throw std::runtime_error("Unknown check-clicks option: " + flag);
+      }
+    }
+    result = check_clicks(settings);
+  } catch (const std::exception &e) {
+    std::cerr << "Click check failed: " << e.what() << "\n";
+    return 1;
+  }
+
+  std::cout << "Found " << result.num_clicks_found << " of "
+            << result.num_clicks << " clicks at " << result.sample_rate
+            << " Hz";
+  if (result.click_errors_frames.count > 0) {
+    std::cout << ", " << result.click_errors_frames.min << " to "
+              << result.click_errors_frames.max << " frames off";
+  }
+  std::cout << "\nMissed clicks: " << result.num_missed_clicks
+            << "\nTap offsets: ";
+  result.tap_offsets.print_ms(std::cout);
+  std::cout << "\n";
 
-  ma_result result;
-  ma_engine engine;
+  // the recorder stamps by the deltas it's given, so only the first tap's
+  // wake up can put them off
+  const bool clicks_ok =
+      result.num_clicks_found == result.num_clicks &&
+      result.click_errors_frames.min == 0 &&
+      result.click_errors_frames.max == 0 && result.num_missed_clicks == 0;
+  const bool taps_ok = result.tap_offsets.count == result.num_clicks &&
+                       std::abs(result.tap_offsets.mean) < 0.002;
+  std::cout << (clicks_ok && taps_ok ? "ok" : "FAILED") << "\n";
+  return clicks_ok && taps_ok ? 0 : 1;
+}
 
-  result = ma_engine_init(NULL, &engine);
-  if (result != MA_SUCCESS) {
-    return -1;
+// jams check-alignment [--bars 2] [--audio-latency 10] [--midi-latency 25]
+// plays hits on the synth and over midi together with made up output
+// latencies and no sound card or midi port, see check_alignment, and fails
+// when a hit isn't heard on both within a millisecond
+int run_check_alignment(const std::vector<std::string> &args) {
+  AlignmentCheckSettings settings;
+  AlignmentCheckResult result;
+  try {
+    for (std::size_t i = 1; i < args.size(); ++i) {
+      const std::string &flag = args[i];
+      if (i + 1 == args.size())
+        throw std::runtime_error("Missing value for " + flag);
+      if (flag == "--bars") {
+        settings.num_bars = std::stoi(args[++i]);
+      } else if (flag == "--audio-latency") {
+        settings.latency.audio_sec = std::stod(args[++i]) / 1e3;
+      } else if (flag == "--midi-latency") {
+        settings.latency.midi_sec = std::stod(args[++i]) / 1e3;
+      } else {
+        throw std::runtime_error("Unknown check-alignment option: " + flag);
+      }
+    }
+    result = check_alignment(settings);
+  } catch (const std::exception &e) {
+    std::cerr << "Alignment check failed: " << e.what() << "\n";
+    return 1;
   }
 
-  bool recorder = true;
-  recorder = false;
+  std::cout << "Found " << result.num_onsets_found << " synth hits and "
+            << result.num_midi_sent << " midi hits of " << result.num_hits
+            << " at " << result.sample_rate << " Hz\nMidi after synth: ";
+  result.errors.print_ms(std::cout);
+  std::cout << "\n";
+
+  const bool ok = result.num_onsets_found == result.num_hits &&
+                  result.num_midi_sent == result.num_hits &&
+                  result.errors.count == result.num_hits &&
+                  std::max(std::abs(result.errors.min),
+                           std::abs(result.errors.max)) < 0.001;
+  std::cout << (ok ? "ok" : "FAILED") << "\n";
+  return ok ? 0 : 1;
+}
+
+struct AudioOptions {
+  AudioBackend backend = AudioBackend::system;
+  // frames a device callback, 0 leaves it to the backend
+  std::uint32_t period_frames = 0;
+  // --load-meter, prints the audio callback load every few seconds
+  bool report_load = false;
+};
+
+// takes "--audio system|null", "--buffer <frames>" and "--load-meter" out of
+// the arguments wherever they are
+AudioOptions take_audio_flags(std::vector<std::string> &args) {
+  AudioOptions options;
+  for (std::size_t i = 0; i < args.size(); ++i) {
+    if (args[i] == "--load-meter") {
+      options.report_load = true;
+      args.erase(args.begin() + i);
+      --i;
+      continue;
+    }
+    if (args[i] != "--audio" && args[i] != "--buffer")
+      continue;
+    if (i + 1 == args.size())
+      throw std::runtime_error("Missing value for " + args[i]);
+    if (args[i] == "--buffer") {
+      options.period_frames = std::stoul(args[i + 1]);
+    } else {
+      options.backend = parse_audio_backend(args[i + 1]);
+      // nothing reads an offline engine in the live modes, it would never
+      // play
+      if (options.backend == AudioBackend::offline)
+        throw std::runtime_error("--audio takes system or null");
+    }
+    args.erase(args.begin() + i, args.begin() + i + 2);
+    --i;
+  }
+  return options;
+}
+
+int main(int argc, char *argv[]) {
+  auto launch_time = std::chrono::steady_clock::now();
+  std::vector<std::string> args(argv + 1, argv + argc);
+
+  // the engine is opened by the first thing that makes a sound, modes that
+  // only send midi never open it
+  AudioOptions audio_options;
+  try {
+    audio_options = take_audio_flags(args);
+  } catch (const std::exception &e) {
+    std::cerr << "Invalid options: " << e.what() << "\n";
+    return 1;
+  }
+  AudioEngine audio(audio_options.backend, 48000,
+                    audio_options.period_frames);
+  // stays quiet until the engine's device has run
+  AudioLoadReporter load_reporter(
+      audio.get_load_meter(),
+      std::chrono::seconds(audio_options.report_load ? 5 : 0));
+
+  if (!args.empty() && args[0] == "batch") {
+    return run_batch(args);
+  }
+  if (!args.empty() && args[0] == "render") {
+    return run_render(args);
+  }
+  if (!args.empty() && args[0] == "audition") {
+    return run_audition(args, launch_time, audio);
+  }
+  if (!args.empty() && args[0] == "replay") {
+    return run_replay(args);
+  }
+  if (!args.empty() && args[0] == "overdub") {
+    return run_overdub(args);
+  }
+  if (!args.empty() && args[0] == "check-clicks") {
+    return run_check_clicks(args);
+  }
+  if (!args.empty() && args[0] == "check-alignment") {
+    return run_check_alignment(args);
+  }
+  if (!args.empty() && args[0] == "calibrate") {
+    return run_calibrate(audio, args);
+  }
+
+  bool recorder = !args.empty() && args[0] == "record";
 
   if (recorder) {
 
+    RecordOptions record_options;
+    try {
+      record_options = parse_record_flags(args);
+    } catch (const std::exception &e) {
+      std::cerr << "Invalid record options: " << e.what() << "\n";
+      return 1;
+    }
+    if (record_options.detect_tempo)
+      return run_free_record(record_options);
+
     int num_bars = 4;
     int subdivision = 4;
     double bpm = 120.0;
@@ -156,108 +1485,194 @@ int main() {
     std::cout << "Enter BPM: ";
     std::cin >> bpm;
 
-    std::thread metronome_thread([&]() {
-      double seconds_per_beat = 60.0 / bpm;
-      // NOTE: assuming 4 beats per bar
-      double seconds_per_bar = seconds_per_beat * 4;
-      double subdivision_duration = seconds_per_bar / subdivision;
-
-      auto metronome_start = std::chrono::high_resolution_clock::now();
-      int current_beat = 0;
-
-      // // Metronome for intro (first 4 beats)
-      // for (int intro_beat = 0; intro_beat < 4; ++intro_beat) {
-      //   auto tick_start = std::chrono::high_resolution_clock::now();
-      //
-      //   if (intro_beat % subdivision == 0) {
-      //     ma_engine_play_sound(&engine, "tock.mp3", NULL);
-      //   } else {
-      //     ma_engine_play_sound(&engine, "tick.mp3", NULL);
-      //   }
-      //
-      //   std::this_thread::sleep_until(
-      //       tick_start +
-      //       std::chrono::duration<double>(subdivision_duration));
-      // }
-      //
-      // Start logging after intro (skip the first 4 beats)
-      while (keep_recording.load()) {
-        auto tick_start = std::chrono::high_resolution_clock::now();
-
-        // Check if it's the first beat of a bar
-        if (current_beat % subdivision == 0) {
-          ma_engine_play_sound(&engine, "tock.mp3", NULL);
-        } else {
-          ma_engine_play_sound(&engine, "tick.mp3", NULL);
-        }
-
-        current_beat++;
-        std::this_thread::sleep_until(
-            tick_start + std::chrono::duration<double>(subdivision_duration));
-      }
-    });
-
-    double seconds_per_bar = (60.0 / bpm) * 4;
+    QuantizeSettings &quantize_settings = record_options.quantize_settings;
+    // the click's subdivision is the grid unless --grid picks another one
+    if (!record_options.has_grid)
+      quantize_settings.note_value = subdivision;
+    const int beats_per_bar = quantize_settings.beats_per_bar;
+    double seconds_per_bar = (60.0 / bpm) * beats_per_bar;
     double total_duration = seconds_per_bar * (num_bars + 1);
 
     try {
+      ma_engine &engine = audio.get();
+      // the port is opened before the clock starts so that opening it doesn't
+      // eat into the first bar
       RtMidiIn midiin;
+      std::string midi_input_name = open_first_midi_input(midiin);
 
-      if (midiin.getPortCount() == 0) {
-        std::cerr << "No MIDI input ports available.\n";
-        return 1;
+      double latency_sec = 0;
+      std::string device_key =
+          calibration_device_key(midi_input_name, audio_output_name(engine));
+      if (auto calibration =
+              load_latency_calibration(default_calibration_path, device_key)) {
+        latency_sec = calibration->offset_sec;
+      } else {
+        std::cout << "No latency calibration for " << device_key
+                  << ", run jams calibrate to get takes onto the grid\n";
       }
 
-      midiin.openPort(0);
-      midiin.setCallback(&midi_callback);
-      midiin.ignoreTypes(false, false, false);
-
-      start_time = std::chrono::high_resolution_clock::now();
-      std::cout << "Recording for " << total_duration << " seconds...\n";
+      // input goes to disk as it is drained so a crash or a very long take
+      // doesn't lose anything, it is read back once recording is done
+      if (record_options.journal_path.empty())
+        record_options.journal_path = timestamped_journal_path();
+      CaptureJournalHeader journal_header;
+      journal_header.bpm = bpm;
+      journal_header.beats_per_bar = beats_per_bar;
+      journal_header.num_bars = num_bars + 1;
+      journal_header.latency_offset_sec = latency_sec;
+      CaptureJournalWriter journal(record_options.journal_path,
+                                   journal_header);
 
-      std::thread timer_thread([&]() {
-        std::this_thread::sleep_for(
-            std::chrono::duration<double>(total_duration));
-        keep_recording = false;
-      });
+      capture_with_click(engine, midiin, bpm, subdivision, beats_per_bar,
+                         total_duration, &journal);
 
-      // Timer will be started right after the intro bar (which doesn’t count as
-      // a real bar)
-
-      // main thread just keeps going until keep recording is done
-      while (keep_recording) {
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      journal.close();
+      if (!journal.ok()) {
+        std::cerr << "Writing the capture journal failed: "
+                  << journal.get_error() << "\n";
+        return 1;
       }
+      std::cout << "Saved " << journal.get_num_records() << " messages to "
+                << journal.get_path() << ", use jams replay to quantize them "
+                << "again\n";
 
-      timer_thread.join();
-      metronome_thread.join();
-      std::cout << "Recording finished.\n";
-
-      std::lock_guard<std::mutex> lock(event_mutex);
-      quantize_events(recorded_events, bpm, num_bars + 1, subdivision);
+      CaptureJournal recorded = read_capture_journal(journal.get_path());
+      quantize_settings.bpm = bpm;
+      return process_take(std::move(recorded.events), record_options,
+                          num_bars + 1, latency_sec);
 
     } catch (RtMidiError &error) {
       error.printMessage();
       return 1;
+    } catch (const std::exception &e) {
+      std::cerr << "Recording failed: " << e.what() << "\n";
+      return 1;
     }
 
   } else {
-    Sequencer sequencer;
-    JamFileData jam_data = load_jam_file("song.jam");
+    PlaybackOptions playback_options;
+    try {
+      playback_options = parse_playback_flags(args, 0);
+    } catch (const std::exception &e) {
+      std::cerr << "Invalid options: " << e.what() << "\n";
+      return 1;
+    }
+    // the devices open on their own thread while the song is read and its
+    // first patterns are parsed
+    StartupTimer timer(launch_time);
+    auto opening_outputs = open_outputs_async(
+        audio, playback_options.use_synth || playback_options.audio_clock,
+        !playback_options.use_synth || playback_options.midi_channels != 0,
+        timer);
 
-    std::cout << "jam file: " << jam_data << std::endl;
+    JamFileData jam_data;
+    try {
+      jam_data = load_jam_file("song.jam");
+    } catch (const std::exception &e) {
+      std::cerr << "Playback failed: " << e.what() << "\n";
+      // the devices are still opening on the other thread
+      opening_outputs.wait();
+      return 1;
+    }
+    timer.mark("song parsed");
+    if (playback_options.audio_clock) {
+      if (!jam_data.backing_tracks.empty())
+        std::cout << "The TRACKS only follow the sequencer, they won't play "
+                     "with --clock audio\n";
+      try {
+        const CompiledSong song =
+            compile_song(compile_patterns(jam_data), jam_data.arrangement);
+        timer.mark("song compiled");
+        std::unique_ptr<RtMidiOut> midi_out = opening_outputs.get();
+        return play_on_audio_clock(audio.get(), jam_data, song,
+                                   playback_options, std::move(midi_out),
+                                   timer);
+      } catch (RtMidiError &error) {
+        error.printMessage();
+        return 1;
+      } catch (const std::exception &e) {
+        std::cerr << "Playback failed: " << e.what() << "\n";
+        if (opening_outputs.valid())
+          opening_outputs.wait();
+        return 1;
+      }
+    }
 
+    // every placement of a pattern shares its bars, which are only parsed
+    // when they are about to be played, the ones that play first are parsed
+    // now while the devices are still opening
+    std::unordered_map<std::string, std::shared_ptr<PatternBars>>
+        pattern_name_to_pattern_bars;
     for (const PatternData &data : jam_data.arrangement) {
       const auto &bar_sequence = jam_data.pattern_name_to_bars.at(data.name);
       const auto &bar_channel = jam_data.pattern_name_to_channel.at(data.name);
-      Pattern p(bar_sequence, bar_channel, jam_data.bpm, false,
+      auto &pattern_bars = pattern_name_to_pattern_bars[data.name];
+      if (!pattern_bars) {
+        pattern_bars = std::make_shared<PatternBars>(bar_sequence, bar_channel,
+                                                     jam_data.bpm);
+      }
+      if (data.start_bar == 0)
+        pattern_bars->compile();
+    }
+    timer.mark("first bars compiled");
+
+    std::unique_ptr<RtMidiOut> midi_out;
+    try {
+      midi_out = opening_outputs.get();
+    } catch (RtMidiError &error) {
+      error.printMessage();
+      return 1;
+    } catch (const std::exception &e) {
+      std::cerr << "Could not open the outputs: " << e.what() << "\n";
+      return 1;
+    }
+
+    std::unique_ptr<Synth> synth;
+    if (playback_options.use_synth) {
+      try {
+        synth = start_synth(audio.get(), playback_options, jam_data);
+      } catch (const std::exception &e) {
+        std::cerr << "Could not start the synth: " << e.what() << "\n";
+        return 1;
+      }
+    }
+
+    std::unique_ptr<Sequencer> sequencer =
+        synth ? std::make_unique<Sequencer>(synth.get())
+              : std::make_unique<Sequencer>(std::move(midi_out));
+
+    std::cout << "jam file: " << jam_data << std::endl;
+
+    // the engine is only opened here when the song has tracks and nothing
+    // else needed it
+    std::unique_ptr<BackingTrackPlayer> backing_tracks;
+    if (!jam_data.backing_tracks.empty()) {
+      try {
+        ma_engine &engine = audio.get();
+        backing_tracks = std::make_unique<BackingTrackPlayer>(
+            jam_data.backing_tracks, jam_data.bpm,
+            sequencer->get_bar_clock(), ma_engine_get_sample_rate(&engine));
+        backing_tracks->attach(engine);
+      } catch (const std::exception &e) {
+        std::cerr << "Could not play the tracks: " << e.what() << "\n";
+        return 1;
+      }
+      std::cout << "Streaming " << backing_tracks->get_num_tracks()
+                << " backing tracks" << std::endl;
+    }
+
+    for (const PatternData &data : jam_data.arrangement) {
+      Pattern p(pattern_name_to_pattern_bars.at(data.name),
+                jam_data.pattern_name_to_channel.at(data.name), false,
                 data.num_repeats, data.start_bar);
-      sequencer.add(p);
+      sequencer->add(p);
     }
 
-    sequencer.set_bpm(jam_data.bpm);
+    sequencer->set_bpm(jam_data.bpm);
+    sequencer->start_warm_up();
+    report_startup_on_first_note(*sequencer, timer);
     while (true) {
-      sequencer.process_current_bar();
+      sequencer->process_current_bar();
     }
   }
 
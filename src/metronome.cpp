@@ -0,0 +1,185 @@
+#include "metronome.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <stdexcept>
+
+namespace {
+
+// how far ahead clicks are handed to miniaudio, the scheduling thread only
+// has to wake up once within this to never miss one
+constexpr double lookahead_sec = 0.1;
+constexpr auto scheduling_interval = std::chrono::milliseconds(10);
+// time between start() and the first click, enough for the first few clicks
+// to be scheduled before they are due
+constexpr double lead_in_sec = 0.1;
+// decoded up front, and without pitch the engine doesn't put the clicks
+// through a resampler, which would start them a frame late
+constexpr ma_uint32 click_sound_flags =
+    MA_SOUND_FLAG_DECODE | MA_SOUND_FLAG_NO_PITCH;
+
+} // namespace
+
+Metronome::Metronome(ma_engine &engine, const std::string &tick_path,
+                     const std::string &tock_path)
+    : engine(engine) {
+  try {
+    load_sound(tick_voices, tick_path);
+    load_sound(tock_voices, tock_path);
+  } catch (...) {
+    uninit_voices();
+    throw;
+  }
+}
+
+Metronome::~Metronome() {
+  stop();
+  uninit_voices();
+}
+
+void Metronome::load_sound(Voices &voices, const std::string &path) {
+  // the first voice decodes the file, the others share its decoded data
+  auto voice = std::make_unique<Voice>();
+  ma_result result = ma_sound_init_from_file(&engine, path.c_str(),
+                                             click_sound_flags, NULL, NULL,
+                                             &voice->sound);
+  if (result != MA_SUCCESS) {
+    throw std::runtime_error("Could not load click sound: " + path);
+  }
+  voices.push_back(std::move(voice));
+
+  // a few to start with so the first bars don't have to add any
+  for (int i = 0; i < 3; ++i)
+    add_voice(voices);
+}
+
+bool Metronome::add_voice(Voices &voices) {
+  if (voices.size() >= max_voices_per_sound)
+    return false;
+  auto voice = std::make_unique<Voice>();
+  if (ma_sound_init_copy(&engine, &voices[0]->sound, click_sound_flags, NULL,
+                         &voice->sound) != MA_SUCCESS)
+    return false;
+  voices.push_back(std::move(voice));
+  return true;
+}
+
+void Metronome::uninit_voices() {
+  for (Voices *voices : {&tick_voices, &tock_voices}) {
+    // copies go first, they reference the first voice's data
+    while (!voices->empty()) {
+      ma_sound_uninit(&voices->back()->sound);
+      voices->pop_back();
+    }
+  }
+}
+
+void Metronome::start(double bpm, int clicks_subdivision,
+                      int clicks_beats_per_bar, SessionClock &clock,
+                      bool use_scheduling_thread) {
+  stop();
+
+  subdivision = clicks_subdivision;
+  beats_per_bar = clicks_beats_per_bar;
+  const double sample_rate = ma_engine_get_sample_rate(&engine);
+  frames_per_click = (60.0 / bpm) * 4.0 / subdivision * sample_rate;
+  next_click = 0;
+  num_missed_clicks = 0;
+
+  // the engine's frame counter and the session clock are read back to back so
+  // that the first click frame and the epoch describe the same moment
+  const std::uint64_t now_frame = ma_engine_get_time_in_pcm_frames(&engine);
+  clock.restart();
+  first_click_frame =
+      now_frame + static_cast<std::uint64_t>(lead_in_sec * sample_rate);
+  clock.epoch = clock.time_point_at(lead_in_sec);
+
+  if (!use_scheduling_thread)
+    return;
+  is_running = true;
+  scheduling_thread = std::thread([this]() {
+    while (is_running.load()) {
+      schedule_ahead();
+      std::this_thread::sleep_for(scheduling_interval);
+    }
+  });
+}
+
+void Metronome::schedule_ahead() {
+  const auto lookahead_frames = static_cast<std::uint64_t>(
+      lookahead_sec * ma_engine_get_sample_rate(&engine));
+  schedule_clicks_until(ma_engine_get_time_in_pcm_frames(&engine) +
+                        lookahead_frames);
+}
+
+// every click is placed from the first one rather than the previous one so
+// rounding never adds up
+std::uint64_t Metronome::click_frame(std::uint64_t click) const {
+  return first_click_frame +
+         static_cast<std::uint64_t>(std::llround(click * frames_per_click));
+}
+
+bool Metronome::is_first_of_bar(std::uint64_t click) const {
+  return (click * 4) %
+             (static_cast<std::uint64_t>(subdivision) * beats_per_bar) ==
+         0;
+}
+
+void Metronome::stop() {
+  is_running = false;
+  if (scheduling_thread.joinable())
+    scheduling_thread.join();
+
+  for (Voices *voices : {&tick_voices, &tock_voices}) {
+    for (auto &voice : *voices) {
+      if (voice->has_played) {
+        ma_sound_stop(&voice->sound);
+        ma_sound_seek_to_pcm_frame(&voice->sound, 0);
+        voice->has_played = false;
+      }
+    }
+  }
+}
+
+ma_sound *Metronome::acquire_voice(SoundType type) {
+  Voices &voices = type == SoundType::TOCK ? tock_voices : tick_voices;
+  for (auto &voice : voices) {
+    // a voice that was handed a start time is busy until it has played to the
+    // end, including while it is waiting to start
+    if (!voice->has_played || ma_sound_at_end(&voice->sound)) {
+      voice->has_played = true;
+      return &voice->sound;
+    }
+  }
+  if (!add_voice(voices))
+    return nullptr;
+  voices.back()->has_played = true;
+  return &voices.back()->sound;
+}
+
+void Metronome::schedule_clicks_until(std::uint64_t frame) {
+  const std::uint64_t now_frame = ma_engine_get_time_in_pcm_frames(&engine);
+
+  while (true) {
+    const std::uint64_t start_frame = click_frame(next_click);
+    if (start_frame >= frame)
+      break;
+
+    const bool is_tock = is_first_of_bar(next_click);
+    ++next_click;
+
+    // a click that is already due would only sound late, leave it out
+    ma_sound *voice =
+        start_frame < now_frame
+            ? nullptr
+            : acquire_voice(is_tock ? SoundType::TOCK : SoundType::TICK);
+    if (!voice) {
+      ++num_missed_clicks;
+      continue;
+    }
+
+    // starting a sound that played to the end rewinds it
+    ma_sound_set_start_time_in_pcm_frames(voice, start_frame);
+    ma_sound_start(voice);
+  }
+}
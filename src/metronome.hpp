@@ -0,0 +1,92 @@
+#ifndef METRONOME_HPP
+#define METRONOME_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "miniaudio/miniaudio.h"
+#include "session_clock.hpp"
+#include "sound/sound_types/sound_types.hpp"
+
+// a click track that plays on the audio clock instead of the wall clock: the
+// tick and tock are decoded into memory once, and every click is handed to
+// miniaudio ahead of time with the exact pcm frame it has to start on, so
+// clicks land on the sample however late the scheduling thread wakes up and
+// nothing is read from disk while playing
+//
+// a click can still be sounding when the next one starts (the clicks are
+// longer than a fast subdivision) so each sound has voices that share its
+// decoded data, a voice is reused once it has played to the end and more are
+// added when they are all busy
+class Metronome {
+public:
+  Metronome(ma_engine &engine, const std::string &tick_path = "tick.mp3",
+            const std::string &tock_path = "tock.mp3");
+  ~Metronome();
+
+  Metronome(const Metronome &) = delete;
+  Metronome &operator=(const Metronome &) = delete;
+
+  // starts clicking every subdivision (a note value, 4 clicks quarter notes)
+  // with a tock on the first click of every bar, the first click is a little
+  // in the future and the clock's epoch is moved onto it so that time 0 on the
+  // clock is exactly the first click
+  //
+  // without the scheduling thread nothing is scheduled until schedule_ahead()
+  // is called, for offline engines where whoever reads the engine decides
+  // when time moves
+  void start(double bpm, int subdivision, int beats_per_bar,
+             SessionClock &clock, bool use_scheduling_thread = true);
+  // stops the scheduling thread and silences clicks that haven't played yet
+  void stop();
+
+  // hands miniaudio every click due within the lookahead of the engine's
+  // time, the scheduling thread does this every few milliseconds
+  void schedule_ahead();
+
+  // the engine frame a click starts on, counting from 0 at the first click
+  std::uint64_t click_frame(std::uint64_t click) const;
+  // whether a click is the tock on the first beat of a bar
+  bool is_first_of_bar(std::uint64_t click) const;
+
+  // clicks that weren't played because the scheduling thread fell so far
+  // behind that their start had already passed, or no voice was free
+  std::uint64_t get_num_missed_clicks() const { return num_missed_clicks; }
+
+private:
+  // enough for a second long click at 32 clicks a second
+  static constexpr std::size_t max_voices_per_sound = 32;
+
+  struct Voice {
+    ma_sound sound;
+    bool has_played = false;
+  };
+  using Voices = std::vector<std::unique_ptr<Voice>>;
+
+  void load_sound(Voices &voices, const std::string &path);
+  bool add_voice(Voices &voices);
+  void uninit_voices();
+  ma_sound *acquire_voice(SoundType type);
+  void schedule_clicks_until(std::uint64_t frame);
+
+  ma_engine &engine;
+  Voices tick_voices;
+  Voices tock_voices;
+
+  // only touched by the scheduling thread while running
+  double frames_per_click = 0;
+  std::uint64_t first_click_frame = 0;
+  std::uint64_t next_click = 0;
+  int subdivision = 4;
+  int beats_per_bar = 4;
+  std::uint64_t num_missed_clicks = 0;
+
+  std::atomic<bool> is_running{false};
+  std::thread scheduling_thread;
+};
+
+#endif // METRONOME_HPP
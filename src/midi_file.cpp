@@ -0,0 +1,98 @@
+#include "midi_file.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+void write_u32_be(std::vector<unsigned char> &out, std::uint32_t value) {
+  out.push_back(static_cast<unsigned char>(value >> 24));
+  out.push_back(static_cast<unsigned char>(value >> 16));
+  out.push_back(static_cast<unsigned char>(value >> 8));
+  out.push_back(static_cast<unsigned char>(value));
+}
+
+void write_u16_be(std::vector<unsigned char> &out, std::uint16_t value) {
+  out.push_back(static_cast<unsigned char>(value >> 8));
+  out.push_back(static_cast<unsigned char>(value));
+}
+
+void write_variable_length(std::vector<unsigned char> &out,
+                           std::uint32_t value) {
+  unsigned char bytes[5];
+  int count = 0;
+  do {
+    bytes[count++] = value & 0x7F;
+    value >>= 7;
+  } while (value > 0);
+
+  // most significant group first, every byte but the last has the top bit set
+  while (count > 1) {
+    out.push_back(bytes[--count] | 0x80);
+  }
+  out.push_back(bytes[0]);
+}
+
+} // namespace
+
+void write_midi_file(const std::string &path, const CompiledSong &song,
+                     unsigned int ticks_per_quarter_note) {
+  std::vector<unsigned char> track;
+  track.reserve(song.events.size() * 4 + 32);
+
+  // tempo meta event, microseconds per quarter note
+  const auto microseconds_per_quarter =
+      static_cast<std::uint32_t>(std::lround(60'000'000.0 / song.bpm));
+  write_variable_length(track, 0);
+  track.insert(track.end(), {0xFF, 0x51, 0x03});
+  track.push_back(static_cast<unsigned char>(microseconds_per_quarter >> 16));
+  track.push_back(static_cast<unsigned char>(microseconds_per_quarter >> 8));
+  track.push_back(static_cast<unsigned char>(microseconds_per_quarter));
+
+  const double ticks_per_sec = song.bpm / 60.0 * ticks_per_quarter_note;
+  std::int64_t previous_tick = 0;
+  for (const TimedMidiEvent &event : song.events) {
+    auto tick = static_cast<std::int64_t>(std::llround(
+        std::max(0.0, event.time_sec) * ticks_per_sec));
+    tick = std::max(tick, previous_tick);
+    write_variable_length(track,
+                          static_cast<std::uint32_t>(tick - previous_tick));
+    previous_tick = tick;
+
+    track.push_back(event.status);
+    track.push_back(event.data1);
+    // program change and channel pressure only carry one data byte
+    const std::uint8_t type = event.status & 0xF0;
+    if (type != 0xC0 && type != 0xD0)
+      track.push_back(event.data2);
+  }
+
+  // end of track at the end of the last bar
+  const auto end_tick = std::max<std::int64_t>(
+      previous_tick, std::llround(song.duration_sec * ticks_per_sec));
+  write_variable_length(track,
+                        static_cast<std::uint32_t>(end_tick - previous_tick));
+  track.insert(track.end(), {0xFF, 0x2F, 0x00});
+
+  std::vector<unsigned char> header;
+  header.insert(header.end(), {'M', 'T', 'h', 'd'});
+  write_u32_be(header, 6);
+  write_u16_be(header, 0); // format 0, a single track
+  write_u16_be(header, 1);
+  write_u16_be(header, static_cast<std::uint16_t>(ticks_per_quarter_note));
+  header.insert(header.end(), {'M', 'T', 'r', 'k'});
+  write_u32_be(header, static_cast<std::uint32_t>(track.size()));
+
+  std::ofstream file(path, std::ios::binary);
+  if (!file) {
+    throw std::runtime_error("Could not open midi file for writing: " + path);
+  }
+  file.write(reinterpret_cast<const char *>(header.data()), header.size());
+  file.write(reinterpret_cast<const char *>(track.data()), track.size());
+  if (!file) {
+    throw std::runtime_error("Failed writing midi file: " + path);
+  }
+}
@@ -0,0 +1,14 @@
+#ifndef MIDI_FILE_HPP
+#define MIDI_FILE_HPP
+
+#include <string>
+
+#include "song_compiler.hpp"
+
+// writes the song as a format 0 standard midi file, one jam bar is one quarter
+// note at the song's bpm, 960 ticks per quarter note divides evenly into the
+// usual 2, 3, 4, 5, 6 and 8 element bars
+void write_midi_file(const std::string &path, const CompiledSong &song,
+                     unsigned int ticks_per_quarter_note = 960);
+
+#endif // MIDI_FILE_HPP
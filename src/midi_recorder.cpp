@@ -0,0 +1,115 @@
+#include "midi_recorder.hpp"
+
+#include <iostream>
+
+#include "capture_journal.hpp"
+
+MidiRecorder::MidiRecorder(std::size_t ring_capacity, bool log_messages)
+    : ring(ring_capacity), log_messages(log_messages) {}
+
+MidiRecorder::~MidiRecorder() { stop(); }
+
+void MidiRecorder::start(RtMidiIn &midi_in_to_record,
+                         const SessionClock &session_clock) {
+  start(session_clock);
+  midi_in = &midi_in_to_record;
+  midi_in->setCallback(&MidiRecorder::midi_callback, this);
+}
+
+void MidiRecorder::start(const SessionClock &session_clock) {
+  stop();
+  events.clear();
+  callback_lag = RunningStats();
+  clock = session_clock;
+  has_first_message = false;
+  driver_time_sec = 0;
+  is_recording = true;
+
+  drain_thread = std::thread([this]() {
+    // the drain thread is deliberately lazy, it sleeps between passes so it
+    // never competes with the input thread
+    while (is_recording.load()) {
+      drain();
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    drain();
+  });
+}
+
+void MidiRecorder::stop() {
+  if (midi_in) {
+    midi_in->cancelCallback();
+    midi_in = nullptr;
+  }
+  is_recording = false;
+  if (drain_thread.joinable())
+    drain_thread.join();
+  if (journal)
+    journal->sync();
+}
+
+void MidiRecorder::midi_callback(double deltatime,
+                                 std::vector<unsigned char> *message,
+                                 void *user_data) {
+  static_cast<MidiRecorder *>(user_data)->capture(deltatime, *message);
+}
+
+// runs on rtmidi's input thread: no locks, no allocation, no io
+void MidiRecorder::capture(double deltatime,
+                           const std::vector<unsigned char> &message) {
+  if (!is_recording.load(std::memory_order_relaxed))
+    return;
+
+  const double callback_time_sec = clock.now_sec();
+
+  // every message moves the driver time forward, including the ones that end
+  // up not being stored
+  if (!has_first_message) {
+    has_first_message = true;
+    driver_time_sec = callback_time_sec;
+  } else {
+    driver_time_sec += deltatime;
+  }
+
+  if (message.empty() || message.size() > 3) {
+    num_oversized.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  CapturedMidiMessage captured{};
+  captured.timestamp_sec = driver_time_sec;
+  captured.callback_lag_sec =
+      static_cast<float>(callback_time_sec - driver_time_sec);
+  captured.size = static_cast<std::uint8_t>(message.size());
+  for (std::size_t i = 0; i < message.size(); ++i)
+    captured.bytes[i] = message[i];
+
+  if (!ring.try_push(captured))
+    num_overflowed.fetch_add(1, std::memory_order_relaxed);
+}
+
+void MidiRecorder::drain() {
+  CapturedMidiMessage captured;
+  while (ring.try_pop(captured)) {
+    if (journal)
+      journal->append(captured);
+    if (message_handler)
+      message_handler(captured);
+    if (!journal && !message_handler)
+      events.push_back(captured);
+    callback_lag.add(captured.callback_lag_sec);
+
+    if (log_messages) {
+      std::cout << "Received MIDI message at " << captured.timestamp_sec
+                << "s: ";
+      for (std::uint8_t i = 0; i < captured.size; ++i) {
+        std::cout << std::hex << (int)captured.bytes[i] << " ";
+      }
+      std::cout << std::dec << std::endl;
+    }
+  }
+  // the last records before a pause are synced on time too, not when the
+  // next message comes in
+  if (journal)
+    journal->maybe_sync();
+}
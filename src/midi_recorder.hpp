@@ -0,0 +1,123 @@
+#ifndef MIDI_RECORDER_HPP
+#define MIDI_RECORDER_HPP
+
+#include <RtMidi.h>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "session_clock.hpp"
+#include "spsc_ring_buffer.hpp"
+#include "stats.hpp"
+
+class CaptureJournalWriter;
+
+// a midi message as captured by the input callback, fixed size so that the
+// callback only ever copies it into preallocated memory, channel messages are
+// at most 3 bytes so only sysex doesn't fit (it is counted and skipped)
+struct CapturedMidiMessage {
+  double timestamp_sec; // on the session clock, from the driver's delta times
+  // how long after timestamp_sec the callback actually ran
+  float callback_lag_sec;
+  std::uint8_t size; // number of valid bytes
+  std::uint8_t bytes[3];
+};
+
+// captures midi input without doing any work on rtmidi's input thread: the
+// callback only stamps the message and pushes it into a lock free ring buffer,
+// a separate drain thread that wakes up every few milliseconds pops from it,
+// logs the messages and stores them, if the drain thread falls behind far
+// enough for the ring to fill up, messages are dropped and counted rather than
+// blocking the callback
+//
+// timestamps come from the delta times rtmidi reports, which the driver takes
+// when the message arrives rather than when the callback gets scheduled: the
+// first message is placed on the session clock at the time its callback ran
+// and every later one is placed by adding up the deltas from there, the
+// difference between that and when each callback actually ran is kept as the
+// callback lag so the quality of the timestamps can be checked
+class MidiRecorder {
+public:
+  explicit MidiRecorder(std::size_t ring_capacity = 1 << 14,
+                        bool log_messages = true);
+  ~MidiRecorder();
+
+  MidiRecorder(const MidiRecorder &) = delete;
+  MidiRecorder &operator=(const MidiRecorder &) = delete;
+
+  // streams drained messages to a journal on disk instead of keeping them in
+  // memory, which keeps memory flat however long the take is, set before
+  // start, the journal has to outlive the recording
+  void set_journal(CaptureJournalWriter *capture_journal) {
+    journal = capture_journal;
+  }
+
+  // hands every drained message to a function as well, called on the drain
+  // thread so it may block for a moment without touching the input thread,
+  // messages are only kept in memory when there is neither a journal nor a
+  // handler, set before start
+  void set_message_handler(
+      std::function<void(const CapturedMidiMessage &)> handler) {
+    message_handler = std::move(handler);
+  }
+
+  // installs the input callback on an already opened port and starts draining,
+  // timestamps are seconds on the given clock
+  void start(RtMidiIn &midi_in, const SessionClock &clock);
+  // starts draining without a port, messages come in through inject()
+  // instead, for feeding in made up input
+  void start(const SessionClock &clock);
+  // what a port's callback would hand over, deltatime is the seconds since
+  // the message before as the driver would have measured it, from one thread
+  // at a time
+  void inject(double deltatime, const std::vector<unsigned char> &message) {
+    capture(deltatime, message);
+  }
+  // stops capturing, drains whatever is left and joins the drain thread
+  void stop();
+
+  // everything captured so far, only valid after stop and empty when
+  // recording to a journal or a handler
+  const std::vector<CapturedMidiMessage> &get_events() const { return events; }
+
+  // messages lost because the ring buffer was full
+  std::uint64_t get_num_overflowed() const { return num_overflowed.load(); }
+  // messages that didn't fit in a CapturedMidiMessage (sysex)
+  std::uint64_t get_num_oversized() const { return num_oversized.load(); }
+  // how late the callbacks ran compared to the driver's timestamps, only valid
+  // after stop
+  const RunningStats &get_callback_lag() const { return callback_lag; }
+
+  static void midi_callback(double deltatime,
+                            std::vector<unsigned char> *message,
+                            void *user_data);
+
+private:
+  void capture(double deltatime, const std::vector<unsigned char> &message);
+  void drain();
+
+  SpscRingBuffer<CapturedMidiMessage> ring;
+  bool log_messages;
+
+  RtMidiIn *midi_in = nullptr;
+  SessionClock clock;
+
+  // only touched by the input thread
+  bool has_first_message = false;
+  double driver_time_sec = 0;
+
+  std::atomic<bool> is_recording{false};
+  std::atomic<std::uint64_t> num_overflowed{0};
+  std::atomic<std::uint64_t> num_oversized{0};
+
+  std::thread drain_thread;
+  CaptureJournalWriter *journal = nullptr;
+  std::function<void(const CapturedMidiMessage &)> message_handler;
+  std::vector<CapturedMidiMessage> events;
+  RunningStats callback_lag;
+};
+
+#endif // MIDI_RECORDER_HPP
@@ -73341,8 +73341,15 @@ static ma_result ma_node_read_pcm_frames(ma_node* pNode, ma_uint32 outputBusInde
         return MA_INVALID_ARGS; /* Invalid output bus index. */
     }
 
-    /* Don't do anything if we're in a stopped state. */
-    if (ma_node_get_state_by_time_range(pNode, globalTime, globalTime + frameCount) != ma_node_state_started) {
+    /*
+    Don't do anything if we're in a stopped state. jams: a start or stop time inside this period
+    counts as started, the offsets below place it on its exact frame. ma_node_get_state_by_time_range()
+    only counts the node as started once the whole period is past its start time, which made those
+    offsets unreachable and held every scheduled sound back to the start of the next period.
+    */
+    if (ma_node_get_state(pNode) != ma_node_state_started ||
+        ma_node_get_state_time(pNode, ma_node_state_started) >= globalTime + frameCount ||
+        ma_node_get_state_time(pNode, ma_node_state_stopped) <= globalTime) {
         return MA_SUCCESS;  /* We're in a stopped state. This is not an error - we just need to not read anything. */
     }
 
@@ -73361,7 +73368,7 @@ static ma_result ma_node_read_pcm_frames(ma_node* pNode, ma_uint32 outputBusInde
     therefore need to offset it by a number of frames to accommodate. The same thing applies for
     the stop time.
     */
-    timeOffsetBeg = (globalTimeBeg < startTime) ? (ma_uint32)(globalTimeEnd - startTime) : 0;
+    timeOffsetBeg = (globalTimeBeg < startTime) ? (ma_uint32)(startTime - globalTimeBeg) : 0;   /* jams: was globalTimeEnd - startTime */
     timeOffsetEnd = (globalTimeEnd > stopTime)  ? (ma_uint32)(globalTimeEnd - stopTime)  : 0;
 
     /* Trim based on the start offset. We need to silence the start of the buffer. */
@@ -2,16 +2,27 @@
 #define MUSIC_ELEMENTS_HPP
 
 #include <RtMidi.h>
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <cstddef>
 #include <functional>
+#include <iomanip>
 #include <iostream>
+#include <memory>
 #include <mutex>
 #include <regex>
+#include <sstream>
 #include <string>
 #include <thread>
+#include <unordered_map>
+#include <vector>
 
+#include "frame_clock.hpp"
 #include "rt_midi_utils/rt_midi_utils.hpp"
+#include "session_clock.hpp"
+#include "spsc_ring_buffer.hpp"
+#include "synth.hpp"
 
 constexpr double epsilon = 1e-3;
 
@@ -42,6 +53,8 @@ public:
   unsigned int midi_velocity;
   bool is_note_on; // True if "note on", false if "note off"
   std::chrono::duration<double> bar_time_offset_sec;
+  // how long a note on sounds, set by Bar
+  std::chrono::duration<double> duration_sec{0.0};
 
 public:
   MidiEventNext(int channel, unsigned int bar_index, int note, double velocity,
@@ -67,9 +80,19 @@ public:
   }
 };
 
+// a controller message in a bar: control change, pitch bend or channel
+// pressure, the channel is the bar's
+struct BarControlEvent {
+  std::chrono::duration<double> bar_time_offset_sec;
+  std::uint8_t status;
+  std::uint8_t data1;
+  std::uint8_t data2;
+};
+
 class Bar {
 public:
   std::vector<MidiEventNext> note_on_midi_events;
+  std::vector<BarControlEvent> control_events;
   double bar_duration_sec;
   double bar_element_duration_sec;
 
@@ -80,13 +103,23 @@ public:
     // or just a literal hiphen
     // wrap the whole thing in (...\s*)+ match one more more of these objects
     // with spaces between them
-    std::regex pattern(R"((\s*((\((?:\s*\d+[',]*\s*)+\))|-)\s*)+)");
+    // a note can carry a velocity and a length in elements, 4:96~2.5, and a
+    // group can hold controller values, c1=64 (control change 1), b=8192
+    // (pitch bend) and p=100 (channel pressure)
+    // built once, constructing a std::regex costs far more than matching it
+    static const std::regex pattern(
+        R"((\s*((\((?:\s*(?:c\d+=\d+|[bp]=\d+|)"
+        R"(\d+[',]*(?::\d+)?(?:~\d*\.?\d+)?)\s*)+\))|-)\s*)+)");
     // std::cout << str << std::endl;
     return std::regex_match(str, pattern);
   }
 
+  static std::uint8_t clamp_data(int value) {
+    return static_cast<std::uint8_t>(std::clamp(value, 0, 127));
+  }
+
   int apply_octave_modifiers(const std::string &note_str) {
-    std::regex base_note_regex(R"((\d+)([',]*))");
+    static const std::regex base_note_regex(R"((\d+)([',]*))");
     std::smatch match;
     if (std::regex_match(note_str, match, base_note_regex)) {
       int note = std::stoi(match[1].str());
@@ -116,10 +149,8 @@ public:
       return;
     }
 
-    std::regex p(R"(\((?:\s*\d+[',]*\s*)*\)|-)");
-
     // Match each parenthesized group or hiphen
-    std::regex group_regex(R"(\(([^)]*)\)|-)");
+    static const std::regex group_regex(R"(\(([^)]*)\)|-)");
     auto groups_begin =
         std::sregex_iterator(pattern.begin(), pattern.end(), group_regex);
     auto groups_end = std::sregex_iterator();
@@ -132,28 +163,63 @@ public:
     // std::cout << "bar_element_duration_sec " << bar_element_duration_sec
     //           << std::endl;
 
-    std::regex note_regex(R"(\d+[',]*)");
+    // controller values first so the digits in c1=64 aren't read as notes
+    static const std::regex token_regex(R"(c(\d+)=(\d+)|([bp])=(\d+)|)"
+                                        R"((\d+[',]*)(?::(\d+))?)"
+                                        R"((?:~(\d*\.?\d+))?)");
+    const std::uint8_t channel_nibble =
+        static_cast<std::uint8_t>((channel - 1) & 0x0F);
 
     unsigned int bar_index = 0;
     for (std::sregex_iterator it = groups_begin; it != groups_end; ++it) {
       std::string group_content = (*it)[1].str(); // inside the parens
+      auto time_offset =
+          std::chrono::duration<double>(bar_index * bar_element_duration_sec);
+
+      auto tokens_begin = std::sregex_iterator(
+          group_content.begin(), group_content.end(), token_regex);
+      auto tokens_end = std::sregex_iterator();
+
+      for (std::sregex_iterator tit = tokens_begin; tit != tokens_end; ++tit) {
+        const std::smatch &token = *tit;
+        if (token[1].matched) {
+          control_events.push_back(
+              {time_offset, static_cast<std::uint8_t>(0xB0 | channel_nibble),
+               clamp_data(std::stoi(token[1].str())),
+               clamp_data(std::stoi(token[2].str()))});
+          continue;
+        }
+        if (token[3].matched) {
+          int value = std::stoi(token[4].str());
+          if (token[3].str() == "b") {
+            value = std::min(value, 16383);
+            control_events.push_back(
+                {time_offset, static_cast<std::uint8_t>(0xE0 | channel_nibble),
+                 static_cast<std::uint8_t>(value & 0x7F),
+                 static_cast<std::uint8_t>(value >> 7)});
+          } else {
+            control_events.push_back(
+                {time_offset, static_cast<std::uint8_t>(0xD0 | channel_nibble),
+                 clamp_data(value), 0});
+          }
+          continue;
+        }
 
-      if (group_content == "-") {
-        // it's a rhythmic rest
-        continue;
-      }
-
-      auto notes_begin = std::sregex_iterator(group_content.begin(),
-                                              group_content.end(), note_regex);
-      auto notes_end = std::sregex_iterator();
-
-      for (std::sregex_iterator nit = notes_begin; nit != notes_end; ++nit) {
-        int note = apply_octave_modifiers(nit->str());
+        int note = apply_octave_modifiers(token[5].str());
         int midi_note = note + 60;
-        auto time_offset =
-            std::chrono::duration<double>(bar_index * bar_element_duration_sec);
         MidiEventNext note_on_me(channel, bar_index, midi_note, 0.5, true,
                                  time_offset);
+        if (token[6].matched) {
+          note_on_me.midi_velocity =
+              std::max<unsigned int>(1, clamp_data(std::stoi(token[6].str())));
+          note_on_me.velocity = note_on_me.midi_velocity / 127.0;
+        }
+        // a note lasts one element unless it says otherwise, a length can
+        // run past the end of the bar
+        double length_elements =
+            token[7].matched ? std::stod(token[7].str()) : 1.0;
+        note_on_me.duration_sec = std::chrono::duration<double>(std::max(
+            length_elements * bar_element_duration_sec - epsilon, epsilon));
         // std::cout << "event: " << note_on_me << std::endl;
         note_on_midi_events.push_back(note_on_me);
       }
@@ -172,16 +238,54 @@ public:
   }
 };
 
-class Pattern {
+// the bars of a pattern, split into bar strings straight away (which is
+// cheap and enough to know how many bars there are) but only parsed into Bars
+// the first time they are needed, every placement of the same pattern in a
+// song shares one of these so a pattern is parsed at most once, compile() is
+// safe to call from several threads at once, which lets a background thread
+// parse upcoming patterns while the sequencer plays
+class PatternBars : public std::enable_shared_from_this<PatternBars> {
 public:
-  bool loop_forever; // loops forever starting from the start index? right now
-                     // it starts from 0, kinda bad
-  unsigned int num_repetitions;
-  unsigned int current_repetition = 0;
-  unsigned int channel;
-  unsigned int start_bar_index;
+  PatternBars(const std::vector<std::string> &bar_sequences,
+              unsigned int channel, unsigned int bpm)
+      : channel(channel), bpm(bpm) {
+    for (const auto &bar_seq : bar_sequences) {
+      std::stringstream ss(bar_seq);
+      std::string bar_str;
+
+      while (std::getline(ss, bar_str, '|')) {
+        bar_str = trim(bar_str);
+        if (!bar_str.empty()) {
+          bar_strings.push_back(bar_str);
+        }
+      }
+    }
+  }
+
+  std::size_t size() const { return bar_strings.size(); }
+  bool empty() const { return bar_strings.empty(); }
+  const std::vector<std::string> &get_bar_strings() const {
+    return bar_strings;
+  }
+  unsigned int get_channel() const { return channel; }
+  unsigned int get_bpm() const { return bpm; }
+  bool is_compiled() const { return compiled.load(std::memory_order_acquire); }
+
+  const std::vector<Bar> &compile() {
+    std::call_once(compile_once, [this]() {
+      bars.reserve(bar_strings.size());
+      for (const std::string &bar_str : bar_strings) {
+        bars.emplace_back(bar_str, channel, bpm);
+      }
+      compiled.store(true, std::memory_order_release);
+    });
+    return bars;
+  }
 
-  std::string trim(const std::string &s) {
+  const Bar &operator[](std::size_t index) { return compile()[index]; }
+
+private:
+  static std::string trim(const std::string &s) {
     auto begin = s.begin();
     while (begin != s.end() && std::isspace(*begin))
       ++begin;
@@ -194,8 +298,26 @@ public:
     return std::string(begin, end + 1);
   }
 
-public:
+  std::vector<std::string> bar_strings;
+  unsigned int channel;
+  unsigned int bpm;
+
+  std::once_flag compile_once;
+  std::atomic<bool> compiled{false};
   std::vector<Bar> bars;
+};
+
+class Pattern {
+public:
+  bool loop_forever; // loops forever starting from the start index? right now
+                     // it starts from 0, kinda bad
+  unsigned int num_repetitions;
+  unsigned int current_repetition = 0;
+  unsigned int channel;
+  unsigned int start_bar_index;
+
+public:
+  std::shared_ptr<PatternBars> bars;
 
   bool can_play_bar_from_bar_sequence(unsigned int bar_index) {
 
@@ -208,27 +330,40 @@ public:
     // then our last bar to play on would be 3, therefore in the equation below
     // we have 0 + 2 * 2 - 1 = 3, which explains the -1
     unsigned int last_bar_to_play_on =
-        start_bar_index + num_repetitions * bars.size() - 1;
+        start_bar_index + num_repetitions * bars->size() - 1;
 
     return start_bar_index <= bar_index and bar_index <= last_bar_to_play_on;
   }
 
+  // one past the last bar this pattern plays on when it doesn't loop
+  unsigned int end_bar_index() const {
+    unsigned int num_bars = static_cast<unsigned int>(bars->size());
+    return start_bar_index + std::max(num_repetitions, 1u) * num_bars;
+  }
+
   Pattern(const std::string &bar_sequence_str, unsigned int channel,
           unsigned int bpm, bool loop_forever, unsigned int num_repetitions = 0,
           unsigned int start_bar_index = 0)
-      : loop_forever(loop_forever), num_repetitions(num_repetitions),
-        channel(channel), start_bar_index(start_bar_index) {
-    parse_and_store_bars({bar_sequence_str}, bpm);
-  }
+      : Pattern(std::vector<std::string>{bar_sequence_str}, channel, bpm,
+                loop_forever, num_repetitions, start_bar_index) {}
 
   Pattern(const std::vector<std::string> &bar_sequence_vec,
           unsigned int channel, unsigned int bpm, bool loop_forever,
           unsigned int num_repetitions = 0, unsigned int start_bar_index = 0)
-      : loop_forever(loop_forever), num_repetitions(num_repetitions),
-        channel(channel), start_bar_index(start_bar_index) {
-    parse_and_store_bars(bar_sequence_vec, bpm);
+      : Pattern(std::make_shared<PatternBars>(bar_sequence_vec, channel, bpm),
+                channel, loop_forever, num_repetitions, start_bar_index) {
+    bars->compile();
   }
 
+  // places already split bars, they get parsed when the pattern is first
+  // played unless something compiles them before that
+  Pattern(std::shared_ptr<PatternBars> bars, unsigned int channel,
+          bool loop_forever, unsigned int num_repetitions = 0,
+          unsigned int start_bar_index = 0)
+      : loop_forever(loop_forever), num_repetitions(num_repetitions),
+        channel(channel), start_bar_index(start_bar_index),
+        bars(std::move(bars)) {}
+
   friend std::ostream &operator<<(std::ostream &os, const Pattern &seq) {
     os << "Pattern {\n"
        << "  loop_forever: " << (seq.loop_forever ? "true" : "false") << ",\n"
@@ -236,7 +371,7 @@ public:
        << "  channel: " << seq.channel << ",\n"
        << "  bars: [\n";
 
-    for (const auto &bar : seq.bars) {
+    for (const auto &bar : seq.bars->compile()) {
       os << "    " << bar << ",\n";
     }
 
@@ -244,22 +379,6 @@ public:
        << "}";
     return os;
   }
-
-private:
-  void parse_and_store_bars(const std::vector<std::string> &bar_sequences,
-                            unsigned int bpm) {
-    for (const auto &bar_seq : bar_sequences) {
-      std::stringstream ss(bar_seq);
-      std::string bar_str;
-
-      while (std::getline(ss, bar_str, '|')) {
-        bar_str = trim(bar_str);
-        if (!bar_str.empty()) {
-          bars.emplace_back(bar_str, channel, bpm);
-        }
-      }
-    }
-  }
 };
 
 struct NoteCollectionSequence {
@@ -268,7 +387,7 @@ struct NoteCollectionSequence {
   std::vector<MidiEvent> relative_midi_events;
 };
 
-size_t count_bar_elements(const std::string &bar) {
+inline size_t count_bar_elements(const std::string &bar) {
   size_t count = 0;
 
   for (size_t i = 0; i < bar.size(); ++i) {
@@ -290,7 +409,7 @@ size_t count_bar_elements(const std::string &bar) {
   return count;
 }
 
-void print_channel_to_note_events(
+inline void print_channel_to_note_events(
     const std::unordered_map<int, std::vector<MidiEvent>>
         &channel_to_note_events,
     const std::chrono::steady_clock::time_point &bar_start_time) {
@@ -323,7 +442,11 @@ public:
   std::vector<Pattern> bar_sequences;
   unsigned int largest_end_bar_for_any_pattern = 0;
 
-  Sequencer() {
+  // plays through the internal synth when there is one, which has to outlive
+  // the sequencer, and through the first midi output port otherwise
+  explicit Sequencer(Synth *internal_synth = nullptr) : synth(internal_synth) {
+    if (synth)
+      return;
     RtMidiOut *raw_midi_out = nullptr;
     if (!initialize_midi_output(raw_midi_out)) {
       std::cerr << "MIDI setup error: Failed to initialize MIDI output\n";
@@ -333,6 +456,44 @@ public:
     midi_out = std::unique_ptr<RtMidiOut>(raw_midi_out);
   }
 
+  // plays through a midi output that was opened elsewhere, so the port can be
+  // opened on another thread while the song is read
+  explicit Sequencer(std::unique_ptr<RtMidiOut> opened_midi_out)
+      : midi_out(std::move(opened_midi_out)) {}
+
+  ~Sequencer() { stop_warm_up(); }
+
+  // parses patterns that start within bars_ahead bars of the playhead on a
+  // background thread, so that by the time a pattern's first bar comes up it
+  // is usually ready and the sequencer doesn't stall parsing it, every
+  // pattern has to be added before this is called
+  void start_warm_up(unsigned int bars_ahead = 8) {
+    stop_warm_up();
+    keep_warming_up = true;
+    warm_up_thread = std::thread([this, bars_ahead]() {
+      while (keep_warming_up.load()) {
+        unsigned int playhead = playhead_bar.load();
+        bool all_compiled = true;
+        for (auto &bar_seq : bar_sequences) {
+          if (bar_seq.bars->is_compiled())
+            continue;
+          all_compiled = false;
+          if (is_coming_up(bar_seq, playhead, bars_ahead))
+            bar_seq.bars->compile();
+        }
+        if (all_compiled)
+          return;
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+      }
+    });
+  }
+
+  void stop_warm_up() {
+    keep_warming_up = false;
+    if (warm_up_thread.joinable())
+      warm_up_thread.join();
+  }
+
   void pause() {
     std::lock_guard<std::mutex> lock(mutex);
     is_paused = true;
@@ -342,6 +503,9 @@ public:
   void resume() {
     std::lock_guard<std::mutex> lock(mutex);
     is_paused = false;
+    // carry on from the current bar instead of rushing to catch up with the
+    // time spent paused
+    clock_is_running = false;
     std::cout << "Sequencer resumed.\n";
   }
 
@@ -364,11 +528,58 @@ public:
 
   void add(const Pattern &bar_seq) {
     bar_sequences.push_back(bar_seq);
-    auto end_bar_index = bar_seq.start_bar_index + bar_seq.bars.size();
+    auto end_bar_index = bar_seq.end_bar_index();
     if (end_bar_index > largest_end_bar_for_any_pattern)
       largest_end_bar_for_any_pattern = end_bar_index;
   }
 
+  // bars are timed from the clock's epoch, bar n of playback starts exactly n
+  // bar lengths after it so timing never drifts and other threads (like a
+  // recorder) can tell which bar is playing from the same clock, without this
+  // the clock starts with the first bar
+  void start_clock(const SessionClock &session_clock) {
+    clock = session_clock;
+    num_bars_played = 0;
+    clock_is_running = true;
+  }
+
+  // the song bar that started last and when it started, published at every
+  // bar boundary so other threads (like the backing tracks) can follow
+  // playback, nothing is published while paused
+  const FrameClock &get_bar_clock() const { return bar_clock; }
+
+  // makes the song a whole number of loops of the given number of bars long
+  // so that a looping pattern of that length lines up with the song's start
+  // every time round
+  void align_song_length_to(unsigned int num_bars) {
+    if (num_bars == 0)
+      return;
+    unsigned int length = std::max(largest_end_bar_for_any_pattern, num_bars);
+    largest_end_bar_for_any_pattern =
+        (length + num_bars - 1) / num_bars * num_bars;
+  }
+
+  // hands new bars for a pattern to the sequencer from another thread, every
+  // pattern playing old_bars plays new_bars from the next bar boundary on,
+  // both pointers have to stay alive until old_bars comes back out of
+  // pop_retired_pattern_bars, only one thread may queue swaps, false when too
+  // many swaps are waiting already
+  bool queue_pattern_bars_swap(PatternBars *old_bars, PatternBars *new_bars) {
+    return pending_pattern_bars_swaps.try_push({old_bars, new_bars});
+  }
+
+  // bars that were swapped out and aren't referenced by the sequencer anymore,
+  // for the thread that queued the swaps
+  bool pop_retired_pattern_bars(PatternBars *&bars) {
+    return retired_pattern_bars.try_pop(bars);
+  }
+
+  // called once, on the playback thread, right after the first note on goes
+  // out, for timing how long it took to start up
+  void set_first_note_handler(std::function<void()> handler) {
+    first_note_handler = std::move(handler);
+  }
+
   void set_bpm(double bpm) {
     using namespace std::chrono;
     tick_duration = duration_cast<nanoseconds>(duration<double>(60.0 / bpm));
@@ -397,11 +608,12 @@ public:
       }
 
       // std::cout << "Processing bar sequence...\n";
+      // parses the pattern here if the warm up thread didn't get to it yet
       const auto &current_bar =
-          bar_seq.bars[sequencer_bar_index % bar_seq.bars.size()];
+          (*bar_seq.bars)[sequencer_bar_index % bar_seq.bars->size()];
 
       // std::cout << "Current bar index: " << sequencer_bar_index
-      //           << ", Number of bars in sequence: " << bar_seq.bars.size()
+      //           << ", Number of bars in sequence: " << bar_seq.bars->size()
       //           << '\n';
 
       for (const auto &note_on_event : current_bar.note_on_midi_events) {
@@ -417,12 +629,12 @@ public:
         // Add note on event
         time_to_midi_events[note_on_time].push_back(note_on_event);
 
-        // Create and add note off event
+        // Create and add note off event, recorded notes can last past the
+        // end of the bar
         std::chrono::steady_clock::time_point note_off_time =
             note_on_time +
             std::chrono::duration_cast<std::chrono::steady_clock::duration>(
-                std::chrono::duration<double>(
-                    current_bar.bar_element_duration_sec - epsilon));
+                note_on_event.duration_sec);
 
         MidiEventNext note_off_event(note_on_event.channel,
                                      note_on_event.bar_index,
@@ -436,13 +648,40 @@ public:
       }
 
       if (sequencer_bar_index != 0 and
-          sequencer_bar_index % bar_seq.bars.size() == 0)
+          sequencer_bar_index % bar_seq.bars->size() == 0)
         bar_seq.current_repetition++;
     }
 
     return time_to_midi_events;
   }
 
+  // the controller messages of the current bar in time order, doesn't move
+  // any pattern on so it has to be called alongside the note events above
+  std::vector<std::pair<std::chrono::steady_clock::time_point, BarControlEvent>>
+  generate_control_events_for_current_bar_for_all_bar_sequences(
+      std::chrono::steady_clock::time_point bar_start_time) {
+    std::vector<
+        std::pair<std::chrono::steady_clock::time_point, BarControlEvent>>
+        control_events;
+    for (auto &bar_seq : bar_sequences) {
+      if (not bar_seq.can_play_bar_from_bar_sequence(sequencer_bar_index))
+        continue;
+      const auto &current_bar =
+          (*bar_seq.bars)[sequencer_bar_index % bar_seq.bars->size()];
+      for (const BarControlEvent &event : current_bar.control_events) {
+        control_events.emplace_back(
+            bar_start_time +
+                std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                    event.bar_time_offset_sec),
+            event);
+      }
+    }
+    std::stable_sort(
+        control_events.begin(), control_events.end(),
+        [](const auto &a, const auto &b) { return a.first < b.first; });
+    return control_events;
+  }
+
   void process_current_bar() {
     using namespace std::chrono;
 
@@ -451,8 +690,17 @@ public:
       return;
     }
 
-    steady_clock::time_point bar_start_time = steady_clock::now();
+    if (!clock_is_running) {
+      clock.epoch = steady_clock::now() - tick_duration * num_bars_played;
+      clock_is_running = true;
+    }
+    steady_clock::time_point bar_start_time =
+        clock.epoch + tick_duration * num_bars_played;
     steady_clock::time_point next_bar_time = bar_start_time + tick_duration;
+    playhead_bar.store(sequencer_bar_index);
+    bar_clock.publish(sequencer_bar_index, bar_start_time);
+
+    apply_pattern_bars_swaps();
 
     // std::cout << "processing bar: " << sequencer_bar_index << std::endl;
     // std::cout << "Tick duration: "
@@ -467,6 +715,18 @@ public:
         time_to_midi_events =
             generate_note_events_for_current_bar_for_all_bar_sequences(
                 bar_start_time);
+    std::vector<std::pair<steady_clock::time_point, BarControlEvent>>
+        control_events =
+            generate_control_events_for_current_bar_for_all_bar_sequences(
+                bar_start_time);
+    std::size_t next_control_event = 0;
+
+    // note offs of notes that ring past the end of the last bar
+    for (auto &[time, events] : carried_midi_events) {
+      auto &scheduled = time_to_midi_events[time];
+      scheduled.insert(scheduled.end(), events.begin(), events.end());
+    }
+    carried_midi_events.clear();
 
     // std::cout << "Time to MIDI events map built. Total events: "
     //           << time_to_midi_events.size() << '\n';
@@ -475,6 +735,14 @@ public:
     while (steady_clock::now() < next_bar_time) {
       steady_clock::time_point now = steady_clock::now();
 
+      // controllers go out before notes due at the same time so a note starts
+      // with the bend or modulation it was played with
+      while (next_control_event < control_events.size() &&
+             control_events[next_control_event].first <= now) {
+        send_control(control_events[next_control_event].second);
+        ++next_control_event;
+      }
+
       // Iterate over all events and trigger those that are due
       for (auto it = time_to_midi_events.begin();
            it != time_to_midi_events.end();) {
@@ -499,13 +767,35 @@ public:
 
       // std::this_thread::sleep_for(milliseconds(1));
     }
+    carried_midi_events = std::move(time_to_midi_events);
 
     sequencer_bar_index++;
     sequencer_bar_index %= largest_end_bar_for_any_pattern;
+    num_bars_played++;
     // std::cout << "Just finished a bar\n";
   }
 
 private:
+  struct PatternBarsSwap {
+    PatternBars *old_bars;
+    PatternBars *new_bars;
+  };
+
+  // runs on the playback thread at a bar boundary, no locks and no
+  // allocation, the old bars are kept alive by whoever queued the swap so
+  // dropping the reference here never frees them
+  void apply_pattern_bars_swaps() {
+    PatternBarsSwap swap;
+    while (pending_pattern_bars_swaps.try_pop(swap)) {
+      for (auto &bar_seq : bar_sequences) {
+        if (bar_seq.bars.get() == swap.old_bars)
+          bar_seq.bars = swap.new_bars->shared_from_this();
+      }
+      if (!retired_pattern_bars.try_push(swap.old_bars))
+        std::cerr << "Retired pattern queue is full\n";
+    }
+  }
+
   void send_note_on(int note, int velocity = 100, int channel = 1) {
     if (channel < 1 || channel > 16) {
       return; // Handle invalid channel number
@@ -514,7 +804,21 @@ private:
     std::vector<unsigned char> message = {
         static_cast<unsigned char>(0x90 + (channel - 1)),
         static_cast<unsigned char>(note), static_cast<unsigned char>(velocity)};
-    midi_out->sendMessage(&message);
+    send_message(message);
+    if (first_note_handler) {
+      // moved out first so it only ever runs once
+      std::function<void()> handler = std::move(first_note_handler);
+      first_note_handler = nullptr;
+      handler();
+    }
+  }
+
+  void send_control(const BarControlEvent &event) {
+    std::vector<unsigned char> message = {event.status, event.data1};
+    // channel pressure only carries one data byte
+    if ((event.status & 0xF0) != 0xD0)
+      message.push_back(event.data2);
+    send_message(message);
   }
 
   void send_note_off(int note, int channel = 1) {
@@ -525,10 +829,54 @@ private:
     std::vector<unsigned char> message = {
         static_cast<unsigned char>(0x80 + (channel - 1)),
         static_cast<unsigned char>(note), 0};
+    send_message(message);
+  }
+
+  void send_message(std::vector<unsigned char> &message) {
+    if (synth) {
+      synth->send(message[0], message.size() > 1 ? message[1] : 0,
+                  message.size() > 2 ? message[2] : 0);
+      return;
+    }
     midi_out->sendMessage(&message);
   }
 
+  bool is_coming_up(const Pattern &bar_seq, unsigned int playhead,
+                    unsigned int bars_ahead) const {
+    if (bar_seq.loop_forever || largest_end_bar_for_any_pattern == 0)
+      return true;
+    if (bar_seq.start_bar_index <= playhead &&
+        playhead < bar_seq.end_bar_index())
+      return true;
+    // the song loops, so a pattern near the start is coming up near the end
+    unsigned int song_length = largest_end_bar_for_any_pattern;
+    unsigned int bars_until_start =
+        (bar_seq.start_bar_index % song_length + song_length -
+         playhead % song_length) %
+        song_length;
+    return bars_until_start <= bars_ahead;
+  }
+
+  // events still due when the last bar ended
+  std::unordered_map<std::chrono::steady_clock::time_point,
+                     std::vector<MidiEventNext>, time_point_hash>
+      carried_midi_events;
+
+  std::atomic<unsigned int> playhead_bar{0};
+  FrameClock bar_clock;
+  std::atomic<bool> keep_warming_up{false};
+  std::thread warm_up_thread;
+
+  SessionClock clock;
+  bool clock_is_running = false;
+  std::uint64_t num_bars_played = 0;
+
+  SpscRingBuffer<PatternBarsSwap> pending_pattern_bars_swaps{16};
+  SpscRingBuffer<PatternBars *> retired_pattern_bars{16};
+
+  Synth *synth = nullptr;
   std::unique_ptr<RtMidiOut> midi_out;
+  std::function<void()> first_note_handler;
   std::chrono::nanoseconds tick_duration{
       std::chrono::duration_cast<std::chrono::nanoseconds>(
           std::chrono::duration<double>{0.5})};
@@ -0,0 +1,173 @@
+#include "offline_render.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+
+#include "miniaudio/miniaudio.h"
+#include "simd.hpp"
+#include "synth.hpp"
+
+namespace {
+
+// about eleven seconds at 48 kHz, big enough that starting the threads for
+// every chunk doesn't show up and small enough that all the stems of a chunk
+// stay small
+constexpr std::uint64_t chunk_frames = 1 << 19;
+
+class WavWriter {
+public:
+  WavWriter(const std::string &path, std::uint32_t sample_rate) : path(path) {
+    ma_encoder_config config = ma_encoder_config_init(
+        ma_encoding_format_wav, ma_format_f32, 2, sample_rate);
+    if (ma_encoder_init_file(path.c_str(), &config, &encoder) != MA_SUCCESS)
+      throw std::runtime_error("Could not open " + path + " for writing");
+  }
+  ~WavWriter() { ma_encoder_uninit(&encoder); }
+
+  WavWriter(const WavWriter &) = delete;
+  WavWriter &operator=(const WavWriter &) = delete;
+
+  void write(const float *frames, std::uint64_t num_frames) {
+    ma_uint64 num_written = 0;
+    if (ma_encoder_write_pcm_frames(&encoder, frames, num_frames,
+                                    &num_written) != MA_SUCCESS ||
+        num_written != num_frames)
+      throw std::runtime_error("Writing " + path + " failed");
+  }
+
+private:
+  std::string path;
+  ma_encoder encoder;
+};
+
+// one channel of the song with the synth that plays it
+struct Stem {
+  int channel;
+  std::unique_ptr<Synth> synth;
+  std::vector<TimedMidiEvent> events;
+  std::size_t next_event = 0;
+  std::vector<float> frames;
+  std::unique_ptr<WavWriter> writer;
+};
+
+// renders frames [first_frame, first_frame + num_frames) of a stem, the synth
+// takes in messages at the start of a render call so rendering stops at every
+// event's frame to hand it over
+void render_stem_chunk(Stem &stem, std::uint64_t first_frame,
+                       std::uint64_t num_frames, double sample_rate) {
+  const std::uint64_t end_frame = first_frame + num_frames;
+  std::uint64_t frame = first_frame;
+  while (frame < end_frame) {
+    std::uint64_t next_frame = end_frame;
+    for (; stem.next_event < stem.events.size(); ++stem.next_event) {
+      const TimedMidiEvent &event = stem.events[stem.next_event];
+      const auto event_frame = static_cast<std::uint64_t>(
+          std::llround(event.time_sec * sample_rate));
+      if (event_frame > frame) {
+        next_frame = std::min(next_frame, event_frame);
+        break;
+      }
+      stem.synth->send(event.status, event.data1, event.data2);
+    }
+    stem.synth->render(stem.frames.data() + 2 * (frame - first_frame),
+                       static_cast<std::uint32_t>(next_frame - frame));
+    frame = next_frame;
+  }
+}
+
+} // namespace
+
+RenderStats render_song_to_wav(const CompiledSong &song,
+                               const std::string &path,
+                               const RenderSettings &settings) {
+  auto start = std::chrono::steady_clock::now();
+  RenderStats stats;
+  const double sample_rate = settings.sample_rate;
+  stats.num_frames = static_cast<std::uint64_t>(
+      std::ceil((song.duration_sec + settings.tail_sec) * sample_rate));
+  stats.audio_sec = stats.num_frames / sample_rate;
+
+  std::vector<std::unique_ptr<Stem>> stems;
+  for (int channel = 1; channel <= 16; ++channel) {
+    auto stem = std::make_unique<Stem>();
+    stem->channel = channel;
+    for (const TimedMidiEvent &event : song.events) {
+      if ((event.status & 0x0F) == channel - 1)
+        stem->events.push_back(event);
+    }
+    if (stem->events.empty())
+      continue;
+    stem->synth = std::make_unique<Synth>(sample_rate);
+    stem->synth->set_drum_kit(settings.drum_kit);
+    stem->synth->set_voice_policy(settings.voice_policy);
+    for (const auto &[program_channel, program] : settings.programs) {
+      if (program_channel == channel)
+        stem->synth->set_program(channel, program);
+    }
+    stem->frames.resize(2 * chunk_frames);
+    stats.channels.push_back(channel);
+    stems.push_back(std::move(stem));
+  }
+
+  if (!settings.stems_directory.empty()) {
+    std::filesystem::create_directories(settings.stems_directory);
+    for (auto &stem : stems) {
+      const std::string stem_path =
+          (std::filesystem::path(settings.stems_directory) /
+           ("channel_" + std::to_string(stem->channel) + ".wav"))
+              .string();
+      stem->writer =
+          std::make_unique<WavWriter>(stem_path, settings.sample_rate);
+    }
+  }
+  WavWriter mix_writer(path, settings.sample_rate);
+  std::vector<float> mix(2 * chunk_frames);
+
+  unsigned int num_threads = settings.num_threads;
+  if (num_threads == 0)
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  num_threads = static_cast<unsigned int>(std::min<std::size_t>(
+      num_threads, std::max<std::size_t>(stems.size(), 1)));
+  stats.num_threads = num_threads;
+
+  for (std::uint64_t first_frame = 0; first_frame < stats.num_frames;
+       first_frame += chunk_frames) {
+    const std::uint64_t num_frames =
+        std::min(chunk_frames, stats.num_frames - first_frame);
+
+    std::atomic<std::size_t> next_stem{0};
+    auto worker = [&]() {
+      for (std::size_t i = next_stem++; i < stems.size(); i = next_stem++)
+        render_stem_chunk(*stems[i], first_frame, num_frames, sample_rate);
+    };
+    std::vector<std::thread> threads;
+    for (unsigned int t = 0; t + 1 < num_threads; ++t)
+      threads.emplace_back(worker);
+    worker();
+    for (std::thread &thread : threads)
+      thread.join();
+
+    std::fill(mix.begin(), mix.begin() + 2 * num_frames, 0.0f);
+    for (auto &stem : stems) {
+      mix_into(mix.data(), stem->frames.data(), 2 * num_frames);
+      if (stem->writer)
+        stem->writer->write(stem->frames.data(), num_frames);
+    }
+    for (std::size_t i = 0; i < 2 * num_frames; ++i)
+      stats.peak = std::max(stats.peak, std::abs(mix[i]));
+    mix_writer.write(mix.data(), num_frames);
+  }
+
+  for (auto &stem : stems)
+    stats.voices += stem->synth->get_voice_stats();
+  stats.render_sec = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+  return stats;
+}
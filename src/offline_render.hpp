@@ -0,0 +1,58 @@
+#ifndef OFFLINE_RENDER_HPP
+#define OFFLINE_RENDER_HPP
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "drum_kit.hpp"
+#include "song_compiler.hpp"
+#include "voice_allocator.hpp"
+
+struct RenderSettings {
+  std::uint32_t sample_rate = 48000;
+  // rendered past the end of the song so the last notes can ring out
+  double tail_sec = 2.0;
+  // 0 means one per core
+  unsigned int num_threads = 0;
+  // the synth's program for a channel (1 - 16)
+  std::vector<std::pair<int, int>> programs;
+  // how each channel's synth hands out its voices
+  VoicePolicy voice_policy;
+  // the legend's samples, loaded at sample_rate, when there are any
+  std::shared_ptr<const DrumKit> drum_kit;
+  // every channel is also written on its own into this directory as
+  // channel_<n>.wav when it isn't empty
+  std::string stems_directory;
+};
+
+struct RenderStats {
+  std::uint64_t num_frames = 0;
+  double audio_sec = 0;
+  double render_sec = 0;
+  unsigned int num_threads = 0;
+  // the channels that had anything to play, 1 - 16
+  std::vector<int> channels;
+  // of the mix, over 1 means it clips once it's turned into integers
+  float peak = 0;
+  // over every channel's synth
+  VoiceStats voices;
+};
+
+// bounces the song through the built in synth into a 32 bit float stereo wav
+// file as fast as it can rather than in real time
+//
+// every channel plays on a synth of its own, the song is rendered a chunk at a
+// time with the channels of a chunk spread over the threads, then the chunk's
+// channels are summed into the mix with simd and written out, so memory stays
+// the same however long the song is, events land on the exact frame they are
+// due
+//
+// throws when a file can't be written
+RenderStats render_song_to_wav(const CompiledSong &song,
+                               const std::string &path,
+                               const RenderSettings &settings = {});
+
+#endif // OFFLINE_RENDER_HPP
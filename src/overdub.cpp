@@ -0,0 +1,179 @@
+#include "overdub.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <stdexcept>
+
+#include "jam_file_writing.hpp"
+
+namespace {
+
+constexpr auto overdub_interval = std::chrono::milliseconds(5);
+// how long after a pass (and its half step of early notes for the next one)
+// is over before it gets merged, covers the recorder's drain interval
+constexpr double merge_margin_sec = 0.02;
+
+bool is_note_on(const CapturedMidiMessage &event) {
+  return event.size == 3 && (event.bytes[0] & 0xF0) == 0x90 &&
+         event.bytes[2] > 0;
+}
+
+bool is_note_off(const CapturedMidiMessage &event) {
+  return event.size == 3 && ((event.bytes[0] & 0xF0) == 0x80 ||
+                             ((event.bytes[0] & 0xF0) == 0x90 &&
+                              event.bytes[2] == 0));
+}
+
+} // namespace
+
+Overdubber::Overdubber(Sequencer &sequencer,
+                       std::shared_ptr<PatternBars> target,
+                       const QuantizeSettings &settings,
+                       double latency_offset_sec,
+                       const PerformanceSettings &performance_settings)
+    : sequencer(sequencer), settings(settings),
+      latency_offset_sec(latency_offset_sec),
+      performance_settings(performance_settings), current(std::move(target)) {
+  if (!current || current->empty()) {
+    throw std::runtime_error("Can't overdub into a pattern without bars");
+  }
+  // a jam bar is one beat
+  pass_duration_sec = current->size() * 60.0 / settings.bpm;
+  num_bars_per_pass =
+      static_cast<int>((current->size() + settings.beats_per_bar - 1) /
+                       settings.beats_per_bar);
+  pending.reserve(1024);
+}
+
+Overdubber::~Overdubber() { stop(); }
+
+void Overdubber::start(const SessionClock &session_clock) {
+  stop();
+  clock = session_clock;
+  next_pass = 0;
+  pending.clear();
+  is_running = true;
+  overdub_thread = std::thread([this]() { run(); });
+}
+
+void Overdubber::stop() {
+  is_running = false;
+  if (overdub_thread.joinable())
+    overdub_thread.join();
+}
+
+void Overdubber::push(const CapturedMidiMessage &message) {
+  if (!ring.try_push(message))
+    num_overflowed.fetch_add(1, std::memory_order_relaxed);
+}
+
+std::shared_ptr<PatternBars> Overdubber::get_pattern_bars() {
+  std::lock_guard<std::mutex> lock(current_mutex);
+  return current;
+}
+
+void Overdubber::run() {
+  const double half_step_sec = step_duration_sec(settings) / 2;
+  const double pass_delay_sec =
+      std::max(latency_offset_sec, 0.0) - half_step_sec + merge_margin_sec;
+
+  while (is_running.load()) {
+    take_messages();
+    // a pass is merged once notes meant for it can't arrive anymore
+    while (clock.now_sec() >=
+           (next_pass + 1) * pass_duration_sec + pass_delay_sec)
+      merge_pass(next_pass++);
+    release_retired_bars();
+    std::this_thread::sleep_for(overdub_interval);
+  }
+
+  // whatever was played in the pass that got cut off counts too
+  take_messages();
+  while (!pending.empty())
+    merge_pass(next_pass++);
+}
+
+void Overdubber::take_messages() {
+  const double half_step_sec = step_duration_sec(settings) / 2;
+  CapturedMidiMessage message;
+  while (ring.try_pop(message)) {
+    message.timestamp_sec -= latency_offset_sec;
+    // notes up to half a step early belong to the start of the next pass
+    auto pass = static_cast<std::int64_t>(std::floor(
+        (message.timestamp_sec + half_step_sec) / pass_duration_sec));
+    if (pass < next_pass) {
+      ++num_late;
+      continue;
+    }
+    pending.push_back(message);
+  }
+}
+
+void Overdubber::merge_pass(std::int64_t pass) {
+  const double half_step_sec = step_duration_sec(settings) / 2;
+  const double pass_start_sec = pass * pass_duration_sec;
+  const double pass_end_sec = pass_start_sec + pass_duration_sec;
+
+  // the pass's messages, timed from its start
+  std::vector<CapturedMidiMessage> pass_events;
+  std::size_t num_note_ons = 0;
+  auto is_in_pass = [&](const CapturedMidiMessage &message) {
+    return message.timestamp_sec + half_step_sec < pass_end_sec;
+  };
+  for (const CapturedMidiMessage &message : pending) {
+    // note offs that already came in for notes held over the end of the pass
+    // give those notes their length, they stay for the next pass too
+    if (!is_in_pass(message) && !is_note_off(message))
+      continue;
+    pass_events.push_back(message);
+    pass_events.back().timestamp_sec -= pass_start_sec;
+    if (is_note_on(message))
+      ++num_note_ons;
+  }
+  pending.erase(std::remove_if(pending.begin(), pending.end(), is_in_pass),
+                pending.end());
+  if (num_note_ons == 0)
+    return;
+
+  std::shared_ptr<PatternBars> merged;
+  {
+    std::lock_guard<std::mutex> lock(current_mutex);
+    merged = current;
+  }
+  QuantizedTake take = quantize(pass_events, settings, num_bars_per_pass);
+  merged = std::make_shared<PatternBars>(
+      merge_take_into_bars(merged->get_bar_strings(), take,
+                           performance_settings),
+      merged->get_channel(), merged->get_bpm());
+  // parsed here so the sequencer never has to
+  merged->compile();
+
+  if (!sequencer.queue_pattern_bars_swap(current.get(), merged.get())) {
+    std::cerr << "Overdub: sequencer isn't taking new bars, pass " << pass + 1
+              << " was dropped\n";
+    return;
+  }
+  published.push_back(current);
+  {
+    std::lock_guard<std::mutex> lock(current_mutex);
+    current = merged;
+  }
+  ++num_passes_merged;
+  num_notes_merged += num_note_ons;
+  std::cout << "Overdub: merged pass " << pass + 1 << " (" << num_note_ons
+            << " notes)\n";
+}
+
+void Overdubber::release_retired_bars() {
+  PatternBars *retired;
+  while (sequencer.pop_retired_pattern_bars(retired)) {
+    published.erase(
+        std::remove_if(published.begin(), published.end(),
+                       [retired](const std::shared_ptr<PatternBars> &bars) {
+                         return bars.get() == retired;
+                       }),
+        published.end());
+  }
+}
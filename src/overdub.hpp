@@ -0,0 +1,97 @@
+#ifndef OVERDUB_HPP
+#define OVERDUB_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "midi_recorder.hpp"
+#include "music_elements.hpp"
+#include "performance.hpp"
+#include "quantizer.hpp"
+#include "session_clock.hpp"
+#include "spsc_ring_buffer.hpp"
+
+// records into a pattern while the sequencer plays it: input is split into
+// passes (one time through the pattern), each pass is quantized and merged
+// into the pattern once it's over and the sequencer picks up the merged bars
+// at its next bar boundary, so what was just played is heard on the following
+// time round
+//
+// nothing here ever blocks the sequencer or the input thread: messages come
+// in through push() (meant for the recorder's drain thread) into a lock free
+// ring, quantizing, merging and parsing the new bars all happen on the
+// overdub thread and the result is handed over with
+// Sequencer::queue_pattern_bars_swap, the bars stay owned by this class until
+// the sequencer hands them back
+//
+// passes are counted from the clock's epoch, which has to be the sequencer's
+// (Sequencer::start_clock), and the song has to be a whole number of passes
+// long (Sequencer::align_song_length_to) so the pattern's first bar plays at
+// the start of every pass
+class Overdubber {
+public:
+  Overdubber(Sequencer &sequencer, std::shared_ptr<PatternBars> target,
+             const QuantizeSettings &settings, double latency_offset_sec = 0,
+             const PerformanceSettings &performance_settings = {});
+  ~Overdubber();
+
+  Overdubber(const Overdubber &) = delete;
+  Overdubber &operator=(const Overdubber &) = delete;
+
+  void start(const SessionClock &clock);
+  // merges what was played in the unfinished pass as well and joins the
+  // overdub thread
+  void stop();
+
+  // producer end, one thread only
+  void push(const CapturedMidiMessage &message);
+
+  // the pattern with everything merged so far, including a last pass the
+  // sequencer may not have picked up yet
+  std::shared_ptr<PatternBars> get_pattern_bars();
+
+  std::uint64_t get_num_passes_merged() const { return num_passes_merged; }
+  std::uint64_t get_num_notes_merged() const { return num_notes_merged; }
+  // messages that arrived after their pass had already been merged
+  std::uint64_t get_num_late() const { return num_late; }
+  // messages lost because the ring was full
+  std::uint64_t get_num_overflowed() const { return num_overflowed.load(); }
+
+private:
+  void run();
+  void take_messages();
+  void merge_pass(std::int64_t pass);
+  void release_retired_bars();
+
+  Sequencer &sequencer;
+  QuantizeSettings settings;
+  double latency_offset_sec;
+  PerformanceSettings performance_settings;
+  double pass_duration_sec;
+  int num_bars_per_pass;
+
+  SessionClock clock;
+  SpscRingBuffer<CapturedMidiMessage> ring{1 << 12};
+  std::atomic<std::uint64_t> num_overflowed{0};
+  std::atomic<bool> is_running{false};
+  std::thread overdub_thread;
+
+  // only touched by the overdub thread while it runs
+  std::vector<CapturedMidiMessage> pending;
+  std::int64_t next_pass = 0;
+  std::uint64_t num_passes_merged = 0;
+  std::uint64_t num_notes_merged = 0;
+  std::uint64_t num_late = 0;
+
+  // current is the newest merge, published holds every version the sequencer
+  // may still be playing
+  std::mutex current_mutex;
+  std::shared_ptr<PatternBars> current;
+  std::vector<std::shared_ptr<PatternBars>> published;
+};
+
+#endif // OVERDUB_HPP
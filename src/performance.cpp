@@ -0,0 +1,164 @@
+#include "performance.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+
+namespace {
+
+// every controller that is thinned out on its own: per channel 128 control
+// changes, pitch bend, channel pressure and 128 notes of poly pressure
+constexpr int lanes_per_channel = 128 + 1 + 1 + 128;
+constexpr int pitch_bend_lane = 128;
+constexpr int channel_pressure_lane = 129;
+constexpr int poly_pressure_lane = 130;
+
+struct ControllerLane {
+  bool has_kept = false;
+  double last_kept_sec = 0;
+  int last_kept_value = 0;
+  // the newest value that wasn't kept, still kept if nothing follows it
+  bool has_pending = false;
+  PerformanceControl pending;
+};
+
+} // namespace
+
+int PerformanceControl::value() const {
+  switch (type()) {
+  case 0xE0:
+    return data1 | (data2 << 7);
+  case 0xC0:
+  case 0xD0:
+    return data1;
+  default:
+    return data2;
+  }
+}
+
+Performance extract_performance(const std::vector<CapturedMidiMessage> &events,
+                                const PerformanceSettings &settings,
+                                double end_sec) {
+  Performance performance;
+  std::vector<std::int32_t> playing_notes(16 * 128, -1);
+  std::vector<ControllerLane> lanes(16 * lanes_per_channel);
+  std::size_t num_control_messages = 0;
+
+  auto end_note = [&](std::int32_t index, double time_sec,
+                      std::uint8_t release_velocity) {
+    PerformanceNote &note = performance.notes[index];
+    note.duration_sec = std::max(0.0, time_sec - note.start_sec);
+    note.release_velocity = release_velocity;
+  };
+
+  auto keep_control = [&](ControllerLane &lane,
+                          const PerformanceControl &control) {
+    performance.controls.push_back(control);
+    lane.has_kept = true;
+    lane.last_kept_sec = control.time_sec;
+    lane.last_kept_value = control.value();
+  };
+
+  double last_sec = 0;
+  for (std::size_t i = 0; i < events.size(); ++i) {
+    const CapturedMidiMessage &event = events[i];
+    if (event.size == 0)
+      continue;
+    last_sec = std::max(last_sec, event.timestamp_sec);
+
+    const std::uint8_t type = event.bytes[0] & 0xF0;
+    const std::uint8_t channel = event.bytes[0] & 0x0F;
+    const std::uint8_t data1 = event.size > 1 ? event.bytes[1] & 0x7F : 0;
+    const std::uint8_t data2 = event.size > 2 ? event.bytes[2] & 0x7F : 0;
+
+    if (type == 0x90 || type == 0x80) {
+      std::int32_t &playing = playing_notes[channel * 128 + data1];
+      const bool is_note_on = type == 0x90 && data2 > 0;
+      if (is_note_on) {
+        // a retriggered note ends the one before it
+        if (playing >= 0)
+          end_note(playing, event.timestamp_sec, 0);
+        playing = static_cast<std::int32_t>(performance.notes.size());
+        performance.notes.push_back({event.timestamp_sec, 0, channel, data1,
+                                     data2, 0, static_cast<std::uint32_t>(i)});
+      } else if (playing >= 0) {
+        end_note(playing, event.timestamp_sec, type == 0x80 ? data2 : 0);
+        playing = -1;
+      } else {
+        ++performance.num_unmatched_note_offs;
+      }
+      continue;
+    }
+
+    int lane_index;
+    if (type == 0xB0) {
+      lane_index = data1;
+    } else if (type == 0xE0) {
+      lane_index = pitch_bend_lane;
+    } else if (type == 0xD0) {
+      lane_index = channel_pressure_lane;
+    } else if (type == 0xA0) {
+      lane_index = poly_pressure_lane + data1;
+    } else if (type == 0xC0) {
+      // program changes are rare and every one matters
+      performance.controls.push_back(
+          {event.timestamp_sec, event.bytes[0], data1, 0});
+      continue;
+    } else {
+      continue;
+    }
+
+    ++num_control_messages;
+    ControllerLane &lane = lanes[channel * lanes_per_channel + lane_index];
+    const PerformanceControl control{event.timestamp_sec, event.bytes[0],
+                                     data1, data2};
+    // pitch bend is compared in 7 bit steps like everything else
+    const int scale = type == 0xE0 ? 128 : 1;
+
+    // the controller rested after the last burst, its final value stays
+    if (lane.has_pending && control.time_sec - lane.pending.time_sec >=
+                                settings.controller_min_interval_sec) {
+      keep_control(lane, lane.pending);
+      lane.has_pending = false;
+    }
+
+    const bool is_due = control.time_sec - lane.last_kept_sec >=
+                        settings.controller_min_interval_sec;
+    const bool has_moved =
+        std::abs(control.value() - lane.last_kept_value) >=
+        settings.controller_min_change * scale;
+    if (!lane.has_kept || (is_due && has_moved)) {
+      keep_control(lane, control);
+      lane.has_pending = false;
+    } else if (control.value() != lane.last_kept_value || lane.has_pending) {
+      lane.pending = control;
+      lane.has_pending = true;
+    }
+  }
+
+  for (ControllerLane &lane : lanes) {
+    if (lane.has_pending)
+      keep_control(lane, lane.pending);
+  }
+  // final values of bursts were added late
+  std::stable_sort(
+      performance.controls.begin(), performance.controls.end(),
+      [](const PerformanceControl &a, const PerformanceControl &b) {
+        return a.time_sec < b.time_sec;
+      });
+  performance.num_controls_dropped =
+      num_control_messages -
+      std::count_if(performance.controls.begin(), performance.controls.end(),
+                    [](const PerformanceControl &control) {
+                      return control.type() != 0xC0;
+                    });
+
+  end_sec = std::max(end_sec, last_sec);
+  for (std::int32_t playing : playing_notes) {
+    if (playing < 0)
+      continue;
+    end_note(playing, end_sec, 0);
+    ++performance.num_held_at_end;
+  }
+
+  return performance;
+}
@@ -0,0 +1,73 @@
+#ifndef PERFORMANCE_HPP
+#define PERFORMANCE_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include "midi_recorder.hpp"
+
+// how much of a controller stream is kept: knobs, mod wheels and pitch bend
+// send a message every few milliseconds while they move, which is far more
+// than playback needs
+struct PerformanceSettings {
+  // a controller value is only kept when at least this long has passed since
+  // the last one kept on the same controller...
+  double controller_min_interval_sec = 0.01;
+  // ...and it moved at least this much, 14 bit pitch bend is compared in 7
+  // bit steps
+  int controller_min_change = 1;
+};
+
+// a note with its length, paired up from a note on and its note off
+struct PerformanceNote {
+  double start_sec;
+  double duration_sec;
+  std::uint8_t channel; // 0 - 15
+  std::uint8_t note;
+  std::uint8_t velocity;
+  std::uint8_t release_velocity;
+  // index of the note on in the events the performance was made from
+  std::uint32_t event_index;
+};
+
+// a controller message that was kept: control change, pitch bend, channel or
+// poly pressure, or program change
+struct PerformanceControl {
+  double time_sec;
+  std::uint8_t status;
+  std::uint8_t data1;
+  std::uint8_t data2;
+
+  std::uint8_t type() const { return status & 0xF0; }
+  std::uint8_t channel() const { return status & 0x0F; }
+  // the 14 bit value for pitch bend, data2 (or data1 for one data byte
+  // messages) for the rest
+  int value() const;
+};
+
+// a take as notes with lengths plus thinned out controller streams, both in
+// time order, this is everything needed to play it back the way it was played
+struct Performance {
+  std::vector<PerformanceNote> notes;
+  std::vector<PerformanceControl> controls;
+  // note offs with no note playing, and notes still held when the take ended
+  // (they end with it)
+  std::size_t num_unmatched_note_offs = 0;
+  std::size_t num_held_at_end = 0;
+  std::size_t num_controls_dropped = 0;
+};
+
+// pairs every note on with the next note off of the same note on the same
+// channel through a table of playing notes (a note on for a note that is
+// already playing ends it first), events have to be in time order, notes
+// still held at the end last until end_sec, or the last event when end_sec is
+// earlier
+//
+// controller values are kept when they are far enough apart in both time and
+// value, and the last value of every burst is always kept (at its own time)
+// so a controller ends up where the player left it
+Performance extract_performance(const std::vector<CapturedMidiMessage> &events,
+                                const PerformanceSettings &settings = {},
+                                double end_sec = 0);
+
+#endif // PERFORMANCE_HPP
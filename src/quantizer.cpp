@@ -0,0 +1,186 @@
+#include "quantizer.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <stdexcept>
+
+namespace {
+
+bool is_note_on(const CapturedMidiMessage &event) {
+  return event.size == 3 && (event.bytes[0] & 0xF0) == 0x90 &&
+         event.bytes[2] > 0;
+}
+
+bool is_note_off(const CapturedMidiMessage &event) {
+  return event.size == 3 && ((event.bytes[0] & 0xF0) == 0x80 ||
+                             ((event.bytes[0] & 0xF0) == 0x90 &&
+                              event.bytes[2] == 0));
+}
+
+// where a note's channel and number go in a 16 * 128 table
+int note_key(const CapturedMidiMessage &event) {
+  return (event.bytes[0] & 0x0F) * 128 + (event.bytes[1] & 0x7F);
+}
+
+// the events are only ever moved by less than a step or so, which means that
+// after bucketing them by step they are almost in order and an insertion sort
+// finishes the job in close to one pass
+void sort_nearly_sorted(std::vector<CapturedMidiMessage> &events,
+                        double bucket_duration_sec) {
+  if (events.size() < 2)
+    return;
+
+  std::int64_t min_bucket = INT64_MAX;
+  std::int64_t max_bucket = INT64_MIN;
+  std::vector<std::int64_t> buckets(events.size());
+  for (std::size_t i = 0; i < events.size(); ++i) {
+    buckets[i] = static_cast<std::int64_t>(
+        std::floor(events[i].timestamp_sec / bucket_duration_sec));
+    min_bucket = std::min(min_bucket, buckets[i]);
+    max_bucket = std::max(max_bucket, buckets[i]);
+  }
+
+  // counting sort by bucket, stable so messages in the same bucket keep the
+  // order they arrived in
+  std::vector<std::uint32_t> counts(max_bucket - min_bucket + 2, 0);
+  for (std::int64_t bucket : buckets)
+    ++counts[bucket - min_bucket + 1];
+  for (std::size_t i = 1; i < counts.size(); ++i)
+    counts[i] += counts[i - 1];
+  std::vector<CapturedMidiMessage> sorted(events.size());
+  for (std::size_t i = 0; i < events.size(); ++i)
+    sorted[counts[buckets[i] - min_bucket]++] = events[i];
+
+  for (std::size_t i = 1; i < sorted.size(); ++i) {
+    CapturedMidiMessage event = sorted[i];
+    std::size_t j = i;
+    while (j > 0 && sorted[j - 1].timestamp_sec > event.timestamp_sec) {
+      sorted[j] = sorted[j - 1];
+      --j;
+    }
+    sorted[j] = event;
+  }
+
+  events.swap(sorted);
+}
+
+} // namespace
+
+double step_duration_sec(const QuantizeSettings &settings) {
+  double seconds_per_beat = 60.0 / settings.bpm;
+  double step = seconds_per_beat * 4.0 / settings.note_value;
+  switch (settings.feel) {
+  case GridFeel::straight:
+    return step;
+  case GridFeel::triplet:
+    return step * 2.0 / 3.0;
+  case GridFeel::dotted:
+    return step * 1.5;
+  }
+  return step;
+}
+
+double grid_time_sec(std::int64_t step, const QuantizeSettings &settings) {
+  double pair_duration = 2.0 * step_duration_sec(settings);
+  std::int64_t pair = step >= 0 ? step / 2 : (step - 1) / 2;
+  bool is_second_of_pair = step - pair * 2 == 1;
+  return pair * pair_duration +
+         (is_second_of_pair ? pair_duration * settings.swing_percent / 100.0
+                            : 0.0);
+}
+
+std::int64_t nearest_step(double time_sec, const QuantizeSettings &settings) {
+  // with swing the grid points aren't evenly spaced but they repeat every two
+  // steps, so find the pair first and then pick the closest of its three
+  // points
+  double pair_duration = 2.0 * step_duration_sec(settings);
+  double pair = std::floor(time_sec / pair_duration);
+  double offset = time_sec - pair * pair_duration;
+  double swung = pair_duration * settings.swing_percent / 100.0;
+
+  std::int64_t step = static_cast<std::int64_t>(pair) * 2;
+  if (offset < swung / 2)
+    return step;
+  if (offset < (swung + pair_duration) / 2)
+    return step + 1;
+  return step + 2;
+}
+
+QuantizedTake quantize(const std::vector<CapturedMidiMessage> &events,
+                       const QuantizeSettings &settings, int num_bars) {
+  if (settings.bpm <= 0 || settings.beats_per_bar <= 0 ||
+      settings.note_value <= 0) {
+    throw std::runtime_error(
+        "Quantizing needs a positive bpm, beats per bar and note value");
+  }
+  if (settings.swing_percent < 0 || settings.swing_percent >= 100) {
+    throw std::runtime_error("Swing has to be between 0 and 100 percent");
+  }
+
+  QuantizedTake take;
+  take.settings = settings;
+  take.step_duration_sec = step_duration_sec(settings);
+  take.events = events;
+
+  const double strength = settings.strength_percent / 100.0;
+  const double window_sec =
+      take.step_duration_sec * settings.window_percent / 100.0;
+
+  // how far each sounding note's note on was moved, per channel and note, so
+  // its note off can follow
+  std::array<double, 16 * 128> note_shift_sec{};
+
+  std::int64_t last_note_step = -1;
+  for (CapturedMidiMessage &event : take.events) {
+    if (is_note_on(event)) {
+      std::int64_t step = nearest_step(event.timestamp_sec, settings);
+      double distance = grid_time_sec(step, settings) - event.timestamp_sec;
+      double shift = 0;
+      if (std::abs(distance) <= window_sec) {
+        shift = distance * strength;
+        ++take.num_moved;
+      } else {
+        ++take.num_outside_window;
+      }
+      note_shift_sec[note_key(event)] = shift;
+      event.timestamp_sec += shift;
+      last_note_step = std::max(last_note_step, step);
+    } else if (is_note_off(event)) {
+      double &shift = note_shift_sec[note_key(event)];
+      event.timestamp_sec += shift;
+      shift = 0;
+    }
+  }
+
+  sort_nearly_sorted(take.events, take.step_duration_sec);
+
+  std::size_t num_steps = 0;
+  if (num_bars > 0) {
+    double steps_per_bar = settings.beats_per_bar * (60.0 / settings.bpm) /
+                           take.step_duration_sec;
+    num_steps =
+        static_cast<std::size_t>(std::ceil(num_bars * steps_per_bar - 1e-9));
+  } else {
+    num_steps = static_cast<std::size_t>(last_note_step + 1);
+  }
+
+  // the events are in time order now so the steps of the note ons never go
+  // down and the groups can be filled in one pass
+  take.step_offsets.assign(num_steps + 1, 0);
+  std::size_t current_step = 0;
+  for (std::size_t i = 0; i < take.events.size(); ++i) {
+    if (!is_note_on(take.events[i]))
+      continue;
+    std::int64_t step = nearest_step(take.events[i].timestamp_sec, settings);
+    if (step < 0 || static_cast<std::size_t>(step) >= num_steps)
+      continue;
+    while (current_step < static_cast<std::size_t>(step))
+      take.step_offsets[++current_step] = take.step_event_indices.size();
+    take.step_event_indices.push_back(static_cast<std::uint32_t>(i));
+  }
+  while (current_step < num_steps)
+    take.step_offsets[++current_step] = take.step_event_indices.size();
+
+  return take;
+}
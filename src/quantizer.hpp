@@ -0,0 +1,67 @@
+#ifndef QUANTIZER_HPP
+#define QUANTIZER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "midi_recorder.hpp"
+
+enum class GridFeel { straight, triplet, dotted };
+
+struct QuantizeSettings {
+  double bpm = 120.0;
+  int beats_per_bar = 4;
+  // the note value of one grid step with a quarter note beat, 4 for quarter
+  // notes, 8 for eighths, 16 for sixteenths...
+  int note_value = 16;
+  GridFeel feel = GridFeel::straight;
+  // where the second step of every pair of steps sits, as a percentage of the
+  // pair: 50 is straight and 66 is a triplet shuffle
+  double swing_percent = 50.0;
+  // how much of the distance to the grid a note is moved, 100 snaps it
+  double strength_percent = 100.0;
+  // notes further than this percentage of a step away from their grid point
+  // are considered intentional and left where they are
+  double window_percent = 100.0;
+};
+
+// seconds between two unswung grid steps
+double step_duration_sec(const QuantizeSettings &settings);
+// the time of grid step `step` including swing
+double grid_time_sec(std::int64_t step, const QuantizeSettings &settings);
+// the grid step closest to a time, can be negative for times before the start
+std::int64_t nearest_step(double time_sec, const QuantizeSettings &settings);
+
+// a quantized take: the moved events in time order plus the note ons grouped
+// by the step they belong to, stored flat (csr style) so a take costs two
+// arrays however long it is, the note ons of step s are
+// events[step_event_indices[i]] for i in [step_offsets[s], step_offsets[s + 1])
+struct QuantizedTake {
+  QuantizeSettings settings;
+  double step_duration_sec = 0;
+  std::vector<CapturedMidiMessage> events;
+  std::vector<std::uint32_t> step_offsets;
+  std::vector<std::uint32_t> step_event_indices;
+  // note ons that were moved and ones that were outside the window
+  std::size_t num_moved = 0;
+  std::size_t num_outside_window = 0;
+
+  std::size_t num_steps() const {
+    return step_offsets.empty() ? 0 : step_offsets.size() - 1;
+  }
+  std::size_t step_begin(std::size_t step) const { return step_offsets[step]; }
+  std::size_t step_end(std::size_t step) const {
+    return step_offsets[step + 1];
+  }
+};
+
+// moves note ons towards the grid and their note offs by the same amount so
+// notes keep their length, other messages keep their time, the grid covers
+// num_bars bars (or up to the last note when it is 0) and note ons past it are
+// kept in events but aren't assigned a step, linear in the number of events
+// when they come in time order like the recorder produces them
+QuantizedTake quantize(const std::vector<CapturedMidiMessage> &events,
+                       const QuantizeSettings &settings, int num_bars = 0);
+
+#endif // QUANTIZER_HPP
@@ -0,0 +1,29 @@
+#ifndef SESSION_CLOCK_HPP
+#define SESSION_CLOCK_HPP
+
+#include <chrono>
+
+// the one time origin shared by everything that happens during a session, the
+// metronome schedules its clicks from it and the recorder stamps input against
+// it, so a recorded time of 2.0 means "two seconds after the first click"
+// whatever thread produced it
+struct SessionClock {
+  using clock = std::chrono::steady_clock;
+
+  clock::time_point epoch = clock::now();
+
+  void restart() { epoch = clock::now(); }
+
+  double seconds_at(clock::time_point time_point) const {
+    return std::chrono::duration<double>(time_point - epoch).count();
+  }
+
+  double now_sec() const { return seconds_at(clock::now()); }
+
+  clock::time_point time_point_at(double seconds) const {
+    return epoch + std::chrono::duration_cast<clock::duration>(
+                       std::chrono::duration<double>(seconds));
+  }
+};
+
+#endif // SESSION_CLOCK_HPP
@@ -0,0 +1,61 @@
+#ifndef SIMD_HPP
+#define SIMD_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// four floats worked on as one with the gcc/clang vector extensions, this
+// compiles to sse on x86 and neon on arm without intrinsics for either, and
+// operators mix with plain floats (x * 2.0f scales every lane)
+using float4 = float __attribute__((vector_size(16)));
+using int4 = std::int32_t __attribute__((vector_size(16)));
+
+inline float4 abs4(float4 x) {
+  return reinterpret_cast<float4>(reinterpret_cast<int4>(x) & 0x7fffffff);
+}
+
+// a comparison gives -1 for true and 0 for false in every lane, as floats
+inline float4 mask_to_float(int4 mask) {
+  return __builtin_convertvector(mask, float4);
+}
+
+inline float sum4(float4 x) { return (x[0] + x[1]) + (x[2] + x[3]); }
+
+inline float4 load4(const float *source) {
+  float4 x;
+  std::memcpy(&x, source, sizeof(x));
+  return x;
+}
+
+inline void store4(float *destination, float4 x) {
+  std::memcpy(destination, &x, sizeof(x));
+}
+
+// destination[i] += source[i] * gain, neither has to be aligned
+inline void mix_into(float *destination, const float *source, std::size_t size,
+                     float gain = 1.0f) {
+  std::size_t i = 0;
+  for (; i + 4 <= size; i += 4)
+    store4(destination + i, load4(destination + i) + load4(source + i) * gain);
+  for (; i < size; ++i)
+    destination[i] += source[i] * gain;
+}
+
+// the same for interleaved stereo, the left and right samples get their own
+// gain
+inline void mix_into_stereo(float *destination, const float *source,
+                            std::size_t num_frames, float gain_left,
+                            float gain_right) {
+  const float4 gain = {gain_left, gain_right, gain_left, gain_right};
+  const std::size_t size = 2 * num_frames;
+  std::size_t i = 0;
+  for (; i + 4 <= size; i += 4)
+    store4(destination + i, load4(destination + i) + load4(source + i) * gain);
+  for (; i < size; i += 2) {
+    destination[i] += source[i] * gain_left;
+    destination[i + 1] += source[i + 1] * gain_right;
+  }
+}
+
+#endif // SIMD_HPP
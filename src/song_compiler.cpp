@@ -0,0 +1,92 @@
+#include "song_compiler.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+CompiledPatterns compile_patterns(const JamFileData &jam_data) {
+  CompiledPatterns patterns;
+  patterns.bpm = jam_data.bpm;
+
+  for (const auto &[pattern_name, bars] : jam_data.pattern_name_to_bars) {
+    auto channel_it = jam_data.pattern_name_to_channel.find(pattern_name);
+    unsigned int channel =
+        channel_it == jam_data.pattern_name_to_channel.end()
+            ? 1
+            : channel_it->second;
+    patterns.pattern_name_to_pattern.emplace(
+        pattern_name, Pattern(bars, channel, jam_data.bpm, false));
+  }
+
+  return patterns;
+}
+
+CompiledSong compile_song(const CompiledPatterns &patterns,
+                          const std::vector<PatternData> &arrangement) {
+  CompiledSong song;
+  song.bpm = patterns.bpm;
+  song.num_bars = 0;
+
+  // a bar lasts one beat, see Bar
+  const double bar_duration_sec = 60.0 / patterns.bpm;
+
+  for (const PatternData &placement : arrangement) {
+    auto it = patterns.pattern_name_to_pattern.find(placement.name);
+    if (it == patterns.pattern_name_to_pattern.end()) {
+      throw std::runtime_error("Arrangement uses unknown pattern: " +
+                               placement.name);
+    }
+
+    const Pattern &pattern = it->second;
+    if (pattern.bars->empty())
+      continue;
+
+    const std::vector<Bar> &bars = pattern.bars->compile();
+    const unsigned int num_bars = static_cast<unsigned int>(bars.size());
+    const unsigned int end_bar =
+        placement.start_bar + std::max(placement.num_repeats, 1u) * num_bars;
+    song.num_bars = std::max(song.num_bars, end_bar);
+
+    for (unsigned int bar_index = placement.start_bar; bar_index < end_bar;
+         ++bar_index) {
+      // the sequencer picks bars by the global bar index, do the same so the
+      // compiled song sounds like live playback
+      const Bar &bar = bars[bar_index % num_bars];
+      const double bar_start_sec = bar_index * bar_duration_sec;
+
+      for (const MidiEventNext &note_on : bar.note_on_midi_events) {
+        const auto channel_nibble =
+            static_cast<std::uint8_t>((note_on.channel - 1) & 0x0F);
+        const auto note = static_cast<std::uint8_t>(note_on.note & 0x7F);
+        const double on_sec =
+            bar_start_sec + note_on.bar_time_offset_sec.count();
+
+        song.events.push_back(
+            {on_sec, static_cast<std::uint8_t>(0x90 | channel_nibble), note,
+             static_cast<std::uint8_t>(note_on.midi_velocity)});
+        song.events.push_back(
+            {on_sec + note_on.duration_sec.count(),
+             static_cast<std::uint8_t>(0x80 | channel_nibble), note, 0});
+      }
+
+      for (const BarControlEvent &control : bar.control_events) {
+        song.events.push_back(
+            {bar_start_sec + control.bar_time_offset_sec.count(),
+             control.status, control.data1, control.data2});
+      }
+    }
+  }
+
+  song.duration_sec = song.num_bars * bar_duration_sec;
+
+  // note offs and controllers go first when they land on the same time as a
+  // note on so a retriggered note isn't cut off straight away and a note
+  // starts with the bend it was played with
+  std::stable_sort(song.events.begin(), song.events.end(),
+                   [](const TimedMidiEvent &a, const TimedMidiEvent &b) {
+                     if (a.time_sec != b.time_sec)
+                       return a.time_sec < b.time_sec;
+                     return !a.is_note_on() && b.is_note_on();
+                   });
+
+  return song;
+}
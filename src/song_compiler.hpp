@@ -0,0 +1,44 @@
+#ifndef SONG_COMPILER_HPP
+#define SONG_COMPILER_HPP
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "jam_file_parsing.hpp"
+#include "music_elements.hpp"
+
+// a raw midi message at an absolute time from the start of the song
+struct TimedMidiEvent {
+  double time_sec;
+  std::uint8_t status; // message type in the high nibble, channel - 1 in the
+                       // low one
+  std::uint8_t data1;
+  std::uint8_t data2;
+
+  bool is_note_on() const { return (status & 0xF0) == 0x90 && data2 > 0; }
+};
+
+// every pattern of a jam file turned into bars once, nothing here depends on
+// the arrangement so one instance is shared read only by every arrangement
+// compiled from the same file
+struct CompiledPatterns {
+  unsigned int bpm;
+  std::unordered_map<std::string, Pattern> pattern_name_to_pattern;
+};
+
+// the whole song flattened into a time sorted list of midi messages, this is
+// what the sequencer would send if it played the arrangement through once
+struct CompiledSong {
+  unsigned int bpm;
+  unsigned int num_bars;
+  double duration_sec;
+  std::vector<TimedMidiEvent> events;
+};
+
+CompiledPatterns compile_patterns(const JamFileData &jam_data);
+CompiledSong compile_song(const CompiledPatterns &patterns,
+                          const std::vector<PatternData> &arrangement);
+
+#endif // SONG_COMPILER_HPP
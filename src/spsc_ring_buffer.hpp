@@ -0,0 +1,99 @@
+#ifndef SPSC_RING_BUFFER_HPP
+#define SPSC_RING_BUFFER_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+
+// a bounded single producer single consumer queue, one thread may push and
+// one other thread may pop at the same time without locks, pushing and popping
+// never allocate (all storage is made up front) so both ends are safe to use
+// from realtime threads like midi input and audio callbacks
+template <typename T> class SpscRingBuffer {
+  static_assert(std::is_trivially_copyable<T>::value,
+                "ring buffer slots are copied with plain assignment");
+
+public:
+  // the capacity is rounded up to a power of two
+  explicit SpscRingBuffer(std::size_t min_capacity) {
+    std::size_t capacity = 2;
+    while (capacity < min_capacity)
+      capacity <<= 1;
+    mask = capacity - 1;
+    slots = std::make_unique<T[]>(capacity);
+  }
+
+  SpscRingBuffer(const SpscRingBuffer &) = delete;
+  SpscRingBuffer &operator=(const SpscRingBuffer &) = delete;
+
+  // producer only, false when the buffer is full
+  bool try_push(const T &value) {
+    const std::size_t tail = write_index.load(std::memory_order_relaxed);
+    if (tail - cached_read_index > mask) {
+      cached_read_index = read_index.load(std::memory_order_acquire);
+      if (tail - cached_read_index > mask)
+        return false;
+    }
+    slots[tail & mask] = value;
+    write_index.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // consumer only, false when the buffer is empty
+  bool try_pop(T &value) {
+    const std::size_t head = read_index.load(std::memory_order_relaxed);
+    if (head == cached_write_index) {
+      cached_write_index = write_index.load(std::memory_order_acquire);
+      if (head == cached_write_index)
+        return false;
+    }
+    value = slots[head & mask];
+    read_index.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  // consumer only, the oldest element without removing it
+  const T *peek() {
+    const std::size_t head = read_index.load(std::memory_order_relaxed);
+    if (head == cached_write_index) {
+      cached_write_index = write_index.load(std::memory_order_acquire);
+      if (head == cached_write_index)
+        return nullptr;
+    }
+    return &slots[head & mask];
+  }
+
+  // consumer only, drops the oldest element without copying it out (for big
+  // elements read through peek), false when the buffer is empty
+  bool try_discard() {
+    if (!peek())
+      return false;
+    read_index.store(read_index.load(std::memory_order_relaxed) + 1,
+                     std::memory_order_release);
+    return true;
+  }
+
+  // only exact when called from one of the two ends while the other is idle
+  std::size_t size() const {
+    return write_index.load(std::memory_order_acquire) -
+           read_index.load(std::memory_order_acquire);
+  }
+
+  std::size_t capacity() const { return mask + 1; }
+
+private:
+  std::unique_ptr<T[]> slots;
+  std::size_t mask;
+
+  // the two ends live on separate cache lines so the producer and the
+  // consumer don't keep stealing the line from each other, each end also
+  // keeps its own copy of the other end's index and only reloads it when the
+  // buffer looks full (or empty)
+  alignas(64) std::atomic<std::size_t> write_index{0};
+  std::size_t cached_read_index = 0;
+  alignas(64) std::atomic<std::size_t> read_index{0};
+  std::size_t cached_write_index = 0;
+};
+
+#endif // SPSC_RING_BUFFER_HPP
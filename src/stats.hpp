@@ -0,0 +1,49 @@
+#ifndef STATS_HPP
+#define STATS_HPP
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <ostream>
+
+// count, mean, spread and extremes of a stream of samples using welford's
+// update, constant memory and no allocation so it can be fed from anywhere,
+// not thread safe
+struct RunningStats {
+  std::uint64_t count = 0;
+  double mean = 0;
+  double min = std::numeric_limits<double>::infinity();
+  double max = -std::numeric_limits<double>::infinity();
+
+  void add(double sample) {
+    ++count;
+    double delta = sample - mean;
+    mean += delta / count;
+    sum_of_squared_deviations += delta * (sample - mean);
+    if (sample < min)
+      min = sample;
+    if (sample > max)
+      max = sample;
+  }
+
+  double variance() const {
+    return count > 1 ? sum_of_squared_deviations / (count - 1) : 0.0;
+  }
+  double stddev() const { return std::sqrt(variance()); }
+
+  // prints the stats of samples measured in seconds as milliseconds
+  void print_ms(std::ostream &os) const {
+    if (count == 0) {
+      os << "no samples";
+      return;
+    }
+    os << "mean " << mean * 1e3 << " ms, stddev " << stddev() * 1e3
+       << " ms, min " << min * 1e3 << " ms, max " << max * 1e3 << " ms over "
+       << count << " samples";
+  }
+
+private:
+  double sum_of_squared_deviations = 0;
+};
+
+#endif // STATS_HPP
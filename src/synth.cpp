@@ -0,0 +1,505 @@
+#include "synth.hpp"
+
+#include <cmath>
+#include <stdexcept>
+
+#include "miniaudio/miniaudio.h"
+
+namespace {
+
+// the attack heads for a little over full level so it gets there in its time
+// instead of creeping up on it
+constexpr float attack_overshoot = 1.2f;
+// -80 dB, a voice this quiet in its release is done
+constexpr float silence = 1e-4f;
+constexpr float pitch_bend_range_semitones = 2;
+
+// how much a one pole filter moves per sample to cover most of the way to its
+// target in time_sec, scaled by ln(1 / what's left)
+float one_pole_coefficient(double time_sec, double log_remaining,
+                           double sample_rate) {
+  const double tau = std::max(time_sec, 0.001) / log_remaining;
+  return static_cast<float>(1 - std::exp(-1 / (tau * sample_rate)));
+}
+
+} // namespace
+
+const std::vector<SynthProgram> &synth_programs() {
+  static const std::vector<SynthProgram> programs = {
+      // name, saw, square, triangle, sine, brightness, attack, decay,
+      // sustain, release, gain
+      {"keys", 0.3f, 0.0f, 0.4f, 0.3f, 0.6f, 0.005f, 0.6f, 0.4f, 0.3f, 0.5f},
+      {"bass", 0.6f, 0.2f, 0.0f, 0.2f, 0.35f, 0.003f, 0.25f, 0.6f, 0.08f,
+       0.7f},
+      {"lead", 0.5f, 0.5f, 0.0f, 0.0f, 0.8f, 0.01f, 0.2f, 0.7f, 0.15f, 0.4f},
+      {"pad", 0.4f, 0.0f, 0.4f, 0.2f, 0.45f, 0.4f, 1.0f, 0.8f, 1.2f, 0.35f},
+      {"pluck", 0.5f, 0.0f, 0.5f, 0.0f, 0.7f, 0.002f, 0.18f, 0.0f, 0.1f,
+       0.6f},
+      {"organ", 0.0f, 0.2f, 0.0f, 0.8f, 0.5f, 0.01f, 0.05f, 1.0f, 0.05f,
+       0.35f},
+      {"perc", 0.0f, 0.3f, 0.0f, 0.7f, 0.9f, 0.001f, 0.12f, 0.0f, 0.05f,
+       0.8f},
+  };
+  return programs;
+}
+
+int find_synth_program(const std::string &name) {
+  const std::vector<SynthProgram> &programs = synth_programs();
+  for (std::size_t i = 0; i < programs.size(); ++i) {
+    if (programs[i].name == name)
+      return static_cast<int>(i);
+  }
+  return -1;
+}
+
+// what miniaudio reads the synth through, the base has to come first
+struct SynthSoundSource {
+  ma_data_source_base base;
+  Synth *synth;
+  ma_sound sound;
+};
+
+namespace {
+
+ma_result read_synth(ma_data_source *data_source, void *frames_out,
+                     ma_uint64 frame_count, ma_uint64 *frames_read) {
+  auto *source = static_cast<SynthSoundSource *>(data_source);
+  source->synth->render(static_cast<float *>(frames_out),
+                        static_cast<std::uint32_t>(frame_count));
+  if (frames_read)
+    *frames_read = frame_count;
+  return MA_SUCCESS;
+}
+
+ma_result get_synth_data_format(ma_data_source *data_source, ma_format *format,
+                                ma_uint32 *num_channels, ma_uint32 *sample_rate,
+                                ma_channel *channel_map,
+                                size_t channel_map_capacity) {
+  auto *source = static_cast<SynthSoundSource *>(data_source);
+  *format = ma_format_f32;
+  *num_channels = 2;
+  *sample_rate = static_cast<ma_uint32>(source->synth->get_sample_rate());
+  ma_channel_map_init_standard(ma_standard_channel_map_default, channel_map,
+                               channel_map_capacity, 2);
+  return MA_SUCCESS;
+}
+
+// the synth never ends and can't be seeked
+ma_data_source_vtable synth_vtable = {
+    read_synth, NULL, get_synth_data_format, NULL, NULL, NULL, 0,
+};
+
+} // namespace
+
+Synth::Synth(double sample_rate) : sample_rate(sample_rate) {
+  for (const SynthProgram &program : synth_programs()) {
+    ProgramCoefficients coefficients;
+    coefficients.saw = program.saw;
+    coefficients.square = program.square;
+    coefficients.triangle = program.triangle;
+    coefficients.sine = program.sine;
+    // brightness 0 - 1 is a cutoff of 200 Hz to 25 kHz
+    const double cutoff_hz = 200 * std::exp2(7 * program.brightness);
+    coefficients.low_pass = static_cast<float>(
+        std::min(1.0, 1 - std::exp(-2 * M_PI * cutoff_hz / sample_rate)));
+    coefficients.attack = one_pole_coefficient(
+        program.attack_sec,
+        std::log(attack_overshoot / (attack_overshoot - 1)), sample_rate);
+    coefficients.decay =
+        one_pole_coefficient(program.decay_sec, std::log(20.0), sample_rate);
+    coefficients.sustain = program.sustain;
+    coefficients.release = one_pole_coefficient(
+        program.release_sec, std::log(1 / silence), sample_rate);
+    coefficients.gain = program.gain;
+    programs.push_back(coefficients);
+  }
+
+  // drums on channel 10 like general midi
+  const int perc = find_synth_program("perc");
+  if (perc >= 0)
+    channels[9].program = perc;
+}
+
+Synth::~Synth() { detach(); }
+
+bool Synth::send(std::uint8_t status, std::uint8_t data1, std::uint8_t data2) {
+  if (messages.try_push({status, data1, data2}))
+    return true;
+  num_dropped_messages.fetch_add(1, std::memory_order_relaxed);
+  return false;
+}
+
+void Synth::set_drum_kit(std::shared_ptr<const DrumKit> kit) {
+  if (kit && kit->sample_rate != sample_rate) {
+    throw std::runtime_error(
+        "The drum kit has to be loaded at the synth's sample rate");
+  }
+  drum_kit = std::move(kit);
+}
+
+bool Synth::set_program(int channel, int program) {
+  if (channel < 1 || channel > 16 || program < 0)
+    return false;
+  return send(static_cast<std::uint8_t>(0xC0 | (channel - 1)),
+              static_cast<std::uint8_t>(program & 0x7F));
+}
+
+void Synth::attach(ma_engine &engine) {
+  if (sound_source)
+    return;
+  if (ma_engine_get_sample_rate(&engine) != sample_rate) {
+    throw std::runtime_error(
+        "The synth has to run at the audio engine's sample rate");
+  }
+
+  auto source = std::make_unique<SynthSoundSource>();
+  source->synth = this;
+  ma_data_source_config config = ma_data_source_config_init();
+  config.vtable = &synth_vtable;
+  if (ma_data_source_init(&config, &source->base) != MA_SUCCESS)
+    throw std::runtime_error("Could not set up the synth's data source");
+  if (ma_sound_init_from_data_source(&engine, &source->base,
+                                     MA_SOUND_FLAG_NO_SPATIALIZATION |
+                                         MA_SOUND_FLAG_NO_PITCH,
+                                     NULL, &source->sound) != MA_SUCCESS) {
+    ma_data_source_uninit(&source->base);
+    throw std::runtime_error("Could not connect the synth to the engine");
+  }
+  ma_sound_start(&source->sound);
+  sound_source = std::move(source);
+}
+
+void Synth::detach() {
+  if (!sound_source)
+    return;
+  ma_sound_uninit(&sound_source->sound);
+  ma_data_source_uninit(&sound_source->base);
+  sound_source.reset();
+}
+
+void Synth::render(float *frames, std::uint32_t num_frames) {
+  frame_clock.publish(num_frames_rendered, FrameClock::clock::now());
+
+  Message message;
+  while (messages.try_pop(message))
+    handle_message(message);
+
+  while (num_frames > 0) {
+    std::uint32_t block = std::min(num_frames, block_frames);
+    if (event_source) {
+      event_source->dispatch_due_events(num_frames_rendered, *this);
+      const std::uint64_t next_event = event_source->next_event_frame();
+      if (next_event - num_frames_rendered < block)
+        block = static_cast<std::uint32_t>(next_event - num_frames_rendered);
+    }
+    update_voices();
+    render_block(frames, block);
+    if (drum_kit)
+      mix_samples(frames, block);
+    frames += 2 * block;
+    num_frames -= block;
+    num_frames_rendered += block;
+  }
+}
+
+void Synth::handle_event(std::uint8_t status, std::uint8_t data1,
+                         std::uint8_t data2) {
+  handle_message({status, data1, data2});
+}
+
+void Synth::handle_message(const Message &message) {
+  const int channel = message.status & 0x0F;
+  switch (message.status & 0xF0) {
+  case 0x90:
+    if (message.data2 > 0) {
+      const DrumSample *sample =
+          drum_kit && drum_kit->plays_on_channel[channel]
+              ? drum_kit->samples[message.data1 & 0x7F].get()
+              : nullptr;
+      if (sample)
+        play_sample(channel, message.data1, *sample, message.data2);
+      else
+        note_on(channel, message.data1, message.data2);
+      break;
+    }
+    [[fallthrough]];
+  case 0x80:
+    note_off(channel, message.data1);
+    break;
+  case 0xB0:
+    control_change(channel, message.data1, message.data2);
+    break;
+  case 0xC0:
+    channels[channel].program =
+        message.data1 % static_cast<int>(programs.size());
+    break;
+  case 0xE0: {
+    const int bend = (message.data1 | (message.data2 << 7)) - 8192;
+    channels[channel].bend_ratio = static_cast<float>(
+        std::exp2(bend / 8192.0 * pitch_bend_range_semitones / 12));
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+void Synth::set_voice_policy(const VoicePolicy &policy) {
+  voice_allocator.set_policy(policy);
+  VoicePolicy sample_policy = policy;
+  sample_policy.retrigger_same_note = false;
+  sample_voice_allocator.set_policy(sample_policy);
+}
+
+VoiceStats Synth::get_voice_stats() const {
+  VoiceStats stats = voice_allocator.get_stats();
+  stats += sample_voice_allocator.get_stats();
+  return stats;
+}
+
+void Synth::note_on(int channel, int note, int velocity) {
+  VoiceAllocator<max_voices>::Reuse reuse;
+  const int voice = voice_allocator.allocate(channel, note, reuse);
+  const int group = voice / 4;
+  const int lane = voice % 4;
+  const int program = channels[channel].program;
+  const ProgramCoefficients &coefficients = programs[program];
+
+  stage[voice] = Stage::attack;
+  voice_channel[voice] = static_cast<std::uint8_t>(channel);
+  voice_note[voice] = static_cast<std::uint8_t>(note);
+  voice_program[voice] = static_cast<std::uint8_t>(program);
+  is_sustained[voice] = false;
+  const float level = velocity / 127.0f;
+  velocity_gain[voice] = level * level * coefficients.gain;
+  base_increment[voice] = static_cast<float>(
+      440 * std::exp2((note - 69) / 12.0) / sample_rate);
+
+  // a stolen or retriggered voice keeps its level and phase and attacks from
+  // there, which doesn't click
+  saw[group][lane] = coefficients.saw;
+  square[group][lane] = coefficients.square;
+  triangle[group][lane] = coefficients.triangle;
+  sine[group][lane] = coefficients.sine;
+  low_pass[group][lane] = coefficients.low_pass;
+  envelope_target[group][lane] = attack_overshoot;
+  envelope_coefficient[group][lane] = coefficients.attack;
+}
+
+void Synth::play_sample(int channel, int note, const DrumSample &sample,
+                        int velocity) {
+  VoiceAllocator<max_sample_voices>::Reuse reuse;
+  SampleVoice &voice =
+      sample_voices[sample_voice_allocator.allocate(channel, note, reuse)];
+  voice.sample = &sample;
+  voice.position = 0;
+  voice.velocity_gain = velocity / 127.0f;
+  voice.channel = static_cast<std::uint8_t>(channel);
+}
+
+void Synth::note_off(int channel, int note) {
+  for (int voice = 0; voice < max_voices; ++voice) {
+    if (voice_channel[voice] != channel || voice_note[voice] != note ||
+        (stage[voice] != Stage::attack && stage[voice] != Stage::decay))
+      continue;
+    if (channels[channel].sustain_pedal)
+      is_sustained[voice] = true;
+    else
+      release_voice(voice);
+  }
+}
+
+void Synth::control_change(int channel, int controller, int value) {
+  Channel &state = channels[channel];
+  switch (controller) {
+  case 7:
+    state.volume = value / 127.0f;
+    break;
+  case 10:
+    state.pan = value / 127.0f;
+    break;
+  case 11:
+    state.expression = value / 127.0f;
+    break;
+  case 64:
+    state.sustain_pedal = value >= 64;
+    if (!state.sustain_pedal) {
+      for (int voice = 0; voice < max_voices; ++voice) {
+        if (voice_channel[voice] == channel && is_sustained[voice])
+          release_voice(voice);
+      }
+    }
+    break;
+  case 120: // all sound off
+    for (int voice = 0; voice < max_voices; ++voice) {
+      if (voice_channel[voice] == channel && stage[voice] != Stage::idle)
+        free_voice(voice);
+    }
+    for (int voice = 0; voice < max_sample_voices; ++voice) {
+      if (sample_voices[voice].channel == channel) {
+        sample_voices[voice].sample = nullptr;
+        sample_voice_allocator.release(voice);
+      }
+    }
+    break;
+  case 121: // reset all controllers
+    state.volume = 100 / 127.0f;
+    state.expression = 1;
+    state.pan = 0.5f;
+    state.bend_ratio = 1;
+    control_change(channel, 64, 0);
+    break;
+  case 123: // all notes off
+    for (int voice = 0; voice < max_voices; ++voice) {
+      if (voice_channel[voice] == channel && stage[voice] != Stage::idle &&
+          stage[voice] != Stage::release)
+        release_voice(voice);
+    }
+    break;
+  default:
+    break;
+  }
+}
+
+void Synth::release_voice(int voice) {
+  const int group = voice / 4;
+  const int lane = voice % 4;
+  stage[voice] = Stage::release;
+  is_sustained[voice] = false;
+  envelope_target[group][lane] = 0;
+  envelope_coefficient[group][lane] = programs[voice_program[voice]].release;
+}
+
+void Synth::free_voice(int voice) {
+  const int group = voice / 4;
+  const int lane = voice % 4;
+  stage[voice] = Stage::idle;
+  is_sustained[voice] = false;
+  voice_allocator.release(voice);
+  envelope[group][lane] = 0;
+  envelope_target[group][lane] = 0;
+  low_pass_state[group][lane] = 0;
+  gain_left[group][lane] = 0;
+  gain_right[group][lane] = 0;
+}
+
+// moves envelopes on to their next stage and follows the channel controllers,
+// once a block
+void Synth::update_voices() {
+  int num_playing = 0;
+  for (int group = 0; group < num_groups; ++group)
+    group_is_playing[group] = false;
+  voice_allocator.begin_levels();
+
+  for (int voice = 0; voice < max_voices; ++voice) {
+    if (stage[voice] == Stage::idle)
+      continue;
+    const int group = voice / 4;
+    const int lane = voice % 4;
+    const ProgramCoefficients &coefficients = programs[voice_program[voice]];
+    const float level = envelope[group][lane];
+
+    if (stage[voice] == Stage::attack && level >= 1) {
+      stage[voice] = Stage::decay;
+      envelope[group][lane] = 1;
+      envelope_target[group][lane] = coefficients.sustain;
+      envelope_coefficient[group][lane] = coefficients.decay;
+    } else if (stage[voice] != Stage::attack &&
+               envelope_target[group][lane] == 0 && level < silence) {
+      free_voice(voice);
+      continue;
+    }
+
+    const Channel &channel = channels[voice_channel[voice]];
+    const float gain =
+        velocity_gain[voice] * channel.volume * channel.expression;
+    // equal power pan
+    const float angle = channel.pan * static_cast<float>(M_PI / 2);
+    gain_left[group][lane] = gain * std::cos(angle);
+    gain_right[group][lane] = gain * std::sin(angle);
+    increment[group][lane] = base_increment[voice] * channel.bend_ratio;
+    // a note still in its attack is about to be loud, it shouldn't be the
+    // first to go because it started low
+    voice_allocator.set_level(
+        voice, gain * (stage[voice] == Stage::attack ? 1 : level));
+
+    group_is_playing[group] = true;
+    ++num_playing;
+  }
+  num_playing_voices.store(num_playing, std::memory_order_relaxed);
+}
+
+void Synth::render_block(float *frames, std::uint32_t num_frames) {
+  // every group adds its four voices into these lane by lane, the lanes are
+  // only summed once per frame at the end
+  float4 left[block_frames] = {};
+  float4 right[block_frames] = {};
+
+  for (int group = 0; group < num_groups; ++group) {
+    if (!group_is_playing[group])
+      continue;
+    float4 p = phase[group];
+    float4 filtered = low_pass_state[group];
+    float4 level = envelope[group];
+    const float4 step = increment[group];
+    const float4 target = envelope_target[group];
+    const float4 coefficient = envelope_coefficient[group];
+    const float4 cutoff = low_pass[group];
+
+    for (std::uint32_t frame = 0; frame < num_frames; ++frame) {
+      p += step;
+      p += mask_to_float(p >= 1.0f);
+
+      // y runs from 1 down to -1 over a cycle, sin(2 pi p) = sin(pi y) which
+      // a parabola with a correction gets within 0.1% of
+      const float4 y = 1.0f - 2.0f * p;
+      const float4 abs_y = abs4(y);
+      const float4 parabola = 4.0f * y * (1.0f - abs_y);
+      const float4 wave =
+          saw[group] * (2.0f * p - 1.0f) +
+          square[group] * (1.0f + 2.0f * mask_to_float(p >= 0.5f)) +
+          triangle[group] * (2.0f * abs_y - 1.0f) +
+          sine[group] *
+              (0.225f * (parabola * abs4(parabola) - parabola) + parabola);
+
+      filtered += (wave - filtered) * cutoff;
+      level += (target - level) * coefficient;
+      const float4 out = filtered * level;
+      left[frame] += out * gain_left[group];
+      right[frame] += out * gain_right[group];
+    }
+
+    phase[group] = p;
+    low_pass_state[group] = filtered;
+    envelope[group] = level;
+  }
+
+  for (std::uint32_t frame = 0; frame < num_frames; ++frame) {
+    frames[2 * frame] = sum4(left[frame]);
+    frames[2 * frame + 1] = sum4(right[frame]);
+  }
+}
+
+// samples are mixed straight into the output, a stereo frame at a time with
+// the channel's level and pan applied per block like the synth voices
+void Synth::mix_samples(float *frames, std::uint32_t num_frames) {
+  for (int index = 0; index < max_sample_voices; ++index) {
+    SampleVoice &voice = sample_voices[index];
+    if (!voice.sample)
+      continue;
+    const Channel &channel = channels[voice.channel];
+    const float gain =
+        voice.velocity_gain * channel.volume * channel.expression;
+    const float angle = channel.pan * static_cast<float>(M_PI / 2);
+    const std::uint64_t num_left = voice.sample->num_frames - voice.position;
+    const auto num_mixed = static_cast<std::uint32_t>(
+        std::min<std::uint64_t>(num_frames, num_left));
+    mix_into_stereo(frames, voice.sample->frames() + 2 * voice.position,
+                    num_mixed, gain * std::cos(angle), gain * std::sin(angle));
+    voice.position += num_mixed;
+    if (voice.position >= voice.sample->num_frames) {
+      voice.sample = nullptr;
+      sample_voice_allocator.release(index);
+    }
+  }
+}
@@ -0,0 +1,214 @@
+#ifndef SYNTH_HPP
+#define SYNTH_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "drum_kit.hpp"
+#include "frame_clock.hpp"
+#include "simd.hpp"
+#include "spsc_ring_buffer.hpp"
+#include "voice_allocator.hpp"
+
+struct ma_engine;
+struct SynthSoundSource;
+
+class Synth;
+
+// a schedule the synth pulls events from on the audio thread, timed in frames
+// of the synth's own clock (frames rendered since it started), render() stops
+// on every event's frame so each one starts on the sample it is due
+class SynthEventSource {
+public:
+  virtual ~SynthEventSource() = default;
+  // the frame the next event is due on
+  virtual std::uint64_t next_event_frame() = 0;
+  // hands every event due on or before frame to Synth::handle_event
+  virtual void dispatch_due_events(std::uint64_t frame, Synth &synth) = 0;
+};
+
+// a sound the synth can play, the oscillator is a mix of four waveforms run
+// through a one pole low pass, the envelope is attack decay sustain release
+struct SynthProgram {
+  std::string name;
+  float saw;
+  float square;
+  float triangle;
+  float sine;
+  // 0 - 1, how much of the oscillator the low pass lets through
+  float brightness;
+  float attack_sec;
+  float decay_sec;
+  float sustain; // 0 - 1
+  float release_sec;
+  float gain;
+};
+
+// the built in programs, a program change picks one by its index
+const std::vector<SynthProgram> &synth_programs();
+// index of the program with the given name, -1 when there isn't one
+int find_synth_program(const std::string &name);
+
+// a polyphonic synth that plays midi messages on the audio thread, so a jam
+// can be heard without anything listening on a midi port
+//
+// messages come in through send() into a lock free ring and are taken out at
+// the start of every render() call, render() never locks or allocates: the
+// voices live in fixed arrays laid out one field per array so four voices are
+// worked on at once with simd, and the program table is turned into per
+// sample coefficients up front
+//
+// voices that aren't playing cost nothing, all of them playing costs the same
+// every callback so the worst case is known up front, when every voice is
+// busy (or a channel is at its limit) the voice policy picks one to take over
+//
+// with a drum kit, notes on the kit's channels that have a sample play it
+// once through from the frame they arrive on instead of a synth voice, note
+// offs don't stop them
+class Synth {
+public:
+  static constexpr int max_voices = 64;
+  static constexpr int max_sample_voices = 32;
+
+  explicit Synth(double sample_rate);
+  ~Synth();
+
+  Synth(const Synth &) = delete;
+  Synth &operator=(const Synth &) = delete;
+
+  // producer end, one thread only, false when the ring is full and the
+  // message was dropped
+  bool send(std::uint8_t status, std::uint8_t data1, std::uint8_t data2 = 0);
+  // channel 1 - 16, goes through the ring like any other program change
+  bool set_program(int channel, int program);
+
+  // has to be given before the synth starts rendering, the kit has to be
+  // loaded at the synth's sample rate
+  void set_drum_kit(std::shared_ptr<const DrumKit> kit);
+
+  // has to be given before the synth starts rendering, the channel limits
+  // and stealing apply to the drum kit's sample voices too but a sample is
+  // never retriggered, two hits on a drum ring on together
+  void set_voice_policy(const VoicePolicy &policy);
+
+  // has to be given before the synth starts rendering and outlive it
+  void set_event_source(SynthEventSource *source) { event_source = source; }
+
+  // consumer end, fills interleaved stereo frames
+  void render(float *frames, std::uint32_t num_frames);
+  // plays a message straight away, only on the thread that renders
+  void handle_event(std::uint8_t status, std::uint8_t data1,
+                    std::uint8_t data2);
+
+  // plays the synth through the engine (and so from its data callback), the
+  // engine has to run at the synth's sample rate and outlive it or detach()
+  void attach(ma_engine &engine);
+  void detach();
+
+  double get_sample_rate() const { return sample_rate; }
+  // frames rendered so far against steady_clock, updated every render call
+  const FrameClock &get_frame_clock() const { return frame_clock; }
+  std::uint64_t get_num_dropped_messages() const {
+    return num_dropped_messages.load(std::memory_order_relaxed);
+  }
+  // synth and sample voices together
+  VoiceStats get_voice_stats() const;
+  int get_num_playing_voices() const {
+    return num_playing_voices.load(std::memory_order_relaxed);
+  }
+
+private:
+  static constexpr int num_groups = max_voices / 4;
+  // envelope stages and parameters are looked at this often
+  static constexpr std::uint32_t block_frames = 32;
+
+  enum class Stage : std::uint8_t { idle, attack, decay, release };
+
+  struct Message {
+    std::uint8_t status;
+    std::uint8_t data1;
+    std::uint8_t data2;
+  };
+
+  struct ProgramCoefficients {
+    float saw, square, triangle, sine;
+    float low_pass;
+    float attack, decay, sustain, release;
+    float gain;
+  };
+
+  struct SampleVoice {
+    const DrumSample *sample = nullptr;
+    std::uint64_t position = 0;
+    float velocity_gain = 0;
+    std::uint8_t channel = 0;
+  };
+
+  struct Channel {
+    int program = 0;
+    float volume = 100 / 127.0f;
+    float expression = 1;
+    float pan = 0.5f;
+    float bend_ratio = 1;
+    bool sustain_pedal = false;
+  };
+
+  void handle_message(const Message &message);
+  void note_on(int channel, int note, int velocity);
+  void play_sample(int channel, int note, const DrumSample &sample,
+                   int velocity);
+  void note_off(int channel, int note);
+  void control_change(int channel, int controller, int value);
+  void release_voice(int voice);
+  void free_voice(int voice);
+  void update_voices();
+  void render_block(float *frames, std::uint32_t num_frames);
+  void mix_samples(float *frames, std::uint32_t num_frames);
+
+  double sample_rate;
+  std::vector<ProgramCoefficients> programs;
+  Channel channels[16];
+
+  // voice v is lane v % 4 of group v / 4
+  float4 phase[num_groups] = {};
+  float4 increment[num_groups] = {};
+  float4 low_pass_state[num_groups] = {};
+  float4 low_pass[num_groups] = {};
+  float4 envelope[num_groups] = {};
+  float4 envelope_target[num_groups] = {};
+  float4 envelope_coefficient[num_groups] = {};
+  float4 gain_left[num_groups] = {};
+  float4 gain_right[num_groups] = {};
+  float4 saw[num_groups] = {};
+  float4 square[num_groups] = {};
+  float4 triangle[num_groups] = {};
+  float4 sine[num_groups] = {};
+  bool group_is_playing[num_groups] = {};
+
+  Stage stage[max_voices] = {};
+  std::uint8_t voice_channel[max_voices] = {};
+  std::uint8_t voice_note[max_voices] = {};
+  std::uint8_t voice_program[max_voices] = {};
+  bool is_sustained[max_voices] = {};
+  float velocity_gain[max_voices] = {};
+  float base_increment[max_voices] = {};
+  VoiceAllocator<max_voices> voice_allocator;
+
+  std::shared_ptr<const DrumKit> drum_kit;
+  SynthEventSource *event_source = nullptr;
+  std::uint64_t num_frames_rendered = 0;
+  FrameClock frame_clock;
+  SampleVoice sample_voices[max_sample_voices];
+  VoiceAllocator<max_sample_voices> sample_voice_allocator;
+
+  SpscRingBuffer<Message> messages{1 << 12};
+  std::atomic<std::uint64_t> num_dropped_messages{0};
+  std::atomic<int> num_playing_voices{0};
+
+  std::unique_ptr<SynthSoundSource> sound_source;
+};
+
+#endif // SYNTH_HPP
@@ -0,0 +1,279 @@
+#include "tempo_detection.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <stdexcept>
+#include <thread>
+
+namespace {
+
+constexpr double histogram_bin_sec = 0.005;
+// how much an interval is smeared over the histogram, covers timing slop
+constexpr double histogram_spread_sec = 0.01;
+constexpr int num_comb_teeth = 4;
+constexpr std::size_t max_candidates = 8;
+// how far refining may move a tempo before the fit is not trusted
+constexpr double max_refinement = 0.03;
+// taken off the fit for every doubling of steps per beat
+constexpr double subdivision_penalty = 0.03;
+
+struct Subdivision {
+  int note_value;
+  GridFeel feel;
+};
+
+constexpr Subdivision subdivisions[] = {
+    {4, GridFeel::straight},  {8, GridFeel::straight},
+    {16, GridFeel::straight}, {8, GridFeel::triplet},
+    {16, GridFeel::triplet},
+};
+
+std::vector<double> onset_times(const std::vector<CapturedMidiMessage> &events,
+                                double chord_window_sec) {
+  std::vector<double> times;
+  for (const CapturedMidiMessage &event : events) {
+    if (event.size == 3 && (event.bytes[0] & 0xF0) == 0x90 &&
+        event.bytes[2] > 0)
+      times.push_back(event.timestamp_sec);
+  }
+  std::sort(times.begin(), times.end());
+
+  std::vector<double> onsets;
+  for (double time : times) {
+    if (onsets.empty() || time - onsets.back() > chord_window_sec)
+      onsets.push_back(time);
+  }
+  return onsets;
+}
+
+std::vector<double> interval_histogram(const std::vector<double> &onsets,
+                                       double max_interval_sec) {
+  const auto num_bins =
+      static_cast<std::size_t>(max_interval_sec / histogram_bin_sec) + 2;
+  std::vector<double> histogram(num_bins, 0.0);
+
+  const int spread_bins =
+      static_cast<int>(std::ceil(3 * histogram_spread_sec / histogram_bin_sec));
+  std::vector<double> kernel(2 * spread_bins + 1);
+  for (int k = -spread_bins; k <= spread_bins; ++k) {
+    double x = k * histogram_bin_sec / histogram_spread_sec;
+    kernel[k + spread_bins] = std::exp(-0.5 * x * x);
+  }
+
+  for (std::size_t i = 0; i < onsets.size(); ++i) {
+    for (std::size_t j = i + 1; j < onsets.size(); ++j) {
+      const double interval = onsets[j] - onsets[i];
+      if (interval > max_interval_sec)
+        break;
+      const long center = std::lround(interval / histogram_bin_sec);
+      for (int k = -spread_bins; k <= spread_bins; ++k) {
+        const long bin = center + k;
+        if (bin >= 0 && bin < static_cast<long>(num_bins))
+          histogram[bin] += kernel[k + spread_bins];
+      }
+    }
+  }
+  return histogram;
+}
+
+double histogram_at(const std::vector<double> &histogram, double time_sec) {
+  const double position = time_sec / histogram_bin_sec;
+  const auto bin = static_cast<std::size_t>(position);
+  if (bin + 1 >= histogram.size())
+    return 0;
+  const double fraction = position - bin;
+  return histogram[bin] * (1 - fraction) + histogram[bin + 1] * fraction;
+}
+
+// 1 at 120 bpm, falling off by octaves, breaks the tie between a tempo and
+// its double or half which fit the same onsets
+double tempo_prior(double bpm) {
+  const double octaves = std::log2(bpm / 120.0);
+  return std::exp(-0.5 * octaves * octaves);
+}
+
+double distance_to_grid(double time_sec, double phase_sec, double step_sec) {
+  const double position = (time_sec - phase_sec) / step_sec;
+  return std::abs(position - std::round(position)) * step_sec;
+}
+
+// fits the onsets to a grid of the given step near the given tempo, returns
+// the estimate with its grid fit filled in
+TempoEstimate fit_grid(const std::vector<double> &onsets, double bpm,
+                       const Subdivision &subdivision) {
+  QuantizeSettings settings;
+  settings.bpm = bpm;
+  settings.note_value = subdivision.note_value;
+  settings.feel = subdivision.feel;
+  const double initial_step_sec = step_duration_sec(settings);
+  double step_sec = initial_step_sec;
+
+  // the phase within a step is the circular mean of where the onsets fall
+  double sum_sin = 0;
+  double sum_cos = 0;
+  for (double onset : onsets) {
+    double angle = 2 * M_PI * std::fmod(onset, step_sec) / step_sec;
+    sum_sin += std::sin(angle);
+    sum_cos += std::cos(angle);
+  }
+  double phase_sec = std::atan2(sum_sin, sum_cos) / (2 * M_PI) * step_sec;
+
+  // the played tempo is never exactly one of the tried ones, a least squares
+  // line through (grid line, onset time) gives the real step and phase
+  for (int iteration = 0; iteration < 2; ++iteration) {
+    double mean_n = 0;
+    double mean_t = 0;
+    std::vector<double> grid_lines(onsets.size());
+    for (std::size_t i = 0; i < onsets.size(); ++i) {
+      grid_lines[i] = std::round((onsets[i] - phase_sec) / step_sec);
+      mean_n += grid_lines[i];
+      mean_t += onsets[i];
+    }
+    mean_n /= onsets.size();
+    mean_t /= onsets.size();
+    double covariance = 0;
+    double variance = 0;
+    for (std::size_t i = 0; i < onsets.size(); ++i) {
+      covariance += (grid_lines[i] - mean_n) * (onsets[i] - mean_t);
+      variance += (grid_lines[i] - mean_n) * (grid_lines[i] - mean_n);
+    }
+    if (variance == 0)
+      break;
+    const double fitted_step_sec = covariance / variance;
+    if (std::abs(fitted_step_sec / initial_step_sec - 1) > max_refinement)
+      break;
+    step_sec = fitted_step_sec;
+    phase_sec = mean_t - step_sec * mean_n;
+  }
+
+  double fit = 0;
+  for (double onset : onsets)
+    fit += 1 - 2 * distance_to_grid(onset, phase_sec, step_sec) / step_sec;
+  fit /= onsets.size();
+
+  const double steps_per_beat = (60.0 / bpm) / initial_step_sec;
+  const double beat_sec = step_sec * steps_per_beat;
+  const int whole_steps_per_beat =
+      std::max(1, static_cast<int>(std::lround(steps_per_beat)));
+
+  // the beat is the step position the most onsets land on
+  std::vector<int> onsets_per_position(whole_steps_per_beat, 0);
+  for (double onset : onsets) {
+    long line = std::lround((onset - phase_sec) / step_sec);
+    ++onsets_per_position[((line % whole_steps_per_beat) +
+                           whole_steps_per_beat) %
+                          whole_steps_per_beat];
+  }
+  const int beat_position = static_cast<int>(
+      std::max_element(onsets_per_position.begin(),
+                       onsets_per_position.end()) -
+      onsets_per_position.begin());
+  double beat_phase_sec = phase_sec + beat_position * step_sec;
+  // moved to the beat at or just before the first onset, a first note played
+  // a little early still counts as on that beat
+  const double first = onsets.front() + step_sec / 2;
+  beat_phase_sec += std::floor((first - beat_phase_sec) / beat_sec) * beat_sec;
+
+  TempoEstimate estimate;
+  estimate.bpm = 60.0 / beat_sec;
+  estimate.phase_sec = beat_phase_sec;
+  estimate.note_value = subdivision.note_value;
+  estimate.feel = subdivision.feel;
+  estimate.grid_fit = fit;
+  estimate.score = fit - subdivision_penalty * std::log2(steps_per_beat);
+  if (subdivision.feel != GridFeel::straight)
+    estimate.score -= subdivision_penalty;
+  return estimate;
+}
+
+} // namespace
+
+TempoAnalysis detect_tempo(const std::vector<CapturedMidiMessage> &events,
+                           const TempoDetectionSettings &settings) {
+  TempoAnalysis analysis;
+  const std::vector<double> onsets =
+      onset_times(events, settings.chord_window_sec);
+  analysis.num_onsets = onsets.size();
+  if (onsets.size() < 4) {
+    throw std::runtime_error("At least 4 notes are needed to find a tempo");
+  }
+
+  const double slowest_beat_sec = 60.0 / settings.min_bpm;
+  const std::vector<double> histogram =
+      interval_histogram(onsets, num_comb_teeth * slowest_beat_sec);
+
+  // comb score of every tempo tried
+  std::vector<double> bpms;
+  std::vector<double> strengths;
+  for (double bpm = settings.min_bpm; bpm <= settings.max_bpm + 1e-9;
+       bpm += settings.bpm_resolution) {
+    const double beat_sec = 60.0 / bpm;
+    double strength = 0;
+    for (int tooth = 1; tooth <= num_comb_teeth; ++tooth)
+      strength += histogram_at(histogram, tooth * beat_sec) / std::sqrt(tooth);
+    bpms.push_back(bpm);
+    strengths.push_back(strength);
+  }
+  const double strongest =
+      std::max(*std::max_element(strengths.begin(), strengths.end()), 1e-9);
+
+  // the peaks, best first, a single tempo given as the range is its own peak
+  std::vector<std::size_t> peaks;
+  for (std::size_t i = 0; i < bpms.size(); ++i) {
+    bool is_peak = (i == 0 || strengths[i] >= strengths[i - 1]) &&
+                   (i + 1 == bpms.size() || strengths[i] > strengths[i + 1]);
+    if (is_peak)
+      peaks.push_back(i);
+  }
+  if (peaks.empty())
+    peaks.push_back(0);
+  std::sort(peaks.begin(), peaks.end(), [&](std::size_t a, std::size_t b) {
+    return strengths[a] * tempo_prior(bpms[a]) >
+           strengths[b] * tempo_prior(bpms[b]);
+  });
+  if (peaks.size() > max_candidates)
+    peaks.resize(max_candidates);
+
+  // every candidate tempo against every subdivision, spread over threads
+  const std::size_t num_subdivisions = std::size(subdivisions);
+  const std::size_t num_jobs = peaks.size() * num_subdivisions;
+  std::vector<TempoEstimate> fits(num_jobs);
+  std::atomic<std::size_t> next_job{0};
+  auto worker = [&]() {
+    for (std::size_t job = next_job++; job < num_jobs; job = next_job++) {
+      const std::size_t peak = peaks[job / num_subdivisions];
+      TempoEstimate &fit = fits[job];
+      fit = fit_grid(onsets, bpms[peak], subdivisions[job % num_subdivisions]);
+      fit.tempo_strength = strengths[peak] / strongest;
+      fit.score += 0.3 * fit.tempo_strength * tempo_prior(fit.bpm);
+    }
+  };
+
+  unsigned int num_threads = settings.num_threads;
+  if (num_threads == 0)
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  num_threads =
+      static_cast<unsigned int>(std::min<std::size_t>(num_threads, num_jobs));
+  std::vector<std::thread> threads;
+  for (unsigned int t = 0; t + 1 < num_threads; ++t)
+    threads.emplace_back(worker);
+  worker();
+  for (std::thread &thread : threads)
+    thread.join();
+
+  // the best subdivision of every tempo, best tempo first
+  for (std::size_t i = 0; i < peaks.size(); ++i) {
+    auto begin = fits.begin() + i * num_subdivisions;
+    analysis.candidates.push_back(*std::max_element(
+        begin, begin + num_subdivisions,
+        [](const TempoEstimate &a, const TempoEstimate &b) {
+          return a.score < b.score;
+        }));
+  }
+  std::sort(analysis.candidates.begin(), analysis.candidates.end(),
+            [](const TempoEstimate &a, const TempoEstimate &b) {
+              return a.score > b.score;
+            });
+  return analysis;
+}
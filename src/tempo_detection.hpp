@@ -0,0 +1,60 @@
+#ifndef TEMPO_DETECTION_HPP
+#define TEMPO_DETECTION_HPP
+
+#include <cstddef>
+#include <vector>
+
+#include "midi_recorder.hpp"
+#include "quantizer.hpp"
+
+struct TempoDetectionSettings {
+  double min_bpm = 60.0;
+  double max_bpm = 200.0;
+  // the spacing of the tempos tried before they are refined
+  double bpm_resolution = 0.5;
+  // note ons closer together than this are one onset (a chord)
+  double chord_window_sec = 0.03;
+  // 0 means one per core
+  unsigned int num_threads = 0;
+};
+
+// a tempo and grid that the onsets of a take fit
+struct TempoEstimate {
+  double bpm = 0;
+  // time of the first beat, at or just before the first onset, take this off
+  // the take to put the beats on the quantizer's grid
+  double phase_sec = 0;
+  int note_value = 16;
+  GridFeel feel = GridFeel::straight;
+  // how close the onsets are to the grid, 1 when they are all on it and
+  // around 0.5 for onsets that ignore it
+  double grid_fit = 0;
+  // how strongly the onsets repeat at this tempo, 1 for the strongest tempo
+  double tempo_strength = 0;
+  double score = 0;
+};
+
+struct TempoAnalysis {
+  std::size_t num_onsets = 0;
+  // best first
+  std::vector<TempoEstimate> candidates;
+};
+
+// finds the tempo, beat phase and subdivision of a freely played take from its
+// note on times alone:
+//
+// - every pair of onsets up to four slow beats apart is put into a smoothed
+//   histogram of inter onset intervals (which is the onsets' autocorrelation)
+// - every tempo in the range is scored with a comb over that histogram (the
+//   beat and its next few multiples) with a mild preference for tempos near
+//   120, the strongest peaks become candidates
+// - every candidate is fitted to each usual subdivision in parallel: the
+//   period and phase are refined with a least squares fit of the onsets to
+//   their nearest grid lines and the grid scored by how close the onsets are
+//   to it, finer grids have to fit clearly better to win
+//
+// throws when the take has fewer than 4 onsets
+TempoAnalysis detect_tempo(const std::vector<CapturedMidiMessage> &events,
+                           const TempoDetectionSettings &settings = {});
+
+#endif // TEMPO_DETECTION_HPP
@@ -0,0 +1,12 @@
+#include "voice_allocator.hpp"
+
+#include <stdexcept>
+
+VoiceStealing parse_voice_stealing(const std::string &name) {
+  if (name == "oldest")
+    return VoiceStealing::oldest;
+  if (name == "quietest")
+    return VoiceStealing::quietest;
+  throw std::runtime_error("Unknown voice stealing: " + name +
+                           " (oldest or quietest)");
+}
@@ -0,0 +1,257 @@
+#ifndef VOICE_ALLOCATOR_HPP
+#define VOICE_ALLOCATOR_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// which sounding voice gives way when a note needs one and there's none to
+// spare
+enum class VoiceStealing : std::uint8_t {
+  // the one that started first
+  oldest,
+  // the one that was quietest at the last block, which is usually a note
+  // nearly done with its release, falls back to the oldest when that voice was
+  // already taken since
+  quietest,
+};
+
+// "oldest" or "quietest", throws on anything else
+VoiceStealing parse_voice_stealing(const std::string &name);
+
+struct VoicePolicy {
+  VoiceStealing stealing = VoiceStealing::oldest;
+  // a note on for a note that is still sounding on the same channel takes its
+  // voice over instead of stacking another one on top
+  bool retrigger_same_note = true;
+  // the most voices channel c (0 - 15) may hold at once, 0 for no limit but
+  // the allocator's, a channel at its limit takes over one of its own voices
+  std::uint8_t channel_limits[16] = {};
+};
+
+// what the voice policy did to notes so far
+struct VoiceStats {
+  // notes that took over a voice because every voice was busy
+  std::uint64_t num_stolen = 0;
+  // notes that took over one of their channel's voices at its limit
+  std::uint64_t num_stolen_by_channel_limit = 0;
+  // notes that took over the voice of the same note still sounding
+  std::uint64_t num_retriggered = 0;
+
+  VoiceStats &operator+=(const VoiceStats &other) {
+    num_stolen += other.num_stolen;
+    num_stolen_by_channel_limit += other.num_stolen_by_channel_limit;
+    num_retriggered += other.num_retriggered;
+    return *this;
+  }
+};
+
+// hands out the voices of a synth, on the audio thread only: allocate() and
+// release() are O(1) and never lock or allocate, everything lives in fixed
+// arrays indexed by voice
+//
+// free voices are a stack, sounding voices are kept in the order they started
+// on a list threaded through prev / next arrays (one list over all voices and
+// one per channel) so the oldest is always at the head, and the voice a
+// channel's note last started on is looked up in a table so a retrigger needs
+// no search, the quietest voices are noted while the synth goes over its
+// voices once a block anyway
+//
+// the counters are written on the audio thread and may be read from
+// any thread
+template <int capacity> class VoiceAllocator {
+  static_assert(capacity > 0 && capacity < 256,
+                "voices and notes are kept in bytes");
+
+public:
+  // why allocate() handed out a voice that was still sounding
+  enum class Reuse : std::uint8_t { none, retriggered, stolen, channel_limit };
+
+  VoiceAllocator() {
+    // voice 0 comes off the stack first so the low voices fill up first
+    for (int voice = 0; voice < capacity; ++voice)
+      free_voices[voice] = static_cast<std::uint8_t>(capacity - 1 - voice);
+    for (auto &notes : note_voice) {
+      for (std::uint8_t &voice : notes)
+        voice = none;
+    }
+    for (int channel = 0; channel < 16; ++channel) {
+      channel_head[channel] = none;
+      channel_tail[channel] = none;
+      channel_quietest[channel] = none;
+    }
+  }
+
+  VoiceAllocator(const VoiceAllocator &) = delete;
+  VoiceAllocator &operator=(const VoiceAllocator &) = delete;
+
+  // before any voice is handed out
+  void set_policy(const VoicePolicy &new_policy) { policy = new_policy; }
+  const VoicePolicy &get_policy() const { return policy; }
+
+  // a voice for a note on channel 0 - 15, which from now on counts as the
+  // newest one sounding, reuse says whether (and why) it was taken from a note
+  // that was still sounding
+  int allocate(int channel, int note, Reuse &reuse) {
+    channel &= 0x0F;
+    note &= 0x7F;
+    const int retriggered = note_voice[channel][note];
+    int voice = none;
+    if (policy.retrigger_same_note && retriggered != none) {
+      voice = retriggered;
+      reuse = Reuse::retriggered;
+      bump(num_retriggered);
+    } else if (policy.channel_limits[channel] != 0 &&
+               channel_count[channel] >= policy.channel_limits[channel]) {
+      voice = victim(channel_quietest[channel], channel_head[channel]);
+      reuse = Reuse::channel_limit;
+      bump(num_stolen_by_channel_limit);
+    } else if (num_free > 0) {
+      reuse = Reuse::none;
+      voice = free_voices[--num_free];
+      is_sounding[voice] = true;
+      append(voice, channel, note);
+      return voice;
+    } else {
+      voice = victim(quietest, head);
+      reuse = Reuse::stolen;
+      bump(num_stolen);
+    }
+    unlink(voice);
+    append(voice, channel, note);
+    return voice;
+  }
+
+  // the voice has gone quiet and can be handed out again
+  void release(int voice) {
+    if (!is_sounding[voice])
+      return;
+    unlink(voice);
+    is_sounding[voice] = false;
+    free_voices[num_free++] = static_cast<std::uint8_t>(voice);
+  }
+
+  // the synth reports how loud each sounding voice is once a block, between
+  // begin_levels() and the next one, for the quietest policy
+  void begin_levels() {
+    quietest = none;
+    for (std::uint8_t &voice : channel_quietest)
+      voice = none;
+  }
+  void set_level(int voice, float level) {
+    if (policy.stealing != VoiceStealing::quietest)
+      return;
+    level_of[voice] = level;
+    if (quietest == none || level < level_of[quietest])
+      quietest = static_cast<std::uint8_t>(voice);
+    std::uint8_t &channel_voice = channel_quietest[voice_channel[voice]];
+    if (channel_voice == none || level < level_of[channel_voice])
+      channel_voice = static_cast<std::uint8_t>(voice);
+  }
+
+  int get_num_sounding() const { return capacity - num_free; }
+  VoiceStats get_stats() const {
+    VoiceStats stats;
+    stats.num_stolen = num_stolen.load(std::memory_order_relaxed);
+    stats.num_stolen_by_channel_limit =
+        num_stolen_by_channel_limit.load(std::memory_order_relaxed);
+    stats.num_retriggered = num_retriggered.load(std::memory_order_relaxed);
+    return stats;
+  }
+
+private:
+  static constexpr std::uint8_t none = 0xFF;
+
+  static void bump(std::atomic<std::uint64_t> &counter) {
+    counter.store(counter.load(std::memory_order_relaxed) + 1,
+                  std::memory_order_relaxed);
+  }
+
+  // the quietest candidate when stealing by level and it's still sounding on
+  // the list the candidate was picked from, the oldest otherwise
+  int victim(std::uint8_t quietest_candidate, std::uint8_t oldest) const {
+    if (policy.stealing == VoiceStealing::quietest &&
+        quietest_candidate != none && is_sounding[quietest_candidate])
+      return quietest_candidate;
+    return oldest;
+  }
+
+  void append(int voice, int channel, int note) {
+    voice_channel[voice] = static_cast<std::uint8_t>(channel);
+    voice_note[voice] = static_cast<std::uint8_t>(note);
+    note_voice[channel][note] = static_cast<std::uint8_t>(voice);
+    ++channel_count[channel];
+
+    prev[voice] = tail;
+    next[voice] = none;
+    if (tail == none)
+      head = static_cast<std::uint8_t>(voice);
+    else
+      next[tail] = static_cast<std::uint8_t>(voice);
+    tail = static_cast<std::uint8_t>(voice);
+
+    channel_prev[voice] = channel_tail[channel];
+    channel_next[voice] = none;
+    if (channel_tail[channel] == none)
+      channel_head[channel] = static_cast<std::uint8_t>(voice);
+    else
+      channel_next[channel_tail[channel]] = static_cast<std::uint8_t>(voice);
+    channel_tail[channel] = static_cast<std::uint8_t>(voice);
+  }
+
+  // takes a sounding voice off both lists and out of the note table, it stays
+  // marked as sounding
+  void unlink(int voice) {
+    const int channel = voice_channel[voice];
+    if (note_voice[channel][voice_note[voice]] == voice)
+      note_voice[channel][voice_note[voice]] = none;
+    --channel_count[channel];
+    if (quietest == voice)
+      quietest = none;
+    if (channel_quietest[channel] == voice)
+      channel_quietest[channel] = none;
+
+    (prev[voice] == none ? head : next[prev[voice]]) = next[voice];
+    (next[voice] == none ? tail : prev[next[voice]]) = prev[voice];
+
+    std::uint8_t &channel_first =
+        channel_prev[voice] == none ? channel_head[channel]
+                                    : channel_next[channel_prev[voice]];
+    channel_first = channel_next[voice];
+    std::uint8_t &channel_last =
+        channel_next[voice] == none ? channel_tail[channel]
+                                    : channel_prev[channel_next[voice]];
+    channel_last = channel_prev[voice];
+  }
+
+  VoicePolicy policy;
+
+  std::uint8_t free_voices[capacity];
+  int num_free = capacity;
+  bool is_sounding[capacity] = {};
+
+  std::uint8_t voice_channel[capacity] = {};
+  std::uint8_t voice_note[capacity] = {};
+  std::uint8_t note_voice[16][128];
+  int channel_count[16] = {};
+
+  // sounding voices from oldest to newest
+  std::uint8_t prev[capacity] = {};
+  std::uint8_t next[capacity] = {};
+  std::uint8_t head = none;
+  std::uint8_t tail = none;
+  std::uint8_t channel_prev[capacity] = {};
+  std::uint8_t channel_next[capacity] = {};
+  std::uint8_t channel_head[16];
+  std::uint8_t channel_tail[16];
+
+  float level_of[capacity] = {};
+  std::uint8_t quietest = none;
+  std::uint8_t channel_quietest[16];
+
+  std::atomic<std::uint64_t> num_stolen{0};
+  std::atomic<std::uint64_t> num_stolen_by_channel_limit{0};
+  std::atomic<std::uint64_t> num_retriggered{0};
+};
+
+#endif // VOICE_ALLOCATOR_HPP
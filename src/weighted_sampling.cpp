@@ -0,0 +1,107 @@
+#include "weighted_sampling.hpp"
+
+#include <cmath>
+#include <stdexcept>
+
+void Xoshiro256::jump() {
+  static const std::uint64_t jump_polynomial[] = {
+      0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL, 0xa9582618e03fc9aaULL,
+      0x39abdc4529b1661cULL};
+
+  std::uint64_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+  for (std::uint64_t word : jump_polynomial) {
+    for (int b = 0; b < 64; ++b) {
+      if (word & (1ULL << b)) {
+        s0 ^= state[0];
+        s1 ^= state[1];
+        s2 ^= state[2];
+        s3 ^= state[3];
+      }
+      (*this)();
+    }
+  }
+
+  state[0] = s0;
+  state[1] = s1;
+  state[2] = s2;
+  state[3] = s3;
+}
+
+// builds one alias row of n columns into the given output arrays
+void build_alias_row(const double *weights, std::size_t n,
+                     std::uint64_t *thresholds, std::uint32_t *aliases) {
+  if (n == 0) {
+    throw std::runtime_error("Cannot build an alias table with no weights");
+  }
+
+  double total = 0;
+  for (std::size_t i = 0; i < n; ++i) {
+    if (weights[i] < 0 || !std::isfinite(weights[i])) {
+      throw std::runtime_error("Alias table weights must be finite and >= 0");
+    }
+    total += weights[i];
+  }
+  if (total <= 0) {
+    throw std::runtime_error("Alias table weights must not all be zero");
+  }
+
+  // scale so that the average column holds exactly 1
+  std::vector<double> scaled(n);
+  std::vector<std::uint32_t> small, large;
+  small.reserve(n);
+  large.reserve(n);
+  for (std::size_t i = 0; i < n; ++i) {
+    scaled[i] = weights[i] * static_cast<double>(n) / total;
+    (scaled[i] < 1.0 ? small : large).push_back(static_cast<std::uint32_t>(i));
+  }
+
+  std::vector<double> probability(n, 1.0);
+  for (std::size_t i = 0; i < n; ++i) {
+    aliases[i] = static_cast<std::uint32_t>(i);
+  }
+
+  while (!small.empty() && !large.empty()) {
+    std::uint32_t less = small.back();
+    small.pop_back();
+    std::uint32_t more = large.back();
+    large.pop_back();
+
+    probability[less] = scaled[less];
+    aliases[less] = more;
+
+    scaled[more] = (scaled[more] + scaled[less]) - 1.0;
+    (scaled[more] < 1.0 ? small : large).push_back(more);
+  }
+
+  // whatever is left over is 1 up to floating point error
+  for (std::uint32_t i : large)
+    probability[i] = 1.0;
+  for (std::uint32_t i : small)
+    probability[i] = 1.0;
+
+  for (std::size_t i = 0; i < n; ++i) {
+    thresholds[i] =
+        static_cast<std::uint64_t>(std::llround(probability[i] * 4294967296.0));
+  }
+}
+
+AliasTable::AliasTable(const std::vector<double> &weights)
+    : thresholds(weights.size()), aliases(weights.size()) {
+  build_alias_row(weights.data(), weights.size(), thresholds.data(),
+                  aliases.data());
+}
+
+AliasRows::AliasRows(const std::vector<double> &row_major_weights,
+                     std::size_t row_length)
+    : row_length(row_length), thresholds(row_major_weights.size()),
+      aliases(row_major_weights.size()) {
+  if (row_length == 0 || row_major_weights.size() % row_length != 0) {
+    throw std::runtime_error("Alias rows must all have the same length");
+  }
+
+  for (std::size_t offset = 0; offset < row_major_weights.size();
+       offset += row_length) {
+    build_alias_row(row_major_weights.data() + offset, row_length,
+                    thresholds.data() + offset, aliases.data() + offset);
+  }
+}
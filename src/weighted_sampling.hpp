@@ -0,0 +1,123 @@
+#ifndef WEIGHTED_SAMPLING_HPP
+#define WEIGHTED_SAMPLING_HPP
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// xoshiro256** (Blackman & Vigna), a small and fast generator whose whole
+// state is 32 bytes, the state is filled from a single 64 bit seed through
+// splitmix64 so that every seed (including 0) gives a usable generator and the
+// same seed always produces the same stream on every platform, which is what
+// lets a generative song be reproduced from its seed
+class Xoshiro256 {
+public:
+  using result_type = std::uint64_t;
+
+  explicit Xoshiro256(std::uint64_t seed = 0) { reseed(seed); }
+
+  void reseed(std::uint64_t seed) {
+    for (std::uint64_t &word : state) {
+      seed += 0x9e3779b97f4a7c15ULL;
+      std::uint64_t z = seed;
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+      word = z ^ (z >> 31);
+    }
+  }
+
+  static constexpr result_type min() { return 0; }
+  static constexpr result_type max() {
+    return std::numeric_limits<result_type>::max();
+  }
+
+  result_type operator()() {
+    const std::uint64_t result = rotl(state[1] * 5, 7) * 9;
+    const std::uint64_t t = state[1] << 17;
+    state[2] ^= state[0];
+    state[3] ^= state[1];
+    state[1] ^= state[2];
+    state[0] ^= state[3];
+    state[2] ^= t;
+    state[3] = rotl(state[3], 45);
+    return result;
+  }
+
+  // uniform in [0, bound) using lemire's multiply-shift, no division and no
+  // distribution object needed per draw
+  std::uint32_t next_below(std::uint32_t bound) {
+    return static_cast<std::uint32_t>(((*this)() >> 32) * bound >> 32);
+  }
+
+  // uniform in [0, 1)
+  double next_double() { return ((*this)() >> 11) * 0x1.0p-53; }
+
+  // advances the state by 2^128 draws, calling this k times on a copy of a
+  // generator gives k non-overlapping streams from one seed
+  void jump();
+
+private:
+  static std::uint64_t rotl(std::uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+  }
+
+  std::uint64_t state[4];
+};
+
+// vose's alias method, built once in O(n) from a list of weights and then
+// sampled in O(1) with a single draw from the generator: the high 32 bits pick
+// a column and the low 32 bits flip that column's biased coin
+class AliasTable {
+public:
+  AliasTable() = default;
+  explicit AliasTable(const std::vector<double> &weights);
+
+  unsigned int sample(Xoshiro256 &rng) const {
+    const std::uint64_t bits = rng();
+    const auto column = static_cast<std::uint32_t>(
+        (bits >> 32) * static_cast<std::uint64_t>(thresholds.size()) >> 32);
+    const std::uint64_t coin = bits & 0xffffffffULL;
+    return coin < thresholds[column] ? column : aliases[column];
+  }
+
+  std::size_t size() const { return thresholds.size(); }
+  bool empty() const { return thresholds.empty(); }
+
+private:
+  // probability of keeping the column scaled to 2^32, stored in 64 bits so
+  // that a probability of exactly 1 is representable
+  std::vector<std::uint64_t> thresholds;
+  std::vector<std::uint32_t> aliases;
+};
+
+// many alias tables of the same length stored back to back in row-major
+// order, used for transition matrices where every state owns a row, keeping
+// them in two flat arrays avoids an allocation per row and keeps neighbouring
+// rows next to each other in memory
+class AliasRows {
+public:
+  AliasRows() = default;
+  // row_major_weights holds num_rows * row_length weights
+  AliasRows(const std::vector<double> &row_major_weights,
+            std::size_t row_length);
+
+  unsigned int sample(std::size_t row, Xoshiro256 &rng) const {
+    const std::uint64_t bits = rng();
+    const auto column = static_cast<std::uint32_t>(
+        (bits >> 32) * static_cast<std::uint64_t>(row_length) >> 32);
+    const std::size_t index = row * row_length + column;
+    const std::uint64_t coin = bits & 0xffffffffULL;
+    return coin < thresholds[index] ? column : aliases[index];
+  }
+
+  std::size_t num_rows() const {
+    return row_length == 0 ? 0 : thresholds.size() / row_length;
+  }
+
+private:
+  std::size_t row_length = 0;
+  std::vector<std::uint64_t> thresholds;
+  std::vector<std::uint32_t> aliases;
+};
+
+#endif // WEIGHTED_SAMPLING_HPP